@@ -0,0 +1,75 @@
+#ifndef NEURAL_NET_ALIGNED_ARRAY_H_
+#define NEURAL_NET_ALIGNED_ARRAY_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "macros.h"
+
+namespace network {
+
+// A fixed-size, heap-allocated array whose storage starts on a cache line
+// boundary, so that rows of weight matrices can be loaded with aligned vector
+// instructions.
+template <typename T>
+class AlignedArray {
+ public:
+  // The alignment of the storage, in bytes.
+  static constexpr size_t kAlignment = 64;
+
+  AlignedArray() = default;
+  ~AlignedArray() {
+    free(data_);
+  }
+  // Resizes the array to hold <size> elements, all set to zero. Old contents
+  // are discarded.
+  void Resize(size_t size) {
+    if (size != size_) {
+      free(data_);
+      data_ = nullptr;
+      size_ = 0;
+      void *memory;
+      if (size && !posix_memalign(&memory, kAlignment, size * sizeof(T))) {
+        data_ = static_cast<T *>(memory);
+        size_ = size;
+      }
+    }
+    if (data_) {
+      memset(data_, 0, size_ * sizeof(T));
+    }
+  }
+  // Returns the number of elements in the array.
+  inline size_t size() const {
+    return size_;
+  }
+  inline T *data() {
+    return data_;
+  }
+  inline const T *data() const {
+    return data_;
+  }
+  inline T &operator[](size_t i) {
+    return data_[i];
+  }
+  inline const T &operator[](size_t i) const {
+    return data_[i];
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(AlignedArray);
+
+ private:
+  T *data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Rounds <count> elements of type T up so that each row of a matrix starts on
+// an aligned boundary.
+template <typename T>
+inline size_t AlignedStride(size_t count) {
+  const size_t per_line = AlignedArray<T>::kAlignment / sizeof(T);
+  return (count + per_line - 1) / per_line * per_line;
+}
+
+} //network
+
+#endif
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <utility>
+
+#include "batch_scheduler.h"
+
+namespace network {
+
+constexpr size_t BatchScheduler::kDefaultMaxBatch;
+constexpr uint32_t BatchScheduler::kDefaultMaxWaitMicroseconds;
+
+BatchScheduler::BatchScheduler(const MFNetwork *network,
+                               size_t max_batch/* = kDefaultMaxBatch*/,
+                               uint32_t max_wait_microseconds/* =
+                                   kDefaultMaxWaitMicroseconds*/) :
+    network_(network),
+    max_batch_(max_batch ? max_batch : 1),
+    max_wait_(max_wait_microseconds),
+    batch_inputs_(max_batch_ * network->GetNumInputs()),
+    batch_outputs_(max_batch_ * network->GetNumOutputs()),
+    worker_(&BatchScheduler::WorkerLoop, this) {}
+
+BatchScheduler::~BatchScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  worker_.join();
+}
+
+std::future<std::vector<double> > BatchScheduler::Submit(
+    const double *inputs) {
+  Request request;
+  request.Inputs.assign(inputs, inputs + network_->GetNumInputs());
+  request.Arrival = Clock::now();
+  std::future<std::vector<double> > outputs = request.Outputs.get_future();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back(std::move(request));
+  }
+  condition_.notify_one();
+  return outputs;
+}
+
+void BatchScheduler::WorkerLoop() {
+  std::vector<Request> batch;
+  batch.reserve(max_batch_);
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      condition_.wait(lock, [this]() {
+        return stopping_ || !queue_.empty();
+      });
+      if (queue_.empty()) {
+        // We're stopping, and everything has been done.
+        return;
+      }
+      // Give other requests until the oldest one has waited long enough to
+      // join it. When we're stopping, there's no point in waiting.
+      const Clock::time_point deadline = queue_.front().Arrival + max_wait_;
+      condition_.wait_until(lock, deadline, [this]() {
+        return stopping_ || queue_.size() >= max_batch_;
+      });
+
+      const size_t size = std::min(queue_.size(), max_batch_);
+      for (size_t i = 0; i < size; ++i) {
+        batch.push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+      ++num_batches_;
+      num_requests_ += size;
+    }
+
+    RunBatch(&batch);
+    batch.clear();
+  }
+}
+
+void BatchScheduler::RunBatch(std::vector<Request> *batch) {
+  const uint32_t num_inputs = network_->GetNumInputs();
+  const uint32_t num_outputs = network_->GetNumOutputs();
+  for (size_t i = 0; i < batch->size(); ++i) {
+    std::copy((*batch)[i].Inputs.begin(), (*batch)[i].Inputs.end(),
+              batch_inputs_.begin() + i * num_inputs);
+  }
+
+  const bool success = network_->EvaluateBatch(
+      batch_inputs_.data(), batch->size(), batch_outputs_.data(), &workspace_);
+  for (size_t i = 0; i < batch->size(); ++i) {
+    std::vector<double> outputs;
+    if (success) {
+      outputs.assign(batch_outputs_.begin() + i * num_outputs,
+                     batch_outputs_.begin() + (i + 1) * num_outputs);
+    }
+    (*batch)[i].Outputs.set_value(std::move(outputs));
+  }
+}
+
+} //network
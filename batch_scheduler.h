@@ -0,0 +1,101 @@
+#ifndef NEURAL_NET_BATCH_SCHEDULER_H_
+#define NEURAL_NET_BATCH_SCHEDULER_H_
+
+// Serves lots of small, concurrent requests against one network by batching
+// them up. Callers submit a single set of inputs and get a future for the
+// outputs, and a worker thread gathers whatever requests are waiting into a
+// batch and runs it through the network all at once. A batch is run as soon
+// as it's full, or once its oldest request has waited long enough, so each
+// request gets delayed by at most that long in exchange for the much higher
+// throughput of batched matrix products.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "execution_plan.h"
+#include "macros.h"
+#include "multilayered_feedforward.h"
+
+namespace network {
+
+class BatchScheduler {
+ public:
+  // The defaults for the constructor.
+  static constexpr size_t kDefaultMaxBatch = 32;
+  static constexpr uint32_t kDefaultMaxWaitMicroseconds = 500;
+
+  // Starts a worker that runs batches of at most <max_batch> requests through
+  // <network>, waiting at most <max_wait_microseconds> after a request comes
+  // in for others to join it. <network> must already be compiled, and must
+  // not change or be destroyed while the scheduler is around.
+  explicit BatchScheduler(const MFNetwork *network,
+                          size_t max_batch = kDefaultMaxBatch,
+                          uint32_t max_wait_microseconds =
+                              kDefaultMaxWaitMicroseconds);
+  // Finishes any requests that have already been submitted, and stops the
+  // worker.
+  ~BatchScheduler();
+  // Queues up <inputs>, which are copied, and returns a future for the
+  // outputs. If the network can't be run, the outputs come back empty.
+  std::future<std::vector<double> > Submit(const double *inputs);
+  // The number of batches that have been run, and the number of requests
+  // that were in them, so that callers can see how well batching is working.
+  inline uint64_t GetNumBatches() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_batches_;
+  }
+  inline uint64_t GetNumRequests() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_requests_;
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(BatchScheduler);
+
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Request {
+    std::vector<double> Inputs;
+    std::promise<std::vector<double> > Outputs;
+    // When the request was submitted.
+    Clock::time_point Arrival;
+  };
+
+  // What the worker thread runs.
+  void WorkerLoop();
+  // Runs <batch> through the network and fulfills its promises.
+  void RunBatch(std::vector<Request> *batch);
+
+  const MFNetwork *network_;
+  const size_t max_batch_;
+  const std::chrono::microseconds max_wait_;
+  // Requests that haven't been picked up yet, oldest first.
+  std::deque<Request> queue_;
+  // Protects everything above and below, except for what only the worker
+  // uses.
+  std::mutex mutex_;
+  // Signalled when requests come in, or when it's time to stop.
+  std::condition_variable condition_;
+  bool stopping_ = false;
+  uint64_t num_batches_ = 0;
+  uint64_t num_requests_ = 0;
+  // Only used by the worker.
+  InferenceWorkspace workspace_;
+  std::vector<double> batch_inputs_;
+  std::vector<double> batch_outputs_;
+  // This comes last, so that everything it uses has been set up by the time
+  // it starts.
+  std::thread worker_;
+};
+
+} //network
+
+#endif
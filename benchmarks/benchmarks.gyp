@@ -0,0 +1,14 @@
+{
+  'targets': [
+    {
+      'target_name': 'hogwild_benchmark',
+      'type': 'executable',
+      'dependencies': [
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'hogwild_benchmark.cc',
+      ],
+    },
+  ],
+}
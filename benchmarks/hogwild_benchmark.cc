@@ -0,0 +1,161 @@
+// Compares how quickly the error comes down, in wall-clock time, when training
+// a network with sparse inputs with the ordinary single-threaded
+// SupervisedLearner::Learn(), and with asynchronous training on every core.
+//
+// Usage: hogwild_benchmark [seconds per mode]
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "../logger.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+#include "../supervised_learner.h"
+#include "../thread_pool.h"
+
+namespace {
+
+const uint32_t kNumInputs = 512;
+const uint32_t kNumOutputs = 4;
+const uint32_t kHiddenSize = 64;
+// How many of the inputs are on in each sample.
+const uint32_t kActiveInputs = 8;
+const uint32_t kNumSamples = 2000;
+
+typedef std::chrono::steady_clock Clock;
+
+// A made-up data set where each output depends on which few inputs are on,
+// like a bag of words.
+struct DataSet {
+  std::vector<double> Inputs;
+  std::vector<double> Targets;
+};
+
+void MakeDataSet(DataSet *data) {
+  std::vector<double> teacher(kNumInputs * kNumOutputs);
+  for (double& weight : teacher) {
+    weight = (rand() % 2000) / 1000.0 - 1;
+  }
+  data->Inputs.assign(kNumSamples * kNumInputs, 0);
+  data->Targets.resize(kNumSamples * kNumOutputs);
+  for (uint32_t sample_i = 0; sample_i < kNumSamples; ++sample_i) {
+    double *inputs = &data->Inputs[sample_i * kNumInputs];
+    double sums [kNumOutputs] = {};
+    for (uint32_t i = 0; i < kActiveInputs; ++i) {
+      const uint32_t input = rand() % kNumInputs;
+      inputs[input] = 1;
+      for (uint32_t j = 0; j < kNumOutputs; ++j) {
+        sums[j] += teacher[input * kNumOutputs + j];
+      }
+    }
+    for (uint32_t j = 0; j < kNumOutputs; ++j) {
+      data->Targets[sample_i * kNumOutputs + j] = 1 / (1 + exp(-sums[j]));
+    }
+  }
+}
+
+// Returns the mean squared error of <network> over all of <data>.
+double GetError(network::MFNetwork *network, const DataSet& data) {
+  std::vector<double> outputs(data.Targets.size());
+  if (!network->GetOutputsBatch(data.Inputs.data(), kNumSamples,
+                                outputs.data())) {
+    return NAN;
+  }
+  double error = 0;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    error += pow(data.Targets[i] - outputs[i], 2);
+  }
+  return error / outputs.size();
+}
+
+// Trains <network> one epoch at a time for <seconds>, printing the error
+// after each one, and returns the final error. Time spent measuring the
+// error doesn't count.
+double Run(const char *name, network::MFNetwork *network,
+           algorithm::SupervisedLearner *learner, const DataSet& data,
+           double seconds) {
+  printf("%s\n", name);
+  printf("%10s %10s %12s\n", "epoch", "seconds", "error");
+  double elapsed = 0;
+  double error = GetError(network, data);
+  printf("%10d %10.3f %12.6f\n", 0, elapsed, error);
+  for (int epoch = 1; elapsed < seconds; ++epoch) {
+    const Clock::time_point start = Clock::now();
+    if (!learner->Learn(0, 1)) {
+      fprintf(stderr, "Training failed.\n");
+      return NAN;
+    }
+    elapsed += std::chrono::duration<double>(Clock::now() - start).count();
+    error = GetError(network, data);
+    printf("%10d %10.3f %12.6f\n", epoch, elapsed, error);
+  }
+  printf("\n");
+  return error;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const double seconds = argc > 1 ? atof(argv[1]) : 5;
+  // Learn() warns every time it stops at the iteration limit.
+  helpers::Logger::Show(Level::ERROR);
+  srand(42);
+
+  DataSet data;
+  MakeDataSet(&data);
+
+  network::Sigmoid sigmoid;
+  network::MFNetwork single(kNumInputs, kNumOutputs, kHiddenSize);
+  single.AddHiddenLayer();
+  single.RandomWeights(-1, 1);
+  single.SetOutputFunctions(&sigmoid);
+  single.SetLearningRate(0.05);
+  single.SetMomentum(0);
+  if (!single.ForceWeightUpdate()) {
+    fprintf(stderr, "Failed to initialize the network.\n");
+    return 1;
+  }
+
+  // The same starting weights for both.
+  network::MFNetwork async(kNumInputs, kNumOutputs, kHiddenSize);
+  async.AddHiddenLayer();
+  std::vector<uint64_t> chromosome(single.GetChromosomeSize());
+  if (!single.GetChromosome(chromosome.data()) ||
+      !async.SetChromosome(chromosome.data())) {
+    fprintf(stderr, "Failed to copy the network.\n");
+    return 1;
+  }
+  async.SetOutputFunctions(&sigmoid);
+  async.SetLearningRate(0.05);
+  // Every core does its share, including the one that calls Learn(). The
+  // layers are too small to be worth splitting up as well.
+  const uint32_t cores = std::max(1U, std::thread::hardware_concurrency());
+  helpers::ThreadPool pool(cores - 1);
+  async.SetThreadPool(&pool, kHiddenSize + 1);
+
+  algorithm::SupervisedLearner single_learner(&single);
+  algorithm::SupervisedLearner async_learner(&async);
+  async_learner.SetAsynchronous(true);
+  for (uint32_t sample_i = 0; sample_i < kNumSamples; ++sample_i) {
+    single_learner.AddTrainingData(&data.Inputs[sample_i * kNumInputs],
+                                   &data.Targets[sample_i * kNumOutputs]);
+    async_learner.AddTrainingData(&data.Inputs[sample_i * kNumInputs],
+                                  &data.Targets[sample_i * kNumOutputs]);
+  }
+
+  const double single_error =
+      Run("Single-threaded Learn()", &single, &single_learner, data, seconds);
+  char name [64];
+  snprintf(name, sizeof(name), "Asynchronous Learn(), %u threads", cores);
+  const double async_error =
+      Run(name, &async, &async_learner, data, seconds);
+  printf("Error after %.1f seconds: %f single-threaded, %f asynchronous\n",
+         seconds, single_error, async_error);
+  return 0;
+}
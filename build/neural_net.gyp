@@ -4,6 +4,7 @@
       'target_name': 'neural_net_all',
       'type': 'none',
       'dependencies': [
+        '<(DEPTH)/benchmarks/benchmarks.gyp:*',
         '<(DEPTH)/tests/tests.gyp:*',
         '<(DEPTH)/libneuralnet.gyp:*',
       ],
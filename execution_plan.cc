@@ -0,0 +1,529 @@
+#include <algorithm>
+
+#include "execution_plan.h"
+#include "kernels.h"
+#include "logger.h"
+
+namespace network {
+namespace {
+
+// How many samples RunBatch() pushes through each row of weights at once.
+constexpr size_t kBatchBlock = 4;
+// The most samples RunBatch() keeps in the workspace at once. Bigger batches
+// get run in chunks of this many, so that the workspace doesn't grow with
+// the size of the batch.
+constexpr size_t kBatchChunk = 128;
+// How many columns go together when RunLayerTransposed() splits up a dense
+// layer. This is a whole number of vectors for every kernel, so each column
+// gets added up exactly the same way as when the layer isn't split, and keeps
+// different threads from writing to the same cache line.
+constexpr uint32_t kTransposeBlock = 16;
+
+} // namespace
+
+template <typename Scalar>
+void BasicInferenceWorkspace<Scalar>::Reserve(
+    const BasicExecutionPlan<Scalar>& plan, size_t count/* = 1*/) {
+  const size_t size = plan.GetMaxWidth() * count;
+  if (front_buffer_.size() < size) {
+    front_buffer_.resize(size);
+    back_buffer_.resize(size);
+  }
+}
+
+template <typename Scalar>
+BasicExecutionPlan<Scalar>::~BasicExecutionPlan() {
+  for (Layer *layer : layers_) {
+    delete layer;
+  }
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::Reset(uint32_t inputs) {
+  for (Layer *layer : layers_) {
+    delete layer;
+  }
+  layers_.clear();
+  output_indices_.clear();
+  num_inputs_ = inputs;
+  max_width_ = inputs;
+}
+
+template <typename Scalar>
+typename BasicExecutionPlan<Scalar>::Layer *
+BasicExecutionPlan<Scalar>::AddLayer(uint32_t outputs) {
+  Layer *layer = new Layer();
+  layer->Inputs = layers_.empty() ? num_inputs_ : layers_.back()->Outputs;
+  layer->Outputs = outputs;
+  layer->Stride = AlignedStride<Scalar>(layer->Inputs);
+  layer->Weights.Resize(layer->Stride * outputs);
+  layer->Biases.Resize(outputs);
+  layer->Impulses.assign(outputs, nullptr);
+  layers_.push_back(layer);
+
+  if (outputs > max_width_) {
+    max_width_ = outputs;
+  }
+
+  return layer;
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::FinishLayer(Layer *layer) {
+  layer->Type = GetCommonImpulseType(layer->Impulses, &layer->Parameter);
+
+  const size_t possible =
+      static_cast<size_t>(layer->Outputs) * layer->Inputs;
+  layer->Sparse = !layer->Connections.empty() &&
+      layer->Connections.size() <= max_sparse_density_ * possible;
+  if (layer->Sparse) {
+    BuildSparse(layer);
+  } else {
+    layer->RowStarts.clear();
+    layer->Columns.clear();
+    layer->RowWeights.clear();
+    layer->ColumnStarts.clear();
+    layer->Rows.clear();
+    layer->ColumnWeights.clear();
+  }
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::UpdateSparseWeights(Layer *layer) const {
+  if (!layer->Sparse) {
+    return;
+  }
+  for (uint32_t row = 0; row < layer->Outputs; ++row) {
+    const Scalar *weights = layer->Weights.data() + row * layer->Stride;
+    for (uint32_t i = layer->RowStarts[row]; i < layer->RowStarts[row + 1];
+         ++i) {
+      layer->RowWeights[i] = weights[layer->Columns[i]];
+    }
+  }
+  for (uint32_t column = 0; column < layer->Inputs; ++column) {
+    for (uint32_t i = layer->ColumnStarts[column];
+         i < layer->ColumnStarts[column + 1]; ++i) {
+      layer->ColumnWeights[i] =
+          layer->Weights[layer->Rows[i] * layer->Stride + column];
+    }
+  }
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::BuildSparse(Layer *layer) const {
+  const size_t count = layer->Connections.size();
+  layer->RowStarts.assign(layer->Outputs + 1, 0);
+  layer->Columns.resize(count);
+  layer->RowWeights.resize(count);
+  layer->ColumnStarts.assign(layer->Inputs + 1, 0);
+  layer->Rows.resize(count);
+  layer->ColumnWeights.resize(count);
+
+  // Connections is already in row order, so the CSR form falls right out of
+  // it. Count the connections in each row and column on the way.
+  for (size_t i = 0; i < count; ++i) {
+    const uint32_t row = layer->Connections[i] / layer->Inputs;
+    const uint32_t column = layer->Connections[i] % layer->Inputs;
+    layer->Columns[i] = column;
+    layer->RowWeights[i] = layer->Weights[row * layer->Stride + column];
+    ++layer->RowStarts[row + 1];
+    ++layer->ColumnStarts[column + 1];
+  }
+  for (uint32_t row = 0; row < layer->Outputs; ++row) {
+    layer->RowStarts[row + 1] += layer->RowStarts[row];
+  }
+  for (uint32_t column = 0; column < layer->Inputs; ++column) {
+    layer->ColumnStarts[column + 1] += layer->ColumnStarts[column];
+  }
+
+  // Going through the rows in order leaves each column sorted by row.
+  std::vector<uint32_t> next(layer->ColumnStarts.begin(),
+                             layer->ColumnStarts.end() - 1);
+  for (uint32_t row = 0; row < layer->Outputs; ++row) {
+    for (uint32_t i = layer->RowStarts[row]; i < layer->RowStarts[row + 1];
+         ++i) {
+      const uint32_t position = next[layer->Columns[i]]++;
+      layer->Rows[position] = row;
+      layer->ColumnWeights[position] = layer->RowWeights[i];
+    }
+  }
+}
+
+template <typename Scalar>
+bool BasicExecutionPlan<Scalar>::Run(
+    const Scalar *inputs, Scalar *outputs,
+    BasicInferenceWorkspace<Scalar> *workspace) const {
+  if (layers_.empty()) {
+    return false;
+  }
+  workspace->Reserve(*this);
+  RunFrom(0, inputs, outputs, workspace);
+  return true;
+}
+
+template <typename Scalar>
+bool BasicExecutionPlan<Scalar>::RunSparse(
+    const uint32_t *indices, const Scalar *values, size_t count,
+    Scalar *outputs, BasicInferenceWorkspace<Scalar> *workspace) const {
+  if (layers_.empty()) {
+    return false;
+  }
+  workspace->Reserve(*this);
+
+  const Layer *layer = layers_[0];
+  Scalar *const out = workspace->GetFrontBuffer();
+  if (layer->Sparse) {
+    // Add in the column of weights for each input, which the CSC form has
+    // all in one place.
+    for (uint32_t i = 0; i < layer->Outputs; ++i) {
+      out[i] = layer->Biases[i];
+    }
+    for (size_t k = 0; k < count; ++k) {
+      const uint32_t column = indices[k];
+      for (uint32_t i = layer->ColumnStarts[column];
+           i < layer->ColumnStarts[column + 1]; ++i) {
+        out[layer->Rows[i]] += layer->ColumnWeights[i] * values[k];
+      }
+    }
+    ApplyImpulses(layer, out, 0, layer->Outputs);
+  } else {
+    // The inputs are the sparse vector now, and we gather from each row.
+    SplitRows(layer->Outputs, [this, layer, indices, values, count, out](
+        uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        const Scalar *row = layer->Weights.data() + i * layer->Stride;
+        out[i] = layer->Biases[i] +
+            kernels::SparseDot(values, indices, count, row);
+      }
+      ApplyImpulses(layer, out, begin, end);
+    });
+  }
+
+  RunFrom(1, out, outputs, workspace);
+  return true;
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::RunFrom(
+    uint32_t layer_i, const Scalar *in, Scalar *outputs,
+    BasicInferenceWorkspace<Scalar> *workspace) const {
+  Scalar *const front = workspace->GetFrontBuffer();
+  Scalar *const back = workspace->GetBackBuffer();
+  for (; layer_i < layers_.size(); ++layer_i) {
+    // The output of each layer is the input to the next one.
+    Scalar *out = (in == front) ? back : front;
+    RunLayer(layer_i, in, out);
+    in = out;
+  }
+
+  for (uint32_t i = 0; i < output_indices_.size(); ++i) {
+    outputs[i] = in[output_indices_[i]];
+  }
+}
+
+template <typename Scalar>
+bool BasicExecutionPlan<Scalar>::BuildCone(const uint32_t *output_ids,
+                                           size_t count,
+                                           OutputCone *cone) const {
+  if (layers_.empty()) {
+    return false;
+  }
+  for (size_t i = 0; i < count; ++i) {
+    if (output_ids[i] >= output_indices_.size()) {
+      LOG(Level::ERROR, "Invalid output %u.", output_ids[i]);
+      return false;
+    }
+  }
+
+  cone->Outputs.assign(output_ids, output_ids + count);
+  cone->Rows.assign(layers_.size(), std::vector<uint32_t>());
+  // Which neurons in the current layer are needed.
+  std::vector<bool> needed(layers_.back()->Outputs, false);
+  for (size_t i = 0; i < count; ++i) {
+    needed[output_indices_[output_ids[i]]] = true;
+  }
+  for (int layer_i = layers_.size() - 1; layer_i >= 0; --layer_i) {
+    const Layer *layer = layers_[layer_i];
+    std::vector<uint32_t>& rows = cone->Rows[layer_i];
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      if (needed[row]) {
+        rows.push_back(row);
+      }
+    }
+
+    // Find the neurons in the layer before that feed the ones we need.
+    std::vector<bool> inputs_needed(layer->Inputs, layer->Connections.empty());
+    if (!layer->Connections.empty()) {
+      for (uint32_t row : rows) {
+        auto connection = std::lower_bound(layer->Connections.begin(),
+                                           layer->Connections.end(),
+                                           row * layer->Inputs);
+        const uint32_t row_end = (row + 1) * layer->Inputs;
+        for (; connection != layer->Connections.end() &&
+               *connection < row_end; ++connection) {
+          inputs_needed[*connection - row * layer->Inputs] = true;
+        }
+      }
+    }
+    needed.swap(inputs_needed);
+  }
+  return true;
+}
+
+template <typename Scalar>
+bool BasicExecutionPlan<Scalar>::RunCone(
+    const OutputCone& cone, const Scalar *inputs, Scalar *outputs,
+    BasicInferenceWorkspace<Scalar> *workspace) const {
+  if (layers_.empty() || cone.Rows.size() != layers_.size()) {
+    return false;
+  }
+  workspace->Reserve(*this);
+
+  Scalar *const front = workspace->GetFrontBuffer();
+  Scalar *const back = workspace->GetBackBuffer();
+  const Scalar *in = inputs;
+  for (uint32_t layer_i = 0; layer_i < layers_.size(); ++layer_i) {
+    // Neurons outside the cone aren't computed, since nothing depends on
+    // them. A dense layer after this one still multiplies them by the zero
+    // weights of the connections that don't exist, though, so they have to be
+    // zero rather than whatever an earlier call left there, which could be
+    // infinite or NaN.
+    Scalar *out = (in == front) ? back : front;
+    const Layer *layer = layers_[layer_i];
+    if (layer_i + 1 < layers_.size() && !layers_[layer_i + 1]->Sparse &&
+        cone.Rows[layer_i].size() < layer->Outputs) {
+      std::fill(out, out + layer->Outputs, 0);
+    }
+    for (uint32_t row : cone.Rows[layer_i]) {
+      out[row] = RunRow(layer, in, row);
+    }
+    in = out;
+  }
+
+  for (uint32_t i = 0; i < cone.Outputs.size(); ++i) {
+    outputs[i] = in[output_indices_[cone.Outputs[i]]];
+  }
+  return true;
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::RunLayer(uint32_t layer_i, const Scalar *in,
+                                          Scalar *out) const {
+  const Layer *layer = layers_[layer_i];
+  SplitRows(layer->Outputs, [this, layer, in, out](uint32_t begin,
+                                                   uint32_t end) {
+    RunRows(layer, in, out, begin, end);
+  });
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::RunLayerBatch(uint32_t layer_i,
+                                               const Scalar *in, size_t count,
+                                               Scalar *out) const {
+  const Layer *layer = layers_[layer_i];
+  SplitRows(layer->Outputs, [this, layer, in, count, out](uint32_t begin,
+                                                          uint32_t end) {
+    RunBatchRows(layer, in, count, out, begin, end);
+  });
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::RunLayerTransposed(uint32_t layer_i,
+                                                    const Scalar *in,
+                                                    Scalar *out) const {
+  const Layer *layer = layers_[layer_i];
+  if (layer->Sparse) {
+    // Each output only reads its own column, so these can be split up.
+    SplitRows(layer->Inputs, [layer, in, out](uint32_t begin, uint32_t end) {
+      for (uint32_t column = begin; column < end; ++column) {
+        const uint32_t start = layer->ColumnStarts[column];
+        out[column] = kernels::SparseDot(
+            layer->ColumnWeights.data() + start, layer->Rows.data() + start,
+            layer->ColumnStarts[column + 1] - start, in);
+      }
+    });
+  } else {
+    // Add up the rows, scaled by the values in <in>, so that the weights are
+    // still read in order. When there are enough outputs to split up, each
+    // block of columns does this for its own part of every row.
+    const uint32_t blocks =
+        (layer->Inputs + kTransposeBlock - 1) / kTransposeBlock;
+    auto work = [layer, in, out](uint32_t begin, uint32_t end) {
+      const uint32_t first = begin * kTransposeBlock;
+      const uint32_t last = std::min(end * kTransposeBlock, layer->Inputs);
+      for (uint32_t column = first; column < last; ++column) {
+        out[column] = 0;
+      }
+      for (uint32_t row = 0; row < layer->Outputs; ++row) {
+        kernels::Axpy(in[row],
+                      layer->Weights.data() + row * layer->Stride + first,
+                      out + first, last - first);
+      }
+    };
+    if (pool_ && layer->Inputs >= min_parallel_neurons_) {
+      pool_->ParallelFor(0, blocks, work);
+    } else {
+      work(0, blocks);
+    }
+  }
+}
+
+template <typename Scalar>
+bool BasicExecutionPlan<Scalar>::RunBatch(
+    const Scalar *inputs, size_t count, Scalar *outputs,
+    BasicInferenceWorkspace<Scalar> *workspace) const {
+  if (layers_.empty()) {
+    return false;
+  }
+  workspace->Reserve(*this, std::min(count, kBatchChunk));
+
+  Scalar *const front = workspace->GetFrontBuffer();
+  Scalar *const back = workspace->GetBackBuffer();
+  const uint32_t last_width = layers_.back()->Outputs;
+  const uint32_t num_outputs = output_indices_.size();
+  for (size_t first = 0; first < count; first += kBatchChunk) {
+    const size_t chunk = std::min(count - first, kBatchChunk);
+    const Scalar *in = inputs + first * num_inputs_;
+    Scalar *out = front;
+    for (uint32_t layer_i = 0; layer_i < layers_.size(); ++layer_i) {
+      RunLayerBatch(layer_i, in, chunk, out);
+      in = out;
+      out = (out == front) ? back : front;
+    }
+
+    Scalar *chunk_outputs = outputs + first * num_outputs;
+    for (size_t sample_i = 0; sample_i < chunk; ++sample_i) {
+      for (uint32_t i = 0; i < num_outputs; ++i) {
+        chunk_outputs[sample_i * num_outputs + i] =
+            in[sample_i * last_width + output_indices_[i]];
+      }
+    }
+  }
+  return true;
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::RunRows(const Layer *layer, const Scalar *in,
+                                         Scalar *out, uint32_t begin,
+                                         uint32_t end) const {
+  if (layer->Sparse) {
+    for (uint32_t i = begin; i < end; ++i) {
+      const uint32_t start = layer->RowStarts[i];
+      out[i] = layer->Biases[i] +
+          kernels::SparseDot(layer->RowWeights.data() + start,
+                             layer->Columns.data() + start,
+                             layer->RowStarts[i + 1] - start, in);
+    }
+  } else {
+    for (uint32_t i = begin; i < end; ++i) {
+      const Scalar *row = layer->Weights.data() + i * layer->Stride;
+      out[i] = layer->Biases[i] + kernels::Dot(row, in, layer->Inputs);
+    }
+  }
+  ApplyImpulses(layer, out, begin, end);
+}
+
+template <typename Scalar>
+Scalar BasicExecutionPlan<Scalar>::RunRow(const Layer *layer,
+                                          const Scalar *in,
+                                          uint32_t row) const {
+  Scalar value;
+  if (layer->Sparse) {
+    const uint32_t start = layer->RowStarts[row];
+    value = layer->Biases[row] +
+        kernels::SparseDot(layer->RowWeights.data() + start,
+                           layer->Columns.data() + start,
+                           layer->RowStarts[row + 1] - start, in);
+  } else {
+    value = layer->Biases[row] +
+        kernels::Dot(layer->Weights.data() + row * layer->Stride, in,
+                     layer->Inputs);
+  }
+  if (layer->Type != ImpulseType::CUSTOM) {
+    ApplyImpulse(layer->Type, layer->Parameter, &value, 1, layer->Accuracy);
+  } else {
+    value = layer->Impulses[row]->Function(value);
+  }
+  return value;
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::ApplyImpulses(const Layer *layer,
+                                               Scalar *values, uint32_t begin,
+                                               uint32_t end) const {
+  if (layer->Type != ImpulseType::CUSTOM) {
+    ApplyImpulse(layer->Type, layer->Parameter, values + begin, end - begin,
+                 layer->Accuracy);
+  } else {
+    for (uint32_t i = begin; i < end; ++i) {
+      values[i] = layer->Impulses[i]->Function(values[i]);
+    }
+  }
+}
+
+template <typename Scalar>
+void BasicExecutionPlan<Scalar>::RunBatchRows(const Layer *layer,
+                                              const Scalar *in, size_t count,
+                                              Scalar *out, uint32_t begin,
+                                              uint32_t end) const {
+  const uint32_t in_width = layer->Inputs;
+  const uint32_t out_width = layer->Outputs;
+
+  if (layer->Sparse) {
+    // Run every sample through each row while its weights are still in
+    // cache.
+    for (uint32_t i = begin; i < end; ++i) {
+      const uint32_t start = layer->RowStarts[i];
+      const uint32_t size = layer->RowStarts[i + 1] - start;
+      for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+        out[sample_i * out_width + i] = layer->Biases[i] +
+            kernels::SparseDot(layer->RowWeights.data() + start,
+                               layer->Columns.data() + start, size,
+                               in + sample_i * in_width);
+      }
+    }
+    for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+      ApplyImpulses(layer, out + sample_i * out_width, begin, end);
+    }
+    return;
+  }
+
+  // Work on a block of samples at a time, so that each row of weights gets
+  // loaded once per block instead of once per sample.
+  size_t sample_i = 0;
+  for (; sample_i + kBatchBlock <= count; sample_i += kBatchBlock) {
+    const Scalar *block[kBatchBlock];
+    for (size_t k = 0; k < kBatchBlock; ++k) {
+      block[k] = in + (sample_i + k) * in_width;
+    }
+    for (uint32_t i = begin; i < end; ++i) {
+      const Scalar *row = layer->Weights.data() + i * layer->Stride;
+      Scalar sums[kBatchBlock] = {0, 0, 0, 0};
+      kernels::Dot4(row, block, in_width, sums);
+      Scalar *out_i = out + sample_i * out_width + i;
+      for (size_t k = 0; k < kBatchBlock; ++k) {
+        out_i[k * out_width] = layer->Biases[i] + sums[k];
+      }
+    }
+  }
+  // Whatever doesn't fit evenly into a block.
+  for (; sample_i < count; ++sample_i) {
+    const Scalar *in_s = in + sample_i * in_width;
+    for (uint32_t i = begin; i < end; ++i) {
+      const Scalar *row = layer->Weights.data() + i * layer->Stride;
+      out[sample_i * out_width + i] =
+          layer->Biases[i] + kernels::Dot(row, in_s, in_width);
+    }
+  }
+
+  for (sample_i = 0; sample_i < count; ++sample_i) {
+    ApplyImpulses(layer, out + sample_i * out_width, begin, end);
+  }
+}
+
+template class BasicInferenceWorkspace<double>;
+template class BasicExecutionPlan<double>;
+template class BasicInferenceWorkspace<float>;
+template class BasicExecutionPlan<float>;
+
+} //network
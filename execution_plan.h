@@ -0,0 +1,311 @@
+#ifndef NEURAL_NET_EXECUTION_PLAN_H_
+#define NEURAL_NET_EXECUTION_PLAN_H_
+
+// A frozen, flat representation of a multilayered feedforward network. Each
+// layer is stored as a dense, row-major weight matrix with one row per neuron
+// and one column per neuron in the previous layer, plus a bias vector, so that
+// running the network is just a sequence of matrix-vector products. Layers
+// where only a few of the possible connections exist are also stored as
+// sparse matrices, which get used instead. Plans come in double and single
+// precision.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "aligned_array.h"
+#include "macros.h"
+#include "output_functions.h"
+#include "thread_pool.h"
+
+namespace network {
+
+template <typename Scalar>
+class BasicExecutionPlan;
+
+// Scratch space that layer activations are passed through while a plan runs.
+// Once it has been sized for a plan, running that plan doesn't allocate any
+// memory. Workspaces grow as needed, so one can be used with several plans.
+template <typename Scalar>
+class BasicInferenceWorkspace {
+ public:
+  BasicInferenceWorkspace() = default;
+  // Makes sure there is room to run <count> samples through <plan> at once.
+  void Reserve(const BasicExecutionPlan<Scalar>& plan, size_t count = 1);
+  inline Scalar *GetFrontBuffer() {
+    return front_buffer_.data();
+  }
+  inline Scalar *GetBackBuffer() {
+    return back_buffer_.data();
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(BasicInferenceWorkspace);
+
+ private:
+  // Layers read from one of these and write to the other.
+  std::vector<Scalar> front_buffer_;
+  std::vector<Scalar> back_buffer_;
+};
+
+template <typename Scalar>
+class BasicExecutionPlan {
+ public:
+  // The default for SetMaxSparseDensity().
+  static constexpr double kDefaultMaxSparseDensity = 0.15;
+
+  // A single compiled layer.
+  struct Layer {
+    // The number of values coming into this layer.
+    uint32_t Inputs;
+    // The number of neurons in this layer.
+    uint32_t Outputs;
+    // The distance, in elements, between the starts of two rows of Weights.
+    uint32_t Stride;
+    // Row <i> holds the weights that neuron <i> applies to each output of the
+    // previous layer. Connections that don't exist are zero.
+    AlignedArray<Scalar> Weights;
+    AlignedArray<Scalar> Biases;
+    // The connections that actually exist, as row * Inputs + column, in
+    // increasing order. This is empty if every neuron is connected to every
+    // input.
+    std::vector<uint32_t> Connections;
+    // Whether the sparse matrices below are in use. FinishLayer() turns this
+    // on when few enough connections exist.
+    bool Sparse = false;
+    // The existing weights in compressed sparse row (CSR) form. The weights
+    // of neuron <i> are RowWeights[RowStarts[i]] up to, but not including,
+    // RowWeights[RowStarts[i + 1]], and Columns holds the input that each one
+    // applies to.
+    std::vector<uint32_t> RowStarts;
+    std::vector<uint32_t> Columns;
+    std::vector<Scalar> RowWeights;
+    // The same weights in compressed sparse column (CSC) form, which is what
+    // products with the transpose of the weights need.
+    std::vector<uint32_t> ColumnStarts;
+    std::vector<uint32_t> Rows;
+    std::vector<Scalar> ColumnWeights;
+    // The impulse function for each neuron.
+    std::vector<ImpulseFunction *> Impulses;
+    // If every neuron uses the same kind of built-in impulse function, this
+    // is it, and it gets applied to the whole layer at once. Otherwise, it's
+    // CUSTOM, and we go through Impulses one neuron at a time.
+    ImpulseType Type = ImpulseType::CUSTOM;
+    // The parameter for Type.
+    double Parameter = 0;
+    // How accurately to compute Type.
+    ImpulseAccuracy Accuracy = ImpulseAccuracy::EXACT;
+  };
+
+  // The neurons that a subset of the network outputs depend on, as found by
+  // BuildCone().
+  struct OutputCone {
+    // The network outputs in the subset, in the order they were asked for.
+    std::vector<uint32_t> Outputs;
+    // For each layer, the neurons that need to be computed, in increasing
+    // order.
+    std::vector<std::vector<uint32_t> > Rows;
+  };
+
+  BasicExecutionPlan() = default;
+  ~BasicExecutionPlan();
+  // Discards all layers and starts a new plan for a network with <inputs>
+  // inputs.
+  void Reset(uint32_t inputs);
+  // Appends a layer with <outputs> neurons, taking its inputs from the layer
+  // added before it. All weights and biases start at zero. Returns the layer so
+  // that the caller can fill it in.
+  Layer *AddLayer(uint32_t outputs);
+  // Must be called once the weights, connections and impulse functions for
+  // <layer> have been filled in, and again whenever any of them change.
+  // Figures out whether the impulse functions can be applied to the layer as
+  // a whole, and builds the sparse matrices if the layer is sparse enough.
+  void FinishLayer(Layer *layer);
+  // Copies the dense weights of <layer> into its sparse matrices, if it has
+  // any. This is much cheaper than FinishLayer() when only the values of the
+  // weights have changed, and never allocates.
+  void UpdateSparseWeights(Layer *layer) const;
+  // Specifies which neuron in the last layer feeds each of the network
+  // outputs.
+  inline void SetOutputIndices(const std::vector<uint32_t>& indices) {
+    output_indices_ = indices;
+  }
+  inline const std::vector<uint32_t>& GetOutputIndices() const {
+    return output_indices_;
+  }
+  // Replaces this plan with a copy of <source>, converting the weights to our
+  // precision. The impulse functions are shared with <source>.
+  template <typename Other>
+  void CopyFrom(const BasicExecutionPlan<Other>& source);
+  // Runs <inputs> through the network and writes the results to <outputs>,
+  // using <workspace> for scratch space. Returns false if the plan is empty.
+  bool Run(const Scalar *inputs, Scalar *outputs,
+           BasicInferenceWorkspace<Scalar> *workspace) const;
+  // Like Run(), but for inputs that are mostly zero. Only the <count> inputs
+  // at <indices> are nonzero, with the values in <values>, and each index
+  // should only appear once. The first layer only reads the weights for
+  // those inputs.
+  bool RunSparse(const uint32_t *indices, const Scalar *values, size_t count,
+                 Scalar *outputs,
+                 BasicInferenceWorkspace<Scalar> *workspace) const;
+  // Works backwards from the <count> network outputs in <output_ids> to find
+  // every neuron that they depend on, and stores them in <cone>. Returns false
+  // if the plan is empty or any of the outputs don't exist. The cone is only
+  // good until the plan changes.
+  bool BuildCone(const uint32_t *output_ids, size_t count,
+                 OutputCone *cone) const;
+  // Like Run(), but only computes the neurons in <cone>, and only writes the
+  // outputs in it to <outputs>, in the same order.
+  bool RunCone(const OutputCone& cone, const Scalar *inputs, Scalar *outputs,
+               BasicInferenceWorkspace<Scalar> *workspace) const;
+  // Runs only the layer at <layer_i>. <in> holds the outputs of the layer
+  // before it, (or the network inputs, for the first layer,) and the outputs
+  // of this layer get written to <out>.
+  void RunLayer(uint32_t layer_i, const Scalar *in, Scalar *out) const;
+  // The same thing, for <count> samples laid out one after another, like they
+  // are for RunBatch().
+  void RunLayerBatch(uint32_t layer_i, const Scalar *in, size_t count,
+                     Scalar *out) const;
+  // Multiplies the transpose of the weights of the layer at <layer_i> by
+  // <in>, which holds one value for each neuron, and writes one value for
+  // each input to <out>. This is how errors flow backwards through a layer in
+  // back propagation. Biases and impulse functions play no part. With a
+  // thread pool, layers with enough inputs get split up by input.
+  void RunLayerTransposed(uint32_t layer_i, const Scalar *in,
+                          Scalar *out) const;
+  // Runs <count> samples through the network at once. <inputs> holds the
+  // inputs for each sample one after the other, and the outputs get written
+  // to <outputs> the same way. Each layer becomes a single matrix-matrix
+  // product over the whole batch. Big batches get run a chunk at a time, so
+  // the workspace only ever needs room for a chunk. Returns false if the
+  // plan is empty.
+  bool RunBatch(const Scalar *inputs, size_t count, Scalar *outputs,
+                BasicInferenceWorkspace<Scalar> *workspace) const;
+  // Returns the number of inputs the plan expects.
+  inline uint32_t GetNumInputs() const {
+    return num_inputs_;
+  }
+  // Returns the number of outputs the plan produces.
+  inline uint32_t GetNumOutputs() const {
+    return output_indices_.size();
+  }
+  // Returns the number of compiled layers. (The input layer simply passes
+  // values through, so it does not get one.)
+  inline uint32_t GetNumLayers() const {
+    return layers_.size();
+  }
+  inline const Layer *GetLayer(uint32_t layer_i) const {
+    return layers_[layer_i];
+  }
+  // Call FinishLayer() again after changing the connections or impulse
+  // functions of the layer returned by this, or UpdateSparseWeights() after
+  // changing only its weights.
+  inline Layer *GetLayer(uint32_t layer_i) {
+    return layers_[layer_i];
+  }
+  // Lets layers with at least <min_neurons> neurons split their neurons
+  // across the workers in <pool>. Passing nullptr turns this off, which is the
+  // default. This survives Reset().
+  inline void SetThreadPool(helpers::ThreadPool *pool, uint32_t min_neurons) {
+    pool_ = pool;
+    min_parallel_neurons_ = min_neurons;
+  }
+  // Layers where at most this fraction of the possible connections exist get
+  // sparse matrices. Gathering the inputs for each connection costs several
+  // times as much as a dense product, so this only pays off once most of
+  // them are missing. (For layers too big to stay in cache, the dense product
+  // waits on memory, and sparse matrices win up to about half.) This takes
+  // effect the next time each layer is finished, and survives Reset().
+  inline void SetMaxSparseDensity(double density) {
+    max_sparse_density_ = density;
+  }
+  // Returns the number of values in the widest layer, including the inputs.
+  inline uint32_t GetMaxWidth() const {
+    return max_width_;
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(BasicExecutionPlan);
+
+ private:
+  // Runs the layers from <layer_i> on, starting with the values in <in>,
+  // which are either the network inputs or in one of the buffers in
+  // <workspace>, and writes the network outputs to <outputs>.
+  void RunFrom(uint32_t layer_i, const Scalar *in, Scalar *outputs,
+               BasicInferenceWorkspace<Scalar> *workspace) const;
+  // Computes neurons <begin> through <end> - 1 of <layer> for the values in
+  // <in>, writing them to the same places in <out>.
+  void RunRows(const Layer *layer, const Scalar *in, Scalar *out,
+               uint32_t begin, uint32_t end) const;
+  // Computes neuron <row> of <layer>, including its impulse function, for
+  // the values in <in>.
+  Scalar RunRow(const Layer *layer, const Scalar *in, uint32_t row) const;
+  // Applies the impulse functions for neurons <begin> through <end> - 1 of
+  // <layer> to the weighted sums for those neurons in <values>.
+  void ApplyImpulses(const Layer *layer, Scalar *values, uint32_t begin,
+                     uint32_t end) const;
+  // Builds the sparse matrices for <layer> from its dense weights.
+  void BuildSparse(Layer *layer) const;
+  // The same thing, for <count> samples laid out one after another.
+  void RunBatchRows(const Layer *layer, const Scalar *in, size_t count,
+                    Scalar *out, uint32_t begin, uint32_t end) const;
+  // Calls <work> with ranges that together cover <rows> neurons, in parallel
+  // if we have a thread pool and there are enough of them.
+  template <typename Work>
+  void SplitRows(uint32_t rows, const Work& work) const {
+    if (pool_ && rows >= min_parallel_neurons_) {
+      pool_->ParallelFor(0, rows, work);
+    } else {
+      work(0, rows);
+    }
+  }
+
+  uint32_t num_inputs_ = 0;
+  // The compiled layers, in order. We are responsible for freeing these.
+  std::vector<Layer *> layers_;
+  // The last layer neuron that feeds each network output.
+  std::vector<uint32_t> output_indices_;
+  // The number of neurons in the widest layer.
+  uint32_t max_width_ = 0;
+  // Workers to split up wide layers with, if there are any.
+  helpers::ThreadPool *pool_ = nullptr;
+  // The smallest layer that gets split up.
+  uint32_t min_parallel_neurons_ = 0;
+  // The densest layer that gets sparse matrices.
+  double max_sparse_density_ = kDefaultMaxSparseDensity;
+};
+
+// This needs a definition outside the class before C++17.
+template <typename Scalar>
+constexpr double BasicExecutionPlan<Scalar>::kDefaultMaxSparseDensity;
+
+typedef BasicInferenceWorkspace<double> InferenceWorkspace;
+typedef BasicExecutionPlan<double> ExecutionPlan;
+typedef BasicInferenceWorkspace<float> InferenceWorkspaceF32;
+typedef BasicExecutionPlan<float> ExecutionPlanF32;
+
+template <typename Scalar>
+template <typename Other>
+void BasicExecutionPlan<Scalar>::CopyFrom(
+    const BasicExecutionPlan<Other>& source) {
+  Reset(source.GetNumInputs());
+  for (uint32_t layer_i = 0; layer_i < source.GetNumLayers(); ++layer_i) {
+    const typename BasicExecutionPlan<Other>::Layer *from =
+        source.GetLayer(layer_i);
+    Layer *to = AddLayer(from->Outputs);
+    for (uint32_t row = 0; row < from->Outputs; ++row) {
+      for (uint32_t column = 0; column < from->Inputs; ++column) {
+        to->Weights[row * to->Stride + column] =
+            from->Weights[row * from->Stride + column];
+      }
+      to->Biases[row] = from->Biases[row];
+    }
+    to->Connections = from->Connections;
+    to->Impulses = from->Impulses;
+    to->Accuracy = from->Accuracy;
+    FinishLayer(to);
+  }
+  SetOutputIndices(source.GetOutputIndices());
+}
+
+} //network
+
+#endif
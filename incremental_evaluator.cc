@@ -0,0 +1,203 @@
+#include <cmath>
+
+#include "incremental_evaluator.h"
+#include "kernels.h"
+
+namespace network {
+
+constexpr double IncrementalEvaluator::kDefaultMaxChangedFraction;
+constexpr uint32_t IncrementalEvaluator::kDefaultRefreshInterval;
+
+IncrementalEvaluator::IncrementalEvaluator(const ExecutionPlan *plan) :
+    plan_(plan) {
+  Reset();
+}
+
+void IncrementalEvaluator::Reset() {
+  layers_.resize(plan_->GetNumLayers());
+  for (uint32_t layer_i = 0; layer_i < layers_.size(); ++layer_i) {
+    const uint32_t size = plan_->GetLayer(layer_i)->Outputs;
+    layers_[layer_i].Sums.assign(size, 0);
+    layers_[layer_i].Outputs.assign(size, 0);
+    layers_[layer_i].Finite = false;
+  }
+  inputs_.assign(plan_->GetNumInputs(), 0);
+
+  // Make room for the most changes any layer could have, so that Evaluate()
+  // doesn't allocate anything.
+  const uint32_t max_width = plan_->GetMaxWidth();
+  for (std::vector<uint32_t> *indices :
+       {&changes_, &next_changes_, &touched_rows_}) {
+    indices->clear();
+    indices->reserve(max_width);
+  }
+  for (std::vector<double> *deltas : {&deltas_, &next_deltas_}) {
+    deltas->clear();
+    deltas->reserve(max_width);
+  }
+  touched_.assign(max_width, false);
+  values_.resize(max_width);
+  primed_ = false;
+}
+
+bool IncrementalEvaluator::Evaluate(const double *inputs, double *outputs) {
+  if (!plan_->GetNumLayers()) {
+    return false;
+  }
+
+  bool refresh = false;
+  if (!primed_ || ++calls_since_refresh_ >= refresh_interval_) {
+    refresh = true;
+    primed_ = true;
+    calls_since_refresh_ = 0;
+  }
+
+  changes_.clear();
+  deltas_.clear();
+  for (uint32_t i = 0; i < inputs_.size(); ++i) {
+    if (inputs[i] != inputs_[i]) {
+      changes_.push_back(i);
+      deltas_.push_back(inputs[i] - inputs_[i]);
+      inputs_[i] = inputs[i];
+    }
+  }
+
+  incremental_layers_ = 0;
+  const double *in = inputs_.data();
+  for (uint32_t layer_i = 0; layer_i < layers_.size(); ++layer_i) {
+    const ExecutionPlan::Layer *layer = plan_->GetLayer(layer_i);
+    next_changes_.clear();
+    next_deltas_.clear();
+    if (refresh ||
+        changes_.size() > max_changed_fraction_ * layer->Inputs ||
+        !layers_[layer_i].Finite || !DeltasFinite()) {
+      RunFull(layer_i, in);
+    } else {
+      RunDelta(layer_i);
+      ++incremental_layers_;
+    }
+    changes_.swap(next_changes_);
+    deltas_.swap(next_deltas_);
+    in = layers_[layer_i].Outputs.data();
+  }
+
+  const std::vector<uint32_t>& output_indices = plan_->GetOutputIndices();
+  for (uint32_t i = 0; i < output_indices.size(); ++i) {
+    outputs[i] = in[output_indices[i]];
+  }
+  return true;
+}
+
+bool IncrementalEvaluator::DeltasFinite() const {
+  for (double delta : deltas_) {
+    if (!std::isfinite(delta)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void IncrementalEvaluator::RunFull(uint32_t layer_i, const double *in) {
+  const ExecutionPlan::Layer *layer = plan_->GetLayer(layer_i);
+  std::vector<double>& sums = layers_[layer_i].Sums;
+  bool finite = true;
+  for (uint32_t row = 0; row < layer->Outputs; ++row) {
+    if (layer->Sparse) {
+      const uint32_t start = layer->RowStarts[row];
+      sums[row] = layer->Biases[row] +
+          kernels::SparseDot(layer->RowWeights.data() + start,
+                             layer->Columns.data() + start,
+                             layer->RowStarts[row + 1] - start, in);
+    } else {
+      sums[row] = layer->Biases[row] +
+          kernels::Dot(layer->Weights.data() + row * layer->Stride, in,
+                       layer->Inputs);
+    }
+    finite = finite && std::isfinite(sums[row]);
+  }
+  layers_[layer_i].Finite = finite;
+  UpdateAllOutputs(layer_i);
+}
+
+void IncrementalEvaluator::RunDelta(uint32_t layer_i) {
+  const ExecutionPlan::Layer *layer = plan_->GetLayer(layer_i);
+  std::vector<double>& sums = layers_[layer_i].Sums;
+  if (!layer->Sparse) {
+    // Every neuron sees every change, so they all need to be recomputed.
+    for (uint32_t i = 0; i < changes_.size(); ++i) {
+      const double *column = layer->Weights.data() + changes_[i];
+      for (uint32_t row = 0; row < layer->Outputs; ++row) {
+        sums[row] += column[row * layer->Stride] * deltas_[i];
+      }
+    }
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      if (!std::isfinite(sums[row])) {
+        layers_[layer_i].Finite = false;
+      }
+    }
+    if (!changes_.empty()) {
+      UpdateAllOutputs(layer_i);
+    }
+    return;
+  }
+
+  // Only the neurons connected to a changed input need to be recomputed.
+  touched_rows_.clear();
+  for (uint32_t i = 0; i < changes_.size(); ++i) {
+    const uint32_t column = changes_[i];
+    for (uint32_t k = layer->ColumnStarts[column];
+         k < layer->ColumnStarts[column + 1]; ++k) {
+      const uint32_t row = layer->Rows[k];
+      sums[row] += layer->ColumnWeights[k] * deltas_[i];
+      if (!touched_[row]) {
+        touched_[row] = true;
+        touched_rows_.push_back(row);
+      }
+    }
+  }
+  for (uint32_t row : touched_rows_) {
+    if (!std::isfinite(sums[row])) {
+      layers_[layer_i].Finite = false;
+    }
+    double output = sums[row];
+    if (layer->Type != ImpulseType::CUSTOM) {
+      ApplyImpulse(layer->Type, layer->Parameter, &output, 1,
+                   layer->Accuracy);
+    } else {
+      output = layer->Impulses[row]->Function(output);
+    }
+    UpdateOutput(layer_i, row, output);
+    touched_[row] = false;
+  }
+}
+
+void IncrementalEvaluator::UpdateAllOutputs(uint32_t layer_i) {
+  const ExecutionPlan::Layer *layer = plan_->GetLayer(layer_i);
+  const std::vector<double>& sums = layers_[layer_i].Sums;
+  if (layer->Type != ImpulseType::CUSTOM) {
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      values_[row] = sums[row];
+    }
+    ApplyImpulse(layer->Type, layer->Parameter, values_.data(),
+                 layer->Outputs, layer->Accuracy);
+  } else {
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      values_[row] = layer->Impulses[row]->Function(sums[row]);
+    }
+  }
+  for (uint32_t row = 0; row < layer->Outputs; ++row) {
+    UpdateOutput(layer_i, row, values_[row]);
+  }
+}
+
+void IncrementalEvaluator::UpdateOutput(uint32_t layer_i, uint32_t row,
+                                        double output) {
+  double& old_output = layers_[layer_i].Outputs[row];
+  if (output != old_output) {
+    next_changes_.push_back(row);
+    next_deltas_.push_back(output - old_output);
+    old_output = output;
+  }
+}
+
+} //network
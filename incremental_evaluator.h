@@ -0,0 +1,111 @@
+#ifndef NEURAL_NET_INCREMENTAL_EVALUATOR_H_
+#define NEURAL_NET_INCREMENTAL_EVALUATOR_H_
+
+// Runs an execution plan over a stream of inputs that only change a little
+// from one call to the next, like readings from a bank of sensors. It keeps
+// the weighted sum for every neuron from the last call, and when only a few of
+// the values coming into a layer have changed, it adds in the difference each
+// of them makes instead of computing the whole layer again. Changes are only
+// passed on to the next layer for the neurons whose outputs actually changed.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "execution_plan.h"
+#include "macros.h"
+
+namespace network {
+
+class IncrementalEvaluator {
+ public:
+  // The default for SetMaxChangedFraction().
+  static constexpr double kDefaultMaxChangedFraction = 0.25;
+  // The default for SetRefreshInterval().
+  static constexpr uint32_t kDefaultRefreshInterval = 1000;
+
+  // <plan> must outlive the evaluator. Call Reset() whenever it changes.
+  explicit IncrementalEvaluator(const ExecutionPlan *plan);
+  // Forgets everything from previous calls, so that the next one computes the
+  // whole network.
+  void Reset();
+  // Runs <inputs> through the plan and writes the results to <outputs>, only
+  // recomputing what depends on the inputs that changed since the last call.
+  // Returns false if the plan is empty.
+  bool Evaluate(const double *inputs, double *outputs);
+  // When more than this fraction of the values coming into a layer have
+  // changed, the layer is just computed from scratch, which is cheaper than
+  // going through each change on its own.
+  inline void SetMaxChangedFraction(double fraction) {
+    max_changed_fraction_ = fraction;
+  }
+  // Each change adds a little rounding error to the sums that it touches, so
+  // every <interval> calls, the whole network gets computed from scratch.
+  // (Layers where a change or a sum isn't finite always are, since the
+  // difference it makes can't be added in and taken back out again.)
+  inline void SetRefreshInterval(uint32_t interval) {
+    refresh_interval_ = interval;
+  }
+  // Returns how many layers were updated incrementally, rather than from
+  // scratch, during the last call.
+  inline uint32_t GetIncrementalLayers() const {
+    return incremental_layers_;
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(IncrementalEvaluator);
+
+ private:
+  // What we remember about each layer.
+  struct LayerState {
+    // The weighted sum for each neuron, before the impulse function.
+    std::vector<double> Sums;
+    // The output of each neuron.
+    std::vector<double> Outputs;
+    // Whether all of Sums are finite. Adding changes to an infinite or NaN
+    // sum can't bring it back, so until they are, the layer gets computed
+    // from scratch.
+    bool Finite = false;
+  };
+
+  // Returns true if every one of deltas_ is finite.
+  bool DeltasFinite() const;
+  // Computes every neuron in the layer at <layer_i> from <in>.
+  void RunFull(uint32_t layer_i, const double *in);
+  // Adds the differences in changes_ and deltas_ into the sums for the layer
+  // at <layer_i>, and recomputes the neurons that they touch.
+  void RunDelta(uint32_t layer_i);
+  // Applies the impulse functions to the sums for every neuron in the layer
+  // at <layer_i>, and stores the results.
+  void UpdateAllOutputs(uint32_t layer_i);
+  // Stores the new output of neuron <row> of the layer at <layer_i>, and
+  // records it in the changes for the next layer if it's different.
+  void UpdateOutput(uint32_t layer_i, uint32_t row, double output);
+
+  const ExecutionPlan *plan_;
+  std::vector<LayerState> layers_;
+  // The inputs from the last call.
+  std::vector<double> inputs_;
+  // Which values coming into the current layer changed, and by how much.
+  std::vector<uint32_t> changes_;
+  std::vector<double> deltas_;
+  // The same, for the layer after it, while the current one is running.
+  std::vector<uint32_t> next_changes_;
+  std::vector<double> next_deltas_;
+  // Marks the neurons of the current layer that have been touched by a
+  // change.
+  std::vector<bool> touched_;
+  std::vector<uint32_t> touched_rows_;
+  // Scratch space for applying impulse functions to a whole layer.
+  std::vector<double> values_;
+  // Whether there is anything to remember from the last call.
+  bool primed_ = false;
+  // Calls since everything was last computed from scratch.
+  uint32_t calls_since_refresh_ = 0;
+  double max_changed_fraction_ = kDefaultMaxChangedFraction;
+  uint32_t refresh_interval_ = kDefaultRefreshInterval;
+  uint32_t incremental_layers_ = 0;
+};
+
+} //network
+
+#endif
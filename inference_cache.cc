@@ -0,0 +1,112 @@
+#include <string.h>
+
+#include "inference_cache.h"
+
+namespace network {
+
+constexpr uint32_t InferenceCache::kDefaultShards;
+
+InferenceCache::InferenceCache(size_t capacity, uint32_t shards) :
+    shards_(shards ? shards : 1),
+    hits_(0),
+    misses_(0) {
+  // Round up, so that the cache can always hold at least <capacity> entries
+  // when they're spread evenly.
+  shard_capacity_ = (capacity + shards_.size() - 1) / shards_.size();
+}
+
+bool InferenceCache::Lookup(const double *inputs, size_t num_inputs,
+                            uint64_t version, double *outputs,
+                            size_t num_outputs) {
+  const uint64_t hash = Hash(inputs, num_inputs);
+  Shard *shard = GetShard(hash);
+  {
+    std::lock_guard<std::mutex> lock(shard->Mutex);
+    auto found = shard->Index.find(hash);
+    if (found != shard->Index.end()) {
+      const Entry& entry = *found->second;
+      if (entry.Version == version && entry.Inputs.size() == num_inputs &&
+          entry.Outputs.size() == num_outputs &&
+          !memcmp(entry.Inputs.data(), inputs,
+                  sizeof(inputs[0]) * num_inputs)) {
+        memcpy(outputs, entry.Outputs.data(),
+               sizeof(outputs[0]) * num_outputs);
+        // Move it to the front of the line.
+        shard->Entries.splice(shard->Entries.begin(), shard->Entries,
+                              found->second);
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void InferenceCache::Insert(const double *inputs, size_t num_inputs,
+                            uint64_t version, const double *outputs,
+                            size_t num_outputs) {
+  if (!shard_capacity_) {
+    return;
+  }
+  const uint64_t hash = Hash(inputs, num_inputs);
+  Shard *shard = GetShard(hash);
+  std::lock_guard<std::mutex> lock(shard->Mutex);
+
+  auto found = shard->Index.find(hash);
+  if (found != shard->Index.end()) {
+    // Either stale, or different inputs with the same hash. Either way, the
+    // new one replaces it.
+    shard->Entries.erase(found->second);
+    shard->Index.erase(found);
+  } else if (shard->Entries.size() >= shard_capacity_) {
+    shard->Index.erase(shard->Entries.back().Hash);
+    shard->Entries.pop_back();
+  }
+
+  shard->Entries.emplace_front();
+  Entry& entry = shard->Entries.front();
+  entry.Hash = hash;
+  entry.Version = version;
+  entry.Inputs.assign(inputs, inputs + num_inputs);
+  entry.Outputs.assign(outputs, outputs + num_outputs);
+  shard->Index[hash] = shard->Entries.begin();
+}
+
+void InferenceCache::Clear() {
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.Mutex);
+    shard.Entries.clear();
+    shard.Index.clear();
+  }
+}
+
+size_t InferenceCache::GetSize() {
+  size_t size = 0;
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard.Mutex);
+    size += shard.Entries.size();
+  }
+  return size;
+}
+
+uint64_t InferenceCache::Hash(const double *inputs, size_t num_inputs) {
+  // Mixes in each input with a multiply and a rotate, and finishes with the
+  // SplitMix64 finalizer so that every bit of the inputs affects every bit of
+  // the hash.
+  uint64_t hash = 0x9e3779b97f4a7c15ULL ^ num_inputs;
+  for (size_t i = 0; i < num_inputs; ++i) {
+    uint64_t bits;
+    memcpy(&bits, &inputs[i], sizeof(bits));
+    hash = (hash ^ bits) * 0xff51afd7ed558ccdULL;
+    hash = (hash << 29) | (hash >> 35);
+  }
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  hash ^= hash >> 31;
+  return hash;
+}
+
+} //network
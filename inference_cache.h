@@ -0,0 +1,91 @@
+#ifndef NEURAL_NET_INFERENCE_CACHE_H_
+#define NEURAL_NET_INFERENCE_CACHE_H_
+
+// A bounded cache of network outputs, keyed on the exact inputs that
+// produced them, for workloads that see the same inputs over and over. It is
+// split into shards, each with its own lock and its own least-recently-used
+// list, so that threads looking up different inputs rarely wait on each
+// other.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "macros.h"
+
+namespace network {
+
+class InferenceCache {
+ public:
+  // The default number of shards.
+  static constexpr uint32_t kDefaultShards = 16;
+
+  // Holds at most <capacity> sets of outputs, spread over <shards> shards.
+  explicit InferenceCache(size_t capacity, uint32_t shards = kDefaultShards);
+  // If the outputs for the <num_inputs> values in <inputs> are in the cache,
+  // and they were computed with weights at <version>, writes them to
+  // <outputs> and returns true. Otherwise, returns false.
+  bool Lookup(const double *inputs, size_t num_inputs, uint64_t version,
+              double *outputs, size_t num_outputs);
+  // Stores the outputs for <inputs>, evicting the least recently used entry
+  // in the shard if it's full.
+  void Insert(const double *inputs, size_t num_inputs, uint64_t version,
+              const double *outputs, size_t num_outputs);
+  // Throws away every entry. The counters are left alone.
+  void Clear();
+  // The number of lookups that did and didn't find what they were looking
+  // for, since the cache was created or the counters were last reset.
+  inline uint64_t GetHits() const {
+    return hits_.load(std::memory_order_relaxed);
+  }
+  inline uint64_t GetMisses() const {
+    return misses_.load(std::memory_order_relaxed);
+  }
+  inline void ResetCounters() {
+    hits_.store(0, std::memory_order_relaxed);
+    misses_.store(0, std::memory_order_relaxed);
+  }
+  // Returns the number of entries in the cache.
+  size_t GetSize();
+
+  DISSALOW_COPY_AND_ASSIGN(InferenceCache);
+
+ private:
+  struct Entry {
+    uint64_t Hash;
+    // The weight version that the outputs were computed with.
+    uint64_t Version;
+    std::vector<double> Inputs;
+    std::vector<double> Outputs;
+  };
+
+  struct Shard {
+    std::mutex Mutex;
+    // Most recently used first.
+    std::list<Entry> Entries;
+    // Where each hash is in Entries. Two different inputs with the same hash
+    // just take turns in the cache.
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> Index;
+  };
+
+  // Hashes the bytes of <inputs>.
+  static uint64_t Hash(const double *inputs, size_t num_inputs);
+  inline Shard *GetShard(uint64_t hash) {
+    return &shards_[(hash >> 32) % shards_.size()];
+  }
+
+  std::vector<Shard> shards_;
+  // The most entries each shard can hold.
+  size_t shard_capacity_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+} //network
+
+#endif
@@ -0,0 +1,1111 @@
+#include <math.h>
+
+#include "kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define NEURAL_NET_X86_KERNELS
+#include <immintrin.h>
+#endif
+
+namespace network {
+namespace kernels {
+namespace {
+
+// A complete set of kernels for one instruction set.
+struct KernelTable {
+  double (*Dot)(const double *a, const double *b, size_t size);
+  void (*Dot4)(const double *weights, const double *const *inputs,
+               size_t size, double *sums);
+  void (*Axpy)(double alpha, const double *x, double *y, size_t size);
+  void (*MomentumUpdate)(double scale, double momentum, const double *inputs,
+                         double *deltas, double *weights, size_t size);
+  void (*NesterovUpdate)(double scale, double momentum, const double *inputs,
+                         double *velocities, double *weights, size_t size);
+  void (*RmsUpdate)(double scale, double decay, double gain, double rate,
+                    double epsilon, const double *inputs, double *squares,
+                    double *weights, size_t size);
+  void (*AdamUpdate)(double scale, double beta1, double beta2, double rate,
+                     double epsilon, const double *inputs, double *means,
+                     double *squares, double *weights, size_t size);
+  float (*DotF32)(const float *a, const float *b, size_t size);
+  void (*Dot4F32)(const float *weights, const float *const *inputs,
+                  size_t size, float *sums);
+  int32_t (*DotInt8)(const int8_t *a, const int8_t *b, size_t size);
+  double (*SparseDot)(const double *values, const uint32_t *indices,
+                      size_t size, const double *x);
+  float (*SparseDotF32)(const float *values, const uint32_t *indices,
+                        size_t size, const float *x);
+  void (*AxpyF32)(float alpha, const float *x, float *y, size_t size);
+};
+
+// Scalar versions, which work everywhere. The SIMD versions also use these to
+// finish off whatever doesn't fill a whole vector.
+
+double ScalarDot(const double *a, const double *b, size_t size) {
+  double sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void ScalarDot4(const double *weights, const double *const *inputs,
+                size_t size, double *sums) {
+  for (size_t i = 0; i < size; ++i) {
+    sums[0] += weights[i] * inputs[0][i];
+    sums[1] += weights[i] * inputs[1][i];
+    sums[2] += weights[i] * inputs[2][i];
+    sums[3] += weights[i] * inputs[3][i];
+  }
+}
+
+float ScalarDot(const float *a, const float *b, size_t size) {
+  float sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += a[i] * b[i];
+  }
+  return sum;
+}
+
+void ScalarDot4(const float *weights, const float *const *inputs,
+                size_t size, float *sums) {
+  for (size_t i = 0; i < size; ++i) {
+    sums[0] += weights[i] * inputs[0][i];
+    sums[1] += weights[i] * inputs[1][i];
+    sums[2] += weights[i] * inputs[2][i];
+    sums[3] += weights[i] * inputs[3][i];
+  }
+}
+
+int32_t ScalarDotInt8(const int8_t *a, const int8_t *b, size_t size) {
+  int32_t sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += static_cast<int32_t>(a[i]) * b[i];
+  }
+  return sum;
+}
+
+double ScalarSparseDot(const double *values, const uint32_t *indices,
+                       size_t size, const double *x) {
+  double sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += values[i] * x[indices[i]];
+  }
+  return sum;
+}
+
+float ScalarSparseDot(const float *values, const uint32_t *indices,
+                      size_t size, const float *x) {
+  float sum = 0;
+  for (size_t i = 0; i < size; ++i) {
+    sum += values[i] * x[indices[i]];
+  }
+  return sum;
+}
+
+void ScalarAxpy(double alpha, const double *x, double *y, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+void ScalarAxpy(float alpha, const float *x, float *y, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+void ScalarMomentumUpdate(double scale, double momentum, const double *inputs,
+                          double *deltas, double *weights, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    double delta = scale * inputs[i];
+    delta += deltas[i] * momentum;
+    weights[i] += delta;
+    deltas[i] = delta;
+  }
+}
+
+void ScalarNesterovUpdate(double scale, double momentum, const double *inputs,
+                          double *velocities, double *weights, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const double step = scale * inputs[i];
+    const double velocity = momentum * velocities[i] + step;
+    weights[i] += step + momentum * velocity;
+    velocities[i] = velocity;
+  }
+}
+
+void ScalarRmsUpdate(double scale, double decay, double gain, double rate,
+                     double epsilon, const double *inputs, double *squares,
+                     double *weights, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const double gradient = scale * inputs[i];
+    const double square = decay * squares[i] + gain * gradient * gradient;
+    weights[i] += rate * gradient / (sqrt(square) + epsilon);
+    squares[i] = square;
+  }
+}
+
+void ScalarAdamUpdate(double scale, double beta1, double beta2, double rate,
+                      double epsilon, const double *inputs, double *means,
+                      double *squares, double *weights, size_t size) {
+  for (size_t i = 0; i < size; ++i) {
+    const double gradient = scale * inputs[i];
+    const double mean = beta1 * means[i] + (1 - beta1) * gradient;
+    const double square = beta2 * squares[i] +
+                          (1 - beta2) * gradient * gradient;
+    weights[i] += rate * mean / (sqrt(square) + epsilon);
+    means[i] = mean;
+    squares[i] = square;
+  }
+}
+
+#ifdef NEURAL_NET_X86_KERNELS
+
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define TARGET_AVX512 __attribute__((target("avx512f")))
+
+// SSE2: two doubles per vector.
+
+TARGET_SSE2 inline double HorizontalSum128(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+TARGET_SSE2 double Sse2Dot(const double *a, const double *b, size_t size) {
+  __m128d sum0 = _mm_setzero_pd();
+  __m128d sum1 = _mm_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    sum0 = _mm_add_pd(sum0, _mm_mul_pd(_mm_loadu_pd(a + i),
+                                       _mm_loadu_pd(b + i)));
+    sum1 = _mm_add_pd(sum1, _mm_mul_pd(_mm_loadu_pd(a + i + 2),
+                                       _mm_loadu_pd(b + i + 2)));
+  }
+  return HorizontalSum128(_mm_add_pd(sum0, sum1)) +
+         ScalarDot(a + i, b + i, size - i);
+}
+
+TARGET_SSE2 void Sse2Dot4(const double *weights, const double *const *inputs,
+                          size_t size, double *sums) {
+  __m128d sum[4] = {_mm_setzero_pd(), _mm_setzero_pd(), _mm_setzero_pd(),
+                    _mm_setzero_pd()};
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    const __m128d w = _mm_loadu_pd(weights + i);
+    for (int k = 0; k < 4; ++k) {
+      sum[k] = _mm_add_pd(sum[k], _mm_mul_pd(w, _mm_loadu_pd(inputs[k] + i)));
+    }
+  }
+  for (int k = 0; k < 4; ++k) {
+    sums[k] += HorizontalSum128(sum[k]);
+  }
+  const double *tails[4] = {inputs[0] + i, inputs[1] + i, inputs[2] + i,
+                            inputs[3] + i};
+  ScalarDot4(weights + i, tails, size - i, sums);
+}
+
+// SSE2 also has four floats per vector.
+
+TARGET_SSE2 inline float HorizontalSum128(__m128 v) {
+  const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+  return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+}
+
+TARGET_SSE2 float Sse2Dot(const float *a, const float *b, size_t size) {
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_loadu_ps(a + i),
+                                       _mm_loadu_ps(b + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+                                       _mm_loadu_ps(b + i + 4)));
+  }
+  return HorizontalSum128(_mm_add_ps(sum0, sum1)) +
+         ScalarDot(a + i, b + i, size - i);
+}
+
+TARGET_SSE2 void Sse2Dot4(const float *weights, const float *const *inputs,
+                          size_t size, float *sums) {
+  __m128 sum[4] = {_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps(),
+                   _mm_setzero_ps()};
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m128 w = _mm_loadu_ps(weights + i);
+    for (int k = 0; k < 4; ++k) {
+      sum[k] = _mm_add_ps(sum[k], _mm_mul_ps(w, _mm_loadu_ps(inputs[k] + i)));
+    }
+  }
+  for (int k = 0; k < 4; ++k) {
+    sums[k] += HorizontalSum128(sum[k]);
+  }
+  const float *tails[4] = {inputs[0] + i, inputs[1] + i, inputs[2] + i,
+                           inputs[3] + i};
+  ScalarDot4(weights + i, tails, size - i, sums);
+}
+
+// SSE2 has no instruction for sign-extending bytes, but unpacking a byte into
+// the top of a 16-bit lane and shifting it back down does the same thing.
+TARGET_SSE2 int32_t Sse2DotInt8(const int8_t *a, const int8_t *b,
+                                size_t size) {
+  __m128i sum = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m128i va =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    const __m128i vb =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    const __m128i a_low = _mm_srai_epi16(_mm_unpacklo_epi8(va, va), 8);
+    const __m128i a_high = _mm_srai_epi16(_mm_unpackhi_epi8(va, va), 8);
+    const __m128i b_low = _mm_srai_epi16(_mm_unpacklo_epi8(vb, vb), 8);
+    const __m128i b_high = _mm_srai_epi16(_mm_unpackhi_epi8(vb, vb), 8);
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(a_low, b_low));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(a_high, b_high));
+  }
+  alignas(16) int32_t lanes[4];
+  _mm_store_si128(reinterpret_cast<__m128i *>(lanes), sum);
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3] +
+         ScalarDotInt8(a + i, b + i, size - i);
+}
+
+TARGET_SSE2 void Sse2Axpy(double alpha, const double *x, double *y,
+                          size_t size) {
+  const __m128d a = _mm_set1_pd(alpha);
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i),
+                                    _mm_mul_pd(a, _mm_loadu_pd(x + i))));
+  }
+  ScalarAxpy(alpha, x + i, y + i, size - i);
+}
+
+TARGET_SSE2 void Sse2Axpy(float alpha, const float *x, float *y,
+                          size_t size) {
+  const __m128 a = _mm_set1_ps(alpha);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm_storeu_ps(y + i, _mm_add_ps(_mm_loadu_ps(y + i),
+                                    _mm_mul_ps(a, _mm_loadu_ps(x + i))));
+  }
+  ScalarAxpy(alpha, x + i, y + i, size - i);
+}
+
+TARGET_SSE2 void Sse2MomentumUpdate(double scale, double momentum,
+                                    const double *inputs, double *deltas,
+                                    double *weights, size_t size) {
+  const __m128d s = _mm_set1_pd(scale);
+  const __m128d m = _mm_set1_pd(momentum);
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    const __m128d delta =
+        _mm_add_pd(_mm_mul_pd(s, _mm_loadu_pd(inputs + i)),
+                   _mm_mul_pd(_mm_loadu_pd(deltas + i), m));
+    _mm_storeu_pd(weights + i, _mm_add_pd(_mm_loadu_pd(weights + i), delta));
+    _mm_storeu_pd(deltas + i, delta);
+  }
+  ScalarMomentumUpdate(scale, momentum, inputs + i, deltas + i, weights + i,
+                       size - i);
+}
+
+TARGET_SSE2 void Sse2NesterovUpdate(double scale, double momentum,
+                                    const double *inputs, double *velocities,
+                                    double *weights, size_t size) {
+  const __m128d s = _mm_set1_pd(scale);
+  const __m128d m = _mm_set1_pd(momentum);
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    const __m128d step = _mm_mul_pd(s, _mm_loadu_pd(inputs + i));
+    const __m128d velocity =
+        _mm_add_pd(_mm_mul_pd(m, _mm_loadu_pd(velocities + i)), step);
+    _mm_storeu_pd(weights + i,
+                  _mm_add_pd(_mm_loadu_pd(weights + i),
+                             _mm_add_pd(step, _mm_mul_pd(m, velocity))));
+    _mm_storeu_pd(velocities + i, velocity);
+  }
+  ScalarNesterovUpdate(scale, momentum, inputs + i, velocities + i,
+                       weights + i, size - i);
+}
+
+TARGET_SSE2 void Sse2RmsUpdate(double scale, double decay, double gain,
+                               double rate, double epsilon,
+                               const double *inputs, double *squares,
+                               double *weights, size_t size) {
+  const __m128d s = _mm_set1_pd(scale);
+  const __m128d d = _mm_set1_pd(decay);
+  const __m128d g = _mm_set1_pd(gain);
+  const __m128d r = _mm_set1_pd(rate);
+  const __m128d e = _mm_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    const __m128d gradient = _mm_mul_pd(s, _mm_loadu_pd(inputs + i));
+    const __m128d square =
+        _mm_add_pd(_mm_mul_pd(d, _mm_loadu_pd(squares + i)),
+                   _mm_mul_pd(_mm_mul_pd(g, gradient), gradient));
+    const __m128d delta = _mm_div_pd(_mm_mul_pd(r, gradient),
+                                     _mm_add_pd(_mm_sqrt_pd(square), e));
+    _mm_storeu_pd(weights + i, _mm_add_pd(_mm_loadu_pd(weights + i), delta));
+    _mm_storeu_pd(squares + i, square);
+  }
+  ScalarRmsUpdate(scale, decay, gain, rate, epsilon, inputs + i, squares + i,
+                  weights + i, size - i);
+}
+
+TARGET_SSE2 void Sse2AdamUpdate(double scale, double beta1, double beta2,
+                                double rate, double epsilon,
+                                const double *inputs, double *means,
+                                double *squares, double *weights,
+                                size_t size) {
+  const __m128d s = _mm_set1_pd(scale);
+  const __m128d b1 = _mm_set1_pd(beta1);
+  const __m128d b2 = _mm_set1_pd(beta2);
+  const __m128d c1 = _mm_set1_pd(1 - beta1);
+  const __m128d c2 = _mm_set1_pd(1 - beta2);
+  const __m128d r = _mm_set1_pd(rate);
+  const __m128d e = _mm_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 2 <= size; i += 2) {
+    const __m128d gradient = _mm_mul_pd(s, _mm_loadu_pd(inputs + i));
+    const __m128d mean = _mm_add_pd(_mm_mul_pd(b1, _mm_loadu_pd(means + i)),
+                                    _mm_mul_pd(c1, gradient));
+    const __m128d square =
+        _mm_add_pd(_mm_mul_pd(b2, _mm_loadu_pd(squares + i)),
+                   _mm_mul_pd(_mm_mul_pd(c2, gradient), gradient));
+    const __m128d delta = _mm_div_pd(_mm_mul_pd(r, mean),
+                                     _mm_add_pd(_mm_sqrt_pd(square), e));
+    _mm_storeu_pd(weights + i, _mm_add_pd(_mm_loadu_pd(weights + i), delta));
+    _mm_storeu_pd(means + i, mean);
+    _mm_storeu_pd(squares + i, square);
+  }
+  ScalarAdamUpdate(scale, beta1, beta2, rate, epsilon, inputs + i, means + i,
+                   squares + i, weights + i, size - i);
+}
+
+// AVX2: four doubles per vector, with fused multiply-add. The AVX2 and
+// AVX-512 kernels all clear the upper halves of the vector registers before
+// handing off to scalar code, since GCC doesn't do it for us in functions
+// with target attributes, and mixing in SSE code otherwise stalls the CPU.
+
+TARGET_AVX2 inline double HorizontalSum256(__m256d v) {
+  __m128d low = _mm_add_pd(_mm256_castpd256_pd128(v),
+                           _mm256_extractf128_pd(v, 1));
+  return _mm_cvtsd_f64(_mm_add_sd(low, _mm_unpackhi_pd(low, low)));
+}
+
+TARGET_AVX2 double Avx2Dot(const double *a, const double *b, size_t size) {
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i),
+                           sum0);
+    sum1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4),
+                           _mm256_loadu_pd(b + i + 4), sum1);
+  }
+  if (i + 4 <= size) {
+    sum0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i),
+                           sum0);
+    i += 4;
+  }
+  const double sum = HorizontalSum256(_mm256_add_pd(sum0, sum1));
+  _mm256_zeroupper();
+  return sum + ScalarDot(a + i, b + i, size - i);
+}
+
+TARGET_AVX2 void Avx2Dot4(const double *weights, const double *const *inputs,
+                          size_t size, double *sums) {
+  __m256d sum0 = _mm256_setzero_pd();
+  __m256d sum1 = _mm256_setzero_pd();
+  __m256d sum2 = _mm256_setzero_pd();
+  __m256d sum3 = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m256d w = _mm256_loadu_pd(weights + i);
+    sum0 = _mm256_fmadd_pd(w, _mm256_loadu_pd(inputs[0] + i), sum0);
+    sum1 = _mm256_fmadd_pd(w, _mm256_loadu_pd(inputs[1] + i), sum1);
+    sum2 = _mm256_fmadd_pd(w, _mm256_loadu_pd(inputs[2] + i), sum2);
+    sum3 = _mm256_fmadd_pd(w, _mm256_loadu_pd(inputs[3] + i), sum3);
+  }
+  sums[0] += HorizontalSum256(sum0);
+  sums[1] += HorizontalSum256(sum1);
+  sums[2] += HorizontalSum256(sum2);
+  sums[3] += HorizontalSum256(sum3);
+  _mm256_zeroupper();
+  const double *tails[4] = {inputs[0] + i, inputs[1] + i, inputs[2] + i,
+                            inputs[3] + i};
+  ScalarDot4(weights + i, tails, size - i, sums);
+}
+
+TARGET_AVX2 inline float HorizontalSum256(__m256 v) {
+  return HorizontalSum128(_mm_add_ps(_mm256_castps256_ps128(v),
+                                     _mm256_extractf128_ps(v, 1)));
+}
+
+TARGET_AVX2 float Avx2Dot(const float *a, const float *b, size_t size) {
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+                           sum0);
+    sum1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8),
+                           _mm256_loadu_ps(b + i + 8), sum1);
+  }
+  if (i + 8 <= size) {
+    sum0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i),
+                           sum0);
+    i += 8;
+  }
+  const float sum = HorizontalSum256(_mm256_add_ps(sum0, sum1));
+  _mm256_zeroupper();
+  return sum + ScalarDot(a + i, b + i, size - i);
+}
+
+TARGET_AVX2 void Avx2Dot4(const float *weights, const float *const *inputs,
+                          size_t size, float *sums) {
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  __m256 sum2 = _mm256_setzero_ps();
+  __m256 sum3 = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m256 w = _mm256_loadu_ps(weights + i);
+    sum0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(inputs[0] + i), sum0);
+    sum1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(inputs[1] + i), sum1);
+    sum2 = _mm256_fmadd_ps(w, _mm256_loadu_ps(inputs[2] + i), sum2);
+    sum3 = _mm256_fmadd_ps(w, _mm256_loadu_ps(inputs[3] + i), sum3);
+  }
+  sums[0] += HorizontalSum256(sum0);
+  sums[1] += HorizontalSum256(sum1);
+  sums[2] += HorizontalSum256(sum2);
+  sums[3] += HorizontalSum256(sum3);
+  _mm256_zeroupper();
+  const float *tails[4] = {inputs[0] + i, inputs[1] + i, inputs[2] + i,
+                           inputs[3] + i};
+  ScalarDot4(weights + i, tails, size - i, sums);
+}
+
+TARGET_AVX2 int32_t Avx2DotInt8(const int8_t *a, const int8_t *b,
+                                size_t size) {
+  __m256i sum = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m256i va = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    const __m256i vb = _mm256_cvtepi8_epi16(
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(va, vb));
+  }
+  alignas(32) int32_t lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i *>(lanes), sum);
+  _mm256_zeroupper();
+  int32_t total = 0;
+  for (int k = 0; k < 8; ++k) {
+    total += lanes[k];
+  }
+  return total + ScalarDotInt8(a + i, b + i, size - i);
+}
+
+TARGET_AVX2 void Avx2Axpy(double alpha, const double *x, double *y,
+                          size_t size) {
+  const __m256d a = _mm256_set1_pd(alpha);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    _mm256_storeu_pd(y + i, _mm256_fmadd_pd(a, _mm256_loadu_pd(x + i),
+                                            _mm256_loadu_pd(y + i)));
+  }
+  _mm256_zeroupper();
+  ScalarAxpy(alpha, x + i, y + i, size - i);
+}
+
+TARGET_AVX2 void Avx2Axpy(float alpha, const float *x, float *y,
+                          size_t size) {
+  const __m256 a = _mm256_set1_ps(alpha);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i),
+                                            _mm256_loadu_ps(y + i)));
+  }
+  _mm256_zeroupper();
+  ScalarAxpy(alpha, x + i, y + i, size - i);
+}
+
+// Gathers aren't much faster than scalar loads, but they let the
+// multiplications and additions happen four or eight at a time. The masked
+// gathers, with every lane enabled, avoid the -Wuninitialized problem from
+// HorizontalSum512() in the unmasked ones.
+
+TARGET_AVX2 double Avx2SparseDot(const double *values,
+                                 const uint32_t *indices, size_t size,
+                                 const double *x) {
+  const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+  __m256d sum = _mm256_setzero_pd();
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m128i index = _mm_loadu_si128(
+        reinterpret_cast<const __m128i *>(indices + i));
+    sum = _mm256_fmadd_pd(_mm256_loadu_pd(values + i),
+                          _mm256_mask_i32gather_pd(_mm256_setzero_pd(), x,
+                                                   index, all, 8),
+                          sum);
+  }
+  const double total = HorizontalSum256(sum);
+  _mm256_zeroupper();
+  return total + ScalarSparseDot(values + i, indices + i, size - i, x);
+}
+
+TARGET_AVX2 float Avx2SparseDot(const float *values, const uint32_t *indices,
+                                size_t size, const float *x) {
+  const __m256 all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m256i index = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(indices + i));
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(values + i),
+                          _mm256_mask_i32gather_ps(_mm256_setzero_ps(), x,
+                                                   index, all, 4),
+                          sum);
+  }
+  const float total = HorizontalSum256(sum);
+  _mm256_zeroupper();
+  return total + ScalarSparseDot(values + i, indices + i, size - i, x);
+}
+
+TARGET_AVX2 void Avx2MomentumUpdate(double scale, double momentum,
+                                    const double *inputs, double *deltas,
+                                    double *weights, size_t size) {
+  const __m256d s = _mm256_set1_pd(scale);
+  const __m256d m = _mm256_set1_pd(momentum);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m256d delta =
+        _mm256_fmadd_pd(s, _mm256_loadu_pd(inputs + i),
+                        _mm256_mul_pd(_mm256_loadu_pd(deltas + i), m));
+    _mm256_storeu_pd(weights + i,
+                     _mm256_add_pd(_mm256_loadu_pd(weights + i), delta));
+    _mm256_storeu_pd(deltas + i, delta);
+  }
+  _mm256_zeroupper();
+  ScalarMomentumUpdate(scale, momentum, inputs + i, deltas + i, weights + i,
+                       size - i);
+}
+
+TARGET_AVX2 void Avx2NesterovUpdate(double scale, double momentum,
+                                    const double *inputs, double *velocities,
+                                    double *weights, size_t size) {
+  const __m256d s = _mm256_set1_pd(scale);
+  const __m256d m = _mm256_set1_pd(momentum);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m256d step = _mm256_mul_pd(s, _mm256_loadu_pd(inputs + i));
+    const __m256d velocity =
+        _mm256_fmadd_pd(m, _mm256_loadu_pd(velocities + i), step);
+    _mm256_storeu_pd(weights + i,
+                     _mm256_add_pd(_mm256_loadu_pd(weights + i),
+                                   _mm256_fmadd_pd(m, velocity, step)));
+    _mm256_storeu_pd(velocities + i, velocity);
+  }
+  _mm256_zeroupper();
+  ScalarNesterovUpdate(scale, momentum, inputs + i, velocities + i,
+                       weights + i, size - i);
+}
+
+TARGET_AVX2 void Avx2RmsUpdate(double scale, double decay, double gain,
+                               double rate, double epsilon,
+                               const double *inputs, double *squares,
+                               double *weights, size_t size) {
+  const __m256d s = _mm256_set1_pd(scale);
+  const __m256d d = _mm256_set1_pd(decay);
+  const __m256d g = _mm256_set1_pd(gain);
+  const __m256d r = _mm256_set1_pd(rate);
+  const __m256d e = _mm256_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m256d gradient = _mm256_mul_pd(s, _mm256_loadu_pd(inputs + i));
+    const __m256d square =
+        _mm256_fmadd_pd(_mm256_mul_pd(g, gradient), gradient,
+                        _mm256_mul_pd(d, _mm256_loadu_pd(squares + i)));
+    const __m256d delta =
+        _mm256_div_pd(_mm256_mul_pd(r, gradient),
+                      _mm256_add_pd(_mm256_sqrt_pd(square), e));
+    _mm256_storeu_pd(weights + i,
+                     _mm256_add_pd(_mm256_loadu_pd(weights + i), delta));
+    _mm256_storeu_pd(squares + i, square);
+  }
+  _mm256_zeroupper();
+  ScalarRmsUpdate(scale, decay, gain, rate, epsilon, inputs + i, squares + i,
+                  weights + i, size - i);
+}
+
+TARGET_AVX2 void Avx2AdamUpdate(double scale, double beta1, double beta2,
+                                double rate, double epsilon,
+                                const double *inputs, double *means,
+                                double *squares, double *weights,
+                                size_t size) {
+  const __m256d s = _mm256_set1_pd(scale);
+  const __m256d b1 = _mm256_set1_pd(beta1);
+  const __m256d b2 = _mm256_set1_pd(beta2);
+  const __m256d c1 = _mm256_set1_pd(1 - beta1);
+  const __m256d c2 = _mm256_set1_pd(1 - beta2);
+  const __m256d r = _mm256_set1_pd(rate);
+  const __m256d e = _mm256_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 4 <= size; i += 4) {
+    const __m256d gradient = _mm256_mul_pd(s, _mm256_loadu_pd(inputs + i));
+    const __m256d mean = _mm256_fmadd_pd(b1, _mm256_loadu_pd(means + i),
+                                         _mm256_mul_pd(c1, gradient));
+    const __m256d square =
+        _mm256_fmadd_pd(_mm256_mul_pd(c2, gradient), gradient,
+                        _mm256_mul_pd(b2, _mm256_loadu_pd(squares + i)));
+    const __m256d delta =
+        _mm256_div_pd(_mm256_mul_pd(r, mean),
+                      _mm256_add_pd(_mm256_sqrt_pd(square), e));
+    _mm256_storeu_pd(weights + i,
+                     _mm256_add_pd(_mm256_loadu_pd(weights + i), delta));
+    _mm256_storeu_pd(means + i, mean);
+    _mm256_storeu_pd(squares + i, square);
+  }
+  _mm256_zeroupper();
+  ScalarAdamUpdate(scale, beta1, beta2, rate, epsilon, inputs + i, means + i,
+                   squares + i, weights + i, size - i);
+}
+
+// AVX-512: eight doubles per vector.
+
+TARGET_AVX512 inline double HorizontalSum512(__m512d v) {
+  // Going through memory avoids _mm512_reduce_add_pd(), which trips
+  // -Wuninitialized in some versions of GCC's headers.
+  alignas(64) double lanes[8];
+  _mm512_store_pd(lanes, v);
+  return ((lanes[0] + lanes[1]) + (lanes[2] + lanes[3])) +
+         ((lanes[4] + lanes[5]) + (lanes[6] + lanes[7]));
+}
+
+TARGET_AVX512 double Avx512Dot(const double *a, const double *b,
+                               size_t size) {
+  __m512d sum0 = _mm512_setzero_pd();
+  __m512d sum1 = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    sum0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i),
+                           sum0);
+    sum1 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i + 8),
+                           _mm512_loadu_pd(b + i + 8), sum1);
+  }
+  if (i + 8 <= size) {
+    sum0 = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i),
+                           sum0);
+    i += 8;
+  }
+  const double sum = HorizontalSum512(_mm512_add_pd(sum0, sum1));
+  _mm256_zeroupper();
+  return sum + ScalarDot(a + i, b + i, size - i);
+}
+
+TARGET_AVX512 void Avx512Dot4(const double *weights,
+                              const double *const *inputs, size_t size,
+                              double *sums) {
+  __m512d sum0 = _mm512_setzero_pd();
+  __m512d sum1 = _mm512_setzero_pd();
+  __m512d sum2 = _mm512_setzero_pd();
+  __m512d sum3 = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m512d w = _mm512_loadu_pd(weights + i);
+    sum0 = _mm512_fmadd_pd(w, _mm512_loadu_pd(inputs[0] + i), sum0);
+    sum1 = _mm512_fmadd_pd(w, _mm512_loadu_pd(inputs[1] + i), sum1);
+    sum2 = _mm512_fmadd_pd(w, _mm512_loadu_pd(inputs[2] + i), sum2);
+    sum3 = _mm512_fmadd_pd(w, _mm512_loadu_pd(inputs[3] + i), sum3);
+  }
+  sums[0] += HorizontalSum512(sum0);
+  sums[1] += HorizontalSum512(sum1);
+  sums[2] += HorizontalSum512(sum2);
+  sums[3] += HorizontalSum512(sum3);
+  _mm256_zeroupper();
+  const double *tails[4] = {inputs[0] + i, inputs[1] + i, inputs[2] + i,
+                            inputs[3] + i};
+  ScalarDot4(weights + i, tails, size - i, sums);
+}
+
+TARGET_AVX512 inline float HorizontalSum512(__m512 v) {
+  alignas(64) float lanes[16];
+  _mm512_store_ps(lanes, v);
+  float sum = 0;
+  for (int i = 0; i < 16; ++i) {
+    sum += lanes[i];
+  }
+  return sum;
+}
+
+TARGET_AVX512 float Avx512Dot(const float *a, const float *b, size_t size) {
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i),
+                           sum0);
+    sum1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16),
+                           _mm512_loadu_ps(b + i + 16), sum1);
+  }
+  if (i + 16 <= size) {
+    sum0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i),
+                           sum0);
+    i += 16;
+  }
+  const float sum = HorizontalSum512(_mm512_add_ps(sum0, sum1));
+  _mm256_zeroupper();
+  return sum + ScalarDot(a + i, b + i, size - i);
+}
+
+TARGET_AVX512 void Avx512Dot4(const float *weights,
+                              const float *const *inputs, size_t size,
+                              float *sums) {
+  __m512 sum0 = _mm512_setzero_ps();
+  __m512 sum1 = _mm512_setzero_ps();
+  __m512 sum2 = _mm512_setzero_ps();
+  __m512 sum3 = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m512 w = _mm512_loadu_ps(weights + i);
+    sum0 = _mm512_fmadd_ps(w, _mm512_loadu_ps(inputs[0] + i), sum0);
+    sum1 = _mm512_fmadd_ps(w, _mm512_loadu_ps(inputs[1] + i), sum1);
+    sum2 = _mm512_fmadd_ps(w, _mm512_loadu_ps(inputs[2] + i), sum2);
+    sum3 = _mm512_fmadd_ps(w, _mm512_loadu_ps(inputs[3] + i), sum3);
+  }
+  sums[0] += HorizontalSum512(sum0);
+  sums[1] += HorizontalSum512(sum1);
+  sums[2] += HorizontalSum512(sum2);
+  sums[3] += HorizontalSum512(sum3);
+  _mm256_zeroupper();
+  const float *tails[4] = {inputs[0] + i, inputs[1] + i, inputs[2] + i,
+                           inputs[3] + i};
+  ScalarDot4(weights + i, tails, size - i, sums);
+}
+
+// Without AVX-512BW there's no 16-bit multiply-add on full-width vectors, so
+// this widens all the way to 32 bits instead. (The zero-masked conversions
+// with a full mask avoid the same -Wuninitialized problem as
+// HorizontalSum512().)
+TARGET_AVX512 int32_t Avx512DotInt8(const int8_t *a, const int8_t *b,
+                                    size_t size) {
+  __m512i sum = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m512i va = _mm512_maskz_cvtepi8_epi32(
+        0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    const __m512i vb = _mm512_maskz_cvtepi8_epi32(
+        0xFFFF, _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+    sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(va, vb));
+  }
+  alignas(64) int32_t lanes[16];
+  _mm512_store_si512(lanes, sum);
+  _mm256_zeroupper();
+  int32_t total = 0;
+  for (int k = 0; k < 16; ++k) {
+    total += lanes[k];
+  }
+  return total + ScalarDotInt8(a + i, b + i, size - i);
+}
+
+TARGET_AVX512 void Avx512Axpy(double alpha, const double *x, double *y,
+                              size_t size) {
+  const __m512d a = _mm512_set1_pd(alpha);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    _mm512_storeu_pd(y + i, _mm512_fmadd_pd(a, _mm512_loadu_pd(x + i),
+                                            _mm512_loadu_pd(y + i)));
+  }
+  _mm256_zeroupper();
+  ScalarAxpy(alpha, x + i, y + i, size - i);
+}
+
+TARGET_AVX512 void Avx512Axpy(float alpha, const float *x, float *y,
+                              size_t size) {
+  const __m512 a = _mm512_set1_ps(alpha);
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    _mm512_storeu_ps(y + i, _mm512_fmadd_ps(a, _mm512_loadu_ps(x + i),
+                                            _mm512_loadu_ps(y + i)));
+  }
+  _mm256_zeroupper();
+  ScalarAxpy(alpha, x + i, y + i, size - i);
+}
+
+TARGET_AVX512 double Avx512SparseDot(const double *values,
+                                     const uint32_t *indices, size_t size,
+                                     const double *x) {
+  __m512d sum = _mm512_setzero_pd();
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m256i index = _mm256_loadu_si256(
+        reinterpret_cast<const __m256i *>(indices + i));
+    const __m512d gathered =
+        _mm512_mask_i32gather_pd(_mm512_setzero_pd(), 0xFF, index, x, 8);
+    sum = _mm512_fmadd_pd(_mm512_loadu_pd(values + i), gathered, sum);
+  }
+  const double total = HorizontalSum512(sum);
+  _mm256_zeroupper();
+  return total + ScalarSparseDot(values + i, indices + i, size - i, x);
+}
+
+TARGET_AVX512 float Avx512SparseDot(const float *values,
+                                    const uint32_t *indices, size_t size,
+                                    const float *x) {
+  __m512 sum = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    const __m512i index = _mm512_loadu_si512(indices + i);
+    const __m512 gathered =
+        _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xFFFF, index, x, 4);
+    sum = _mm512_fmadd_ps(_mm512_loadu_ps(values + i), gathered, sum);
+  }
+  const float total = HorizontalSum512(sum);
+  _mm256_zeroupper();
+  return total + ScalarSparseDot(values + i, indices + i, size - i, x);
+}
+
+TARGET_AVX512 void Avx512MomentumUpdate(double scale, double momentum,
+                                        const double *inputs, double *deltas,
+                                        double *weights, size_t size) {
+  const __m512d s = _mm512_set1_pd(scale);
+  const __m512d m = _mm512_set1_pd(momentum);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m512d delta =
+        _mm512_fmadd_pd(s, _mm512_loadu_pd(inputs + i),
+                        _mm512_mul_pd(_mm512_loadu_pd(deltas + i), m));
+    _mm512_storeu_pd(weights + i,
+                     _mm512_add_pd(_mm512_loadu_pd(weights + i), delta));
+    _mm512_storeu_pd(deltas + i, delta);
+  }
+  _mm256_zeroupper();
+  ScalarMomentumUpdate(scale, momentum, inputs + i, deltas + i, weights + i,
+                       size - i);
+}
+
+TARGET_AVX512 void Avx512NesterovUpdate(double scale, double momentum,
+                                        const double *inputs,
+                                        double *velocities, double *weights,
+                                        size_t size) {
+  const __m512d s = _mm512_set1_pd(scale);
+  const __m512d m = _mm512_set1_pd(momentum);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m512d step = _mm512_mul_pd(s, _mm512_loadu_pd(inputs + i));
+    const __m512d velocity =
+        _mm512_fmadd_pd(m, _mm512_loadu_pd(velocities + i), step);
+    _mm512_storeu_pd(weights + i,
+                     _mm512_add_pd(_mm512_loadu_pd(weights + i),
+                                   _mm512_fmadd_pd(m, velocity, step)));
+    _mm512_storeu_pd(velocities + i, velocity);
+  }
+  _mm256_zeroupper();
+  ScalarNesterovUpdate(scale, momentum, inputs + i, velocities + i,
+                       weights + i, size - i);
+}
+
+TARGET_AVX512 void Avx512RmsUpdate(double scale, double decay, double gain,
+                                   double rate, double epsilon,
+                                   const double *inputs, double *squares,
+                                   double *weights, size_t size) {
+  const __m512d s = _mm512_set1_pd(scale);
+  const __m512d d = _mm512_set1_pd(decay);
+  const __m512d g = _mm512_set1_pd(gain);
+  const __m512d r = _mm512_set1_pd(rate);
+  const __m512d e = _mm512_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m512d gradient = _mm512_mul_pd(s, _mm512_loadu_pd(inputs + i));
+    const __m512d square =
+        _mm512_fmadd_pd(_mm512_mul_pd(g, gradient), gradient,
+                        _mm512_mul_pd(d, _mm512_loadu_pd(squares + i)));
+    // The masked square root gets around _mm512_sqrt_pd() tripping
+    // -Wmaybe-uninitialized in some versions of GCC's headers.
+    const __m512d delta =
+        _mm512_div_pd(_mm512_mul_pd(r, gradient),
+                      _mm512_add_pd(_mm512_mask_sqrt_pd(square, 0xff, square),
+                                    e));
+    _mm512_storeu_pd(weights + i,
+                     _mm512_add_pd(_mm512_loadu_pd(weights + i), delta));
+    _mm512_storeu_pd(squares + i, square);
+  }
+  _mm256_zeroupper();
+  ScalarRmsUpdate(scale, decay, gain, rate, epsilon, inputs + i, squares + i,
+                  weights + i, size - i);
+}
+
+TARGET_AVX512 void Avx512AdamUpdate(double scale, double beta1, double beta2,
+                                    double rate, double epsilon,
+                                    const double *inputs, double *means,
+                                    double *squares, double *weights,
+                                    size_t size) {
+  const __m512d s = _mm512_set1_pd(scale);
+  const __m512d b1 = _mm512_set1_pd(beta1);
+  const __m512d b2 = _mm512_set1_pd(beta2);
+  const __m512d c1 = _mm512_set1_pd(1 - beta1);
+  const __m512d c2 = _mm512_set1_pd(1 - beta2);
+  const __m512d r = _mm512_set1_pd(rate);
+  const __m512d e = _mm512_set1_pd(epsilon);
+  size_t i = 0;
+  for (; i + 8 <= size; i += 8) {
+    const __m512d gradient = _mm512_mul_pd(s, _mm512_loadu_pd(inputs + i));
+    const __m512d mean = _mm512_fmadd_pd(b1, _mm512_loadu_pd(means + i),
+                                         _mm512_mul_pd(c1, gradient));
+    const __m512d square =
+        _mm512_fmadd_pd(_mm512_mul_pd(c2, gradient), gradient,
+                        _mm512_mul_pd(b2, _mm512_loadu_pd(squares + i)));
+    // See Avx512RmsUpdate() for why the square root is masked.
+    const __m512d delta =
+        _mm512_div_pd(_mm512_mul_pd(r, mean),
+                      _mm512_add_pd(_mm512_mask_sqrt_pd(square, 0xff, square),
+                                    e));
+    _mm512_storeu_pd(weights + i,
+                     _mm512_add_pd(_mm512_loadu_pd(weights + i), delta));
+    _mm512_storeu_pd(means + i, mean);
+    _mm512_storeu_pd(squares + i, square);
+  }
+  _mm256_zeroupper();
+  ScalarAdamUpdate(scale, beta1, beta2, rate, epsilon, inputs + i, means + i,
+                   squares + i, weights + i, size - i);
+}
+
+#endif // NEURAL_NET_X86_KERNELS
+
+// Indexed by InstructionSet. Instruction sets that can't be compiled for fall
+// back on the scalar kernels.
+const KernelTable kTables[] = {
+  {ScalarDot, ScalarDot4, ScalarAxpy, ScalarMomentumUpdate,
+   ScalarNesterovUpdate, ScalarRmsUpdate, ScalarAdamUpdate, ScalarDot,
+   ScalarDot4, ScalarDotInt8, ScalarSparseDot, ScalarSparseDot, ScalarAxpy},
+#ifdef NEURAL_NET_X86_KERNELS
+  // SSE2 has no gathers, so it uses the scalar sparse kernels.
+  {Sse2Dot, Sse2Dot4, Sse2Axpy, Sse2MomentumUpdate,
+   Sse2NesterovUpdate, Sse2RmsUpdate, Sse2AdamUpdate, Sse2Dot, Sse2Dot4,
+   Sse2DotInt8, ScalarSparseDot, ScalarSparseDot, Sse2Axpy},
+  {Avx2Dot, Avx2Dot4, Avx2Axpy, Avx2MomentumUpdate,
+   Avx2NesterovUpdate, Avx2RmsUpdate, Avx2AdamUpdate, Avx2Dot, Avx2Dot4,
+   Avx2DotInt8, Avx2SparseDot, Avx2SparseDot, Avx2Axpy},
+  {Avx512Dot, Avx512Dot4, Avx512Axpy, Avx512MomentumUpdate,
+   Avx512NesterovUpdate, Avx512RmsUpdate, Avx512AdamUpdate, Avx512Dot,
+   Avx512Dot4, Avx512DotInt8, Avx512SparseDot, Avx512SparseDot, Avx512Axpy},
+#else
+  {ScalarDot, ScalarDot4, ScalarAxpy, ScalarMomentumUpdate,
+   ScalarNesterovUpdate, ScalarRmsUpdate, ScalarAdamUpdate, ScalarDot,
+   ScalarDot4, ScalarDotInt8, ScalarSparseDot, ScalarSparseDot, ScalarAxpy},
+  {ScalarDot, ScalarDot4, ScalarAxpy, ScalarMomentumUpdate,
+   ScalarNesterovUpdate, ScalarRmsUpdate, ScalarAdamUpdate, ScalarDot,
+   ScalarDot4, ScalarDotInt8, ScalarSparseDot, ScalarSparseDot, ScalarAxpy},
+  {ScalarDot, ScalarDot4, ScalarAxpy, ScalarMomentumUpdate,
+   ScalarNesterovUpdate, ScalarRmsUpdate, ScalarAdamUpdate, ScalarDot,
+   ScalarDot4, ScalarDotInt8, ScalarSparseDot, ScalarSparseDot, ScalarAxpy},
+#endif
+};
+
+// Returns a reference to the table that the kernels dispatch through. It gets
+// set to the best one available the first time it's used.
+const KernelTable *&ActiveTable() {
+  static const KernelTable *table =
+      &kTables[static_cast<int>(GetSupportedInstructionSet())];
+  return table;
+}
+
+} // namespace
+
+double Dot(const double *a, const double *b, size_t size) {
+  return ActiveTable()->Dot(a, b, size);
+}
+
+void Dot4(const double *weights, const double *const *inputs, size_t size,
+          double *sums) {
+  ActiveTable()->Dot4(weights, inputs, size, sums);
+}
+
+float Dot(const float *a, const float *b, size_t size) {
+  return ActiveTable()->DotF32(a, b, size);
+}
+
+void Dot4(const float *weights, const float *const *inputs, size_t size,
+          float *sums) {
+  ActiveTable()->Dot4F32(weights, inputs, size, sums);
+}
+
+int32_t DotInt8(const int8_t *a, const int8_t *b, size_t size) {
+  return ActiveTable()->DotInt8(a, b, size);
+}
+
+double SparseDot(const double *values, const uint32_t *indices, size_t size,
+                 const double *x) {
+  return ActiveTable()->SparseDot(values, indices, size, x);
+}
+
+float SparseDot(const float *values, const uint32_t *indices, size_t size,
+                const float *x) {
+  return ActiveTable()->SparseDotF32(values, indices, size, x);
+}
+
+void Axpy(double alpha, const double *x, double *y, size_t size) {
+  ActiveTable()->Axpy(alpha, x, y, size);
+}
+
+void Axpy(float alpha, const float *x, float *y, size_t size) {
+  ActiveTable()->AxpyF32(alpha, x, y, size);
+}
+
+void MomentumUpdate(double scale, double momentum, const double *inputs,
+                    double *deltas, double *weights, size_t size) {
+  ActiveTable()->MomentumUpdate(scale, momentum, inputs, deltas, weights,
+                                size);
+}
+
+void NesterovUpdate(double scale, double momentum, const double *inputs,
+                    double *velocities, double *weights, size_t size) {
+  ActiveTable()->NesterovUpdate(scale, momentum, inputs, velocities, weights,
+                                size);
+}
+
+void RmsUpdate(double scale, double decay, double gain, double rate,
+               double epsilon, const double *inputs, double *squares,
+               double *weights, size_t size) {
+  ActiveTable()->RmsUpdate(scale, decay, gain, rate, epsilon, inputs, squares,
+                           weights, size);
+}
+
+void AdamUpdate(double scale, double beta1, double beta2, double rate,
+                double epsilon, const double *inputs, double *means,
+                double *squares, double *weights, size_t size) {
+  ActiveTable()->AdamUpdate(scale, beta1, beta2, rate, epsilon, inputs, means,
+                            squares, weights, size);
+}
+
+InstructionSet GetSupportedInstructionSet() {
+#ifdef NEURAL_NET_X86_KERNELS
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return InstructionSet::AVX512;
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return InstructionSet::AVX2;
+  }
+  if (__builtin_cpu_supports("sse2")) {
+    return InstructionSet::SSE2;
+  }
+#endif
+  return InstructionSet::SCALAR;
+}
+
+InstructionSet GetInstructionSet() {
+  return static_cast<InstructionSet>(ActiveTable() - kTables);
+}
+
+bool SetInstructionSet(InstructionSet instruction_set) {
+  if (static_cast<int>(instruction_set) >
+      static_cast<int>(GetSupportedInstructionSet())) {
+    return false;
+  }
+  ActiveTable() = &kTables[static_cast<int>(instruction_set)];
+  return true;
+}
+
+} // kernels
+} //network
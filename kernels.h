@@ -0,0 +1,87 @@
+#ifndef NEURAL_NET_KERNELS_H_
+#define NEURAL_NET_KERNELS_H_
+
+// The innermost loops of inference and back propagation. Each kernel has a
+// portable scalar version, as well as SSE2, AVX2 and AVX-512 versions on x86.
+// The fastest version that the CPU supports is picked the first time any
+// kernel is used.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace network {
+namespace kernels {
+
+// The instruction sets that we have kernels for, from slowest to fastest.
+enum class InstructionSet {
+  SCALAR = 0,
+  SSE2,
+  AVX2,
+  AVX512
+};
+
+// Returns the sum of a[i] * b[i] over <size> elements.
+double Dot(const double *a, const double *b, size_t size);
+// Computes the dot product of <weights> with each of the four vectors in
+// <inputs>, and adds them to the four elements of <sums>. This is the inner
+// loop of a matrix-matrix product, and only loads the weights once.
+void Dot4(const double *weights, const double *const *inputs, size_t size,
+          double *sums);
+// Single-precision versions of Dot() and Dot4(). Each vector holds twice as
+// many floats as doubles, and the sums are accumulated in float.
+float Dot(const float *a, const float *b, size_t size);
+void Dot4(const float *weights, const float *const *inputs, size_t size,
+          float *sums);
+// Returns the sum of a[i] * b[i] over <size> 8-bit elements, accumulated in 32
+// bits. This can't overflow as long as <size> is under 133,000 or so.
+int32_t DotInt8(const int8_t *a, const int8_t *b, size_t size);
+// Returns the sum of values[i] * x[indices[i]] over <size> elements. This is
+// the inner loop of a sparse matrix-vector product, where <values> and
+// <indices> are the nonzero elements of one row (or column) and where they
+// are.
+double SparseDot(const double *values, const uint32_t *indices, size_t size,
+                 const double *x);
+float SparseDot(const float *values, const uint32_t *indices, size_t size,
+                const float *x);
+// Does y[i] += alpha * x[i].
+void Axpy(double alpha, const double *x, double *y, size_t size);
+void Axpy(float alpha, const float *x, float *y, size_t size);
+// The momentum weight update for back propagation. For each weight, the change
+// is scale * inputs[i] + momentum * deltas[i]. The change gets added to
+// weights[i] and saved in deltas[i] for next time.
+void MomentumUpdate(double scale, double momentum, const double *inputs,
+                    double *deltas, double *weights, size_t size);
+// The Nesterov momentum weight update. For each weight, the velocity becomes
+// momentum * velocities[i] + scale * inputs[i], and is saved in
+// velocities[i]. The weight then moves by scale * inputs[i] plus momentum
+// times the new velocity, so that it looks ahead along where it's going.
+void NesterovUpdate(double scale, double momentum, const double *inputs,
+                    double *velocities, double *weights, size_t size);
+// The weight update for Adagrad and RMSProp. For each weight, with a gradient
+// of g = scale * inputs[i], squares[i] becomes decay * squares[i] + gain * g^2,
+// and the weight moves by rate * g / (sqrt(squares[i]) + epsilon).
+void RmsUpdate(double scale, double decay, double gain, double rate,
+               double epsilon, const double *inputs, double *squares,
+               double *weights, size_t size);
+// The Adam weight update. For each weight, with a gradient of
+// g = scale * inputs[i], means[i] becomes beta1 * means[i] + (1 - beta1) * g,
+// squares[i] becomes beta2 * squares[i] + (1 - beta2) * g^2, and the weight
+// moves by rate * means[i] / (sqrt(squares[i]) + epsilon). Correcting for the
+// bias of the averages is up to the caller, through <rate> and <epsilon>.
+void AdamUpdate(double scale, double beta1, double beta2, double rate,
+                double epsilon, const double *inputs, double *means,
+                double *squares, double *weights, size_t size);
+
+// Returns the fastest instruction set supported by this CPU.
+InstructionSet GetSupportedInstructionSet();
+// Returns the instruction set that the kernels are currently using.
+InstructionSet GetInstructionSet();
+// Forces the kernels to use a particular instruction set. This is meant for
+// testing and benchmarking, and is not safe to call while kernels are
+// running on other threads. Returns false if the CPU doesn't support it.
+bool SetInstructionSet(InstructionSet instruction_set);
+
+} // kernels
+} //network
+
+#endif
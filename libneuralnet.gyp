@@ -4,13 +4,33 @@
       'target_name': 'libneuralnet',
       'type': 'static_library',
       'sources': [
+        'batch_scheduler.cc',
+        'execution_plan.cc',
         'genetic_algorithm.cc',
+        'incremental_evaluator.cc',
+        'inference_cache.cc',
+        'kernels.cc',
         'logger.cc',
         'multilayered_feedforward.cc',
+        'multilayered_feedforward_f32.cc',
         'neuron.cc',
+        'optimizers.cc',
         'output_functions.cc',
+        'pipeline.cc',
+        'quantized_network.cc',
+        'serialization.cc',
+        'source_exporter.cc',
         'supervised_learner.cc',
+        'thread_pool.cc',
       ],
+      'cflags': [
+        '-pthread',
+      ],
+      'link_settings': {
+        'ldflags': [
+          '-pthread',
+        ],
+      },
     },
   ],
 }
@@ -6,6 +6,9 @@
 #include <string.h>
 #include <time.h>
 
+#include <algorithm>
+
+#include "kernels.h"
 #include "logger.h"
 #include "multilayered_feedforward.h"
 
@@ -20,7 +23,8 @@ MFNetwork::MFNetwork(uint32_t inputs, uint32_t outputs, uint32_t layer_size) :
     layer_size_(layer_size),
     use_special_weights_(0),
     learning_rate_(0.01),
-    momentum_(0.5) {
+    momentum_(0.5),
+    input_values_(inputs, 0) {
   // Seed random number generator.
   srand(time(NULL));
   // Create the input and output layers.
@@ -90,6 +94,7 @@ void MFNetwork::AddHiddenLayer(int size/* = -1*/) {
     --it;
     layers_.insert(it, layer);
   }
+  MarkChanged();
 }
 
 bool MFNetwork::RemoveLayer(uint32_t index) {
@@ -101,19 +106,127 @@ bool MFNetwork::RemoveLayer(uint32_t index) {
   Layer_t *to_delete = layers_[index];
   layers_.erase(layers_.begin() + index);
   delete to_delete;
+  MarkChanged();
 
   return true;
 }
 
 void MFNetwork::SetInputs(const double *values) {
   // Write to our buffer. (It will get sent to the input layer later.)
-  layer_input_buffer_.clear();
-  for (uint32_t i = 0; i < num_inputs_; ++i) {
-    layer_input_buffer_[i].push_back(values[i]);
+  memcpy(input_values_.data(), values, sizeof(values[0]) * num_inputs_);
+  sparse_inputs_ = false;
+}
+
+void MFNetwork::SetSparseInputs(const uint32_t *indices, const double *values,
+                                size_t count) {
+  // The layers themselves still need every input.
+  input_values_.assign(num_inputs_, 0);
+  for (size_t i = 0; i < count; ++i) {
+    input_values_[indices[i]] = values[i];
+  }
+  sparse_input_indices_.assign(indices, indices + count);
+  sparse_input_values_.assign(values, values + count);
+  sparse_inputs_ = true;
+}
+
+bool MFNetwork::Compile() {
+  use_plan_ = true;
+  return BuildPlan();
+}
+
+bool MFNetwork::GetOutputsBatch(const double *inputs, size_t count,
+                                double *outputs) {
+  if (plan_stale_ && !BuildPlan()) {
+    return false;
+  }
+  return plan_.RunBatch(inputs, count, outputs, &workspace_);
+}
+
+bool MFNetwork::GetOutputsSubset(const uint32_t *output_ids, size_t count,
+                                 double *values) {
+  if (plan_stale_ && !BuildPlan()) {
+    return false;
+  }
+  if (!cone_valid_ || cone_.Outputs.size() != count ||
+      !std::equal(cone_.Outputs.begin(), cone_.Outputs.end(), output_ids)) {
+    cone_valid_ = plan_.BuildCone(output_ids, count, &cone_);
+    if (!cone_valid_) {
+      return false;
+    }
+  }
+  return plan_.RunCone(cone_, input_values_.data(), values, &workspace_);
+}
+
+bool MFNetwork::Evaluate(const double *inputs, double *outputs,
+                         InferenceWorkspace *workspace) const {
+  if (!use_plan_ || plan_stale_) {
+    return false;
+  }
+  if (cache_ && cache_->Lookup(inputs, num_inputs_, version_, outputs,
+                               num_outputs_)) {
+    return true;
+  }
+  if (!plan_.Run(inputs, outputs, workspace)) {
+    return false;
+  }
+  if (cache_) {
+    cache_->Insert(inputs, num_inputs_, version_, outputs, num_outputs_);
+  }
+  return true;
+}
+
+bool MFNetwork::EvaluateBatch(const double *inputs, size_t count,
+                              double *outputs,
+                              InferenceWorkspace *workspace) const {
+  if (!use_plan_ || plan_stale_) {
+    return false;
+  }
+  return plan_.RunBatch(inputs, count, outputs, workspace);
+}
+
+bool MFNetwork::EvaluateSparse(const uint32_t *indices, const double *values,
+                               size_t count, double *outputs,
+                               InferenceWorkspace *workspace) const {
+  if (!use_plan_ || plan_stale_) {
+    return false;
   }
+  return plan_.RunSparse(indices, values, count, outputs, workspace);
 }
 
 bool MFNetwork::DoUpdate(double *values) {
+  if (!values) {
+    return UpdateLayers(nullptr);
+  }
+  if (cache_ && cache_->Lookup(input_values_.data(), num_inputs_, version_,
+                               values, num_outputs_)) {
+    return true;
+  }
+
+  bool success;
+  if (use_plan_) {
+    if (plan_stale_ && !BuildPlan()) {
+      return false;
+    }
+    if (sparse_inputs_) {
+      success = plan_.RunSparse(sparse_input_indices_.data(),
+                                sparse_input_values_.data(),
+                                sparse_input_indices_.size(), values,
+                                &workspace_);
+    } else {
+      success = plan_.Run(input_values_.data(), values, &workspace_);
+    }
+  } else {
+    success = UpdateLayers(values);
+  }
+
+  if (success && cache_) {
+    cache_->Insert(input_values_.data(), num_inputs_, version_, values,
+                   num_outputs_);
+  }
+  return success;
+}
+
+bool MFNetwork::UpdateLayers(double *values) {
   if (!HiddenLayerQuantity()) {
     // Our network won't work without at least one hidden layer, and it will be
     // pretty useless.
@@ -123,6 +236,12 @@ bool MFNetwork::DoUpdate(double *values) {
   // Maps the output of each neuron in a layer to the index of its neuron.
   std::map<int, double> layer_output_buffer;
 
+  // Feed our inputs to the input layer.
+  layer_input_buffer_.clear();
+  for (uint32_t i = 0; i < num_inputs_; ++i) {
+    layer_input_buffer_[i].push_back(input_values_[i]);
+  }
+
   // Calculate each layer in sequence.
   for (uint32_t layer_i = 0; layer_i < layers_.size(); ++layer_i) {
     Layer_t *layer = layers_[layer_i];
@@ -206,6 +325,123 @@ bool MFNetwork::DoUpdate(double *values) {
   return true;
 }
 
+bool MFNetwork::BuildPlan() {
+  // Make sure every neuron has the right number of weights first.
+  if (!ForceWeightUpdate()) {
+    return false;
+  }
+
+  // The input layer always has unit weights, no bias and the default impulse
+  // function, so it simply passes the inputs through and needs no layer in the
+  // plan.
+  plan_.Reset(num_inputs_);
+  std::vector<double> weights;
+  for (uint32_t layer_i = 1; layer_i < layers_.size(); ++layer_i) {
+    Layer_t *source = layers_[layer_i - 1];
+    Layer_t *layer = layers_[layer_i];
+    const uint32_t size = layer->Neurons.size();
+    ExecutionPlan::Layer *compiled = plan_.AddLayer(size);
+
+    // Each neuron's inputs arrive in order of the index of the neuron in the
+    // previous layer that sent them, so that's the order in which its weights
+    // get used up.
+    std::vector<uint32_t> weights_used(size, 0);
+    std::vector<bool> connected(size * compiled->Inputs, false);
+    std::vector<std::vector<double> > neuron_weights(size);
+    layer->WeightColumns.assign(size, std::vector<uint32_t>());
+    for (uint32_t neuron_i = 0; neuron_i < size; ++neuron_i) {
+      layer->Neurons[neuron_i]->GetWeights(&neuron_weights[neuron_i]);
+    }
+    for (auto& kv : source->RoutingMap) {
+      if (kv.first < 0 ||
+          static_cast<uint32_t>(kv.first) >= source->Neurons.size()) {
+        continue;
+      }
+      for (int dest : kv.second) {
+        if (dest < 0 || static_cast<uint32_t>(dest) >= size) {
+          // Nothing receives this, so it doesn't matter.
+          continue;
+        }
+        if (weights_used[dest] >= neuron_weights[dest].size()) {
+          LOG(Level::ERROR, "Routing for layer %u does not match weights.",
+              layer_i - 1);
+          return false;
+        }
+        compiled->Weights[dest * compiled->Stride + kv.first] +=
+            neuron_weights[dest][weights_used[dest]++];
+        layer->WeightColumns[dest].push_back(kv.first);
+        connected[dest * compiled->Inputs + kv.first] = true;
+      }
+    }
+    if (std::find(connected.begin(), connected.end(), false) !=
+        connected.end()) {
+      for (uint32_t i = 0; i < connected.size(); ++i) {
+        if (connected[i]) {
+          compiled->Connections.push_back(i);
+        }
+      }
+    }
+
+    for (uint32_t neuron_i = 0; neuron_i < size; ++neuron_i) {
+      Neuron *neuron = layer->Neurons[neuron_i];
+      if (weights_used[neuron_i] != neuron_weights[neuron_i].size()) {
+        LOG(Level::ERROR, "Neuron %u in layer %u has unused weights.",
+            neuron_i, layer_i);
+        return false;
+      }
+      compiled->Biases[neuron_i] = neuron->GetBias();
+      compiled->Impulses[neuron_i] = neuron->GetOutputFunction();
+    }
+    layer->StateOffsets.resize(size + 1);
+    size_t offset = 0;
+    for (uint32_t neuron_i = 0; neuron_i < size; ++neuron_i) {
+      layer->StateOffsets[neuron_i] = offset;
+      // One for each weight, and one for the bias.
+      offset += neuron_weights[neuron_i].size() + 1;
+    }
+    layer->StateOffsets[size] = offset;
+    plan_.FinishLayer(compiled);
+    compiled->Accuracy = layer->Accuracy;
+  }
+
+  // Figure out which output neuron goes to which network output.
+  Layer_t *output_layer = layers_.back();
+  std::vector<uint32_t> output_indices(num_outputs_, 0);
+  std::vector<bool> output_set(num_outputs_, false);
+  for (auto& kv : output_layer->RoutingMap) {
+    for (int dest : kv.second) {
+      if (dest < 0 || static_cast<uint32_t>(dest) >= num_outputs_ ||
+          output_set[dest]) {
+        LOG(Level::ERROR, "Invalid routing for output layer.");
+        return false;
+      }
+      output_indices[dest] = kv.first;
+      output_set[dest] = true;
+    }
+  }
+  for (bool set : output_set) {
+    if (!set) {
+      LOG(Level::ERROR, "Invalid routing for output layer.");
+      return false;
+    }
+  }
+  plan_.SetOutputIndices(output_indices);
+  workspace_.Reserve(plan_);
+
+  plan_stale_ = false;
+  cone_valid_ = false;
+  // The weights might have been changed or moved around.
+  optimizer_step_ = 0;
+  return true;
+}
+
+const ExecutionPlan *MFNetwork::GetExecutionPlan() {
+  if (plan_stale_ && !BuildPlan()) {
+    return nullptr;
+  }
+  return &plan_;
+}
+
 bool MFNetwork::CheckInitialized() {
   if (initialized_) {
     return true;
@@ -242,6 +478,7 @@ Neuron *MFNetwork::GetNeuron(uint32_t layer_i, uint32_t neuron_i) {
     return nullptr;
   }
 
+  MarkChanged();
   return layer->Neurons[neuron_i];
 }
 
@@ -254,6 +491,7 @@ bool MFNetwork::SetLayerWeights(uint32_t layer_i,
   for (Neuron *neuron : layer->Neurons) {
     neuron->SetWeights(values);
   }
+  MarkChanged();
   return true;
 }
 
@@ -264,6 +502,7 @@ void MFNetwork::SetOutputFunctions(ImpulseFunction *impulse) {
       neuron->SetOutputFunction(impulse);
     }
   }
+  MarkChanged();
 }
 
 bool MFNetwork::SetLayerOutputFunctions(uint32_t layer_i,
@@ -275,6 +514,17 @@ bool MFNetwork::SetLayerOutputFunctions(uint32_t layer_i,
   for (Neuron *neuron : layer->Neurons) {
     neuron->SetOutputFunction(impulse);
   }
+  MarkChanged();
+  return true;
+}
+
+bool MFNetwork::SetLayerImpulseAccuracy(uint32_t layer_i,
+    ImpulseAccuracy accuracy) {
+  if (!layer_i || layer_i >= layers_.size()) {
+    return false;
+  }
+  layers_[layer_i]->Accuracy = accuracy;
+  MarkChanged();
   return true;
 }
 
@@ -294,6 +544,7 @@ bool MFNetwork::SetLayerBiases(uint32_t layer_i, double bias) {
   for (Neuron *neuron : layer->Neurons) {
     neuron->SetBias(bias);
   }
+  MarkChanged();
 
   return true;
 }
@@ -311,6 +562,7 @@ bool MFNetwork::SetOutputRoute(uint32_t layer_i, uint32_t neuron_i,
   // Write to the proper layer's routing map.
   layer->RoutingMap[neuron_i] = output_nodes;
   layer->DefaultRouting = false;
+  MarkChanged();
   return true;
 }
 
@@ -326,75 +578,572 @@ bool MFNetwork::CopyLayout(const MFNetwork& source) {
   for (uint32_t i = 0; i < layers_.size(); ++i) {
     layers_[i]->RoutingMap = source.layers_[i]->RoutingMap;
   }
+  MarkChanged();
 
   return true;
 }
 
+void MFNetwork::SetThreadPool(helpers::ThreadPool *pool,
+    uint32_t min_parallel_neurons/* = kMinParallelNeurons*/) {
+  pool_ = pool;
+  min_parallel_neurons_ = min_parallel_neurons;
+  plan_.SetThreadPool(pool, min_parallel_neurons);
+}
+
 bool MFNetwork::PropagateError(const double *targets,
-    double *final_outputs/* = nullptr*/) {
-  double outputs [num_outputs_];
-  std::vector<double> internal;
-  if (!final_outputs) {
-    GetOutputs(outputs);
-  } else {
-    // We can skip calculating outputs.
-    memcpy(outputs, final_outputs, sizeof(outputs[0]) * num_outputs_);
+    double * /*final_outputs = nullptr*/) {
+  if (plan_stale_ && !BuildPlan()) {
+    return false;
+  }
+  if (gradient_buffers_.empty()) {
+    gradient_buffers_.resize(1);
+  }
+  GradientBuffer *buffer = &gradient_buffers_[0];
+  RunSample(input_values_.data(), targets, buffer);
+  if (optimizer_) {
+    StartOptimizerStep();
+  }
+
+  // Iterate across the plan backwards. The errors for each layer are worked
+  // out from the ones for the layer after it before that layer's weights get
+  // adjusted, so that they're based on the same weights that produced the
+  // outputs.
+  for (int layer_i = plan_.GetNumLayers() - 1; layer_i >= 0; --layer_i) {
+    const ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+    if (layer_i > 0) {
+      buffer->NextErrors.resize(layer->Inputs);
+      plan_.RunLayerTransposed(layer_i, buffer->Errors.data(),
+                               buffer->NextErrors.data());
+    }
+    ToSignals(layer, buffer->Outputs[layer_i].data(), 1, buffer);
+    // The first layer's inputs are the network inputs, so if those are
+    // sparse, so are its weight changes.
+    AdjustLayer(layer_i,
+                layer_i ? buffer->Outputs[layer_i - 1].data() :
+                          input_values_.data(),
+                buffer->Errors.data(), !layer_i && sparse_inputs_);
+    buffer->Errors.swap(buffer->NextErrors);
+  }
+
+  // The plan has been kept up to date with the neurons, so it doesn't need to
+  // be rebuilt, but anything computed with the old weights is stale.
+  ++version_;
+  return true;
+}
+
+void MFNetwork::RunSample(const double *inputs, const double *targets,
+                          GradientBuffer *buffer) const {
+  const uint32_t num_layers = plan_.GetNumLayers();
+  buffer->Outputs.resize(num_layers);
+  const double *in = inputs;
+  for (uint32_t layer_i = 0; layer_i < num_layers; ++layer_i) {
+    buffer->Outputs[layer_i].resize(plan_.GetLayer(layer_i)->Outputs);
+    plan_.RunLayer(layer_i, in, buffer->Outputs[layer_i].data());
+    in = buffer->Outputs[layer_i].data();
   }
 
-  // Stores the errors from the last layer. We also use it to store the network
-  // errors initially.
-  std::map<uint32_t, double> last_errors_input;
-  // Buffer for last_errors_input.
-  std::map<uint32_t, double> last_errors_output;
+  // Output layer neurons that don't feed a network output don't have any
+  // error.
+  const std::vector<uint32_t>& output_indices = plan_.GetOutputIndices();
+  buffer->Errors.assign(plan_.GetLayer(num_layers - 1)->Outputs, 0);
   for (uint32_t i = 0; i < num_outputs_; ++i) {
-    last_errors_input[i] = targets[i] - outputs[i];
+    buffer->Errors[output_indices[i]] = targets[i] - in[output_indices[i]];
   }
+}
 
-  // Iterate across our network backwards.
-  for (int layer_i = layers_.size() - 1; layer_i >= 0; --layer_i) {
-    Layer_t *layer = layers_[layer_i];
-    for (int neuron_i = layer->Neurons.size() - 1;
-        neuron_i >= 0; --neuron_i) {
-      Neuron *neuron = layer->Neurons[neuron_i];
-      ImpulseFunction *impulse = neuron->GetOutputFunction();
-
-      if (impulse != nullptr) {
-        double error = 0;
-        if (static_cast<uint32_t>(layer_i) == layers_.size() - 1) {
-          // Output layer.
-          error = last_errors_input[neuron_i];
-        } else if (layer_i != 0) {
-          // Hidden layer.
-          // Based on how we assign outputs to weights, we can work backwards to
-          // find which weight on the downstream neuron governs the output of
-          // this one.
-          Layer_t *lower_layer = layers_[layer_i + 1];
-          for (int dest : layer->RoutingMap[neuron_i]) {
-            Neuron *lower_neuron = lower_layer->Neurons[dest];
-            double weight;
-            CHECK(lower_neuron->GetLastWeight(&weight),
-                "Neuron has the wrong number of weights.");
-            error += weight * last_errors_input[dest];
+void MFNetwork::AdjustLayer(uint32_t layer_i, const double *inputs,
+                            const double *signals, bool skip_zero_inputs) {
+  ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+  // The input layer isn't in the plan.
+  Layer_t *source = layers_[layer_i + 1];
+  const uint32_t width = layer->Outputs;
+
+  // Each neuron takes its inputs in the order of its weights. Unless the
+  // routing has been changed, that's the order of the columns in the plan,
+  // and <inputs> can be used as it is. Otherwise, they have to be gathered
+  // up first.
+  bool gather = !layer->Connections.empty();
+  for (uint32_t neuron_i = 0; !gather && neuron_i < width; ++neuron_i) {
+    gather = source->WeightColumns[neuron_i].size() != layer->Inputs;
+  }
+  if (gather) {
+    gathered_offsets_.resize(width + 1);
+    size_t offset = 0;
+    for (uint32_t neuron_i = 0; neuron_i < width; ++neuron_i) {
+      gathered_offsets_[neuron_i] = offset;
+      offset += source->WeightColumns[neuron_i].size();
+    }
+    gathered_offsets_[width] = offset;
+    gathered_inputs_.resize(offset);
+    for (uint32_t neuron_i = 0; neuron_i < width; ++neuron_i) {
+      double *gathered = gathered_inputs_.data() + gathered_offsets_[neuron_i];
+      for (uint32_t column : source->WeightColumns[neuron_i]) {
+        *gathered++ = inputs[column];
+      }
+    }
+  }
+
+  // Each neuron only touches its own weights, so wide layers can be split up.
+  SplitNeurons(width, [this, layer, source, inputs, signals, skip_zero_inputs,
+                       gather](uint32_t begin, uint32_t end) {
+    for (uint32_t neuron_i = begin; neuron_i < end; ++neuron_i) {
+      const double *neuron_inputs = gather ?
+          gathered_inputs_.data() + gathered_offsets_[neuron_i] : inputs;
+      Neuron *neuron = source->Neurons[neuron_i];
+      if (optimizer_) {
+        neuron->Optimize(*optimizer_, optimizer_step_, signals[neuron_i],
+                         neuron_inputs, signals[neuron_i],
+                         source->OptimizerState.data() +
+                             source->StateOffsets[neuron_i],
+                         source->StateOffsets.back(), skip_zero_inputs);
+      } else {
+        neuron->ApplySignal(learning_rate_, momentum_, signals[neuron_i],
+                            neuron_inputs, skip_zero_inputs);
+      }
+      CopyWeightsToPlan(source, neuron_i, layer);
+    }
+  });
+  // Only the values of the weights changed, so the sparse matrices can be
+  // updated in place.
+  plan_.UpdateSparseWeights(layer);
+}
+
+void MFNetwork::StartOptimizerStep() {
+  if (!optimizer_step_) {
+    const uint32_t state_size = optimizer_->GetStateSize();
+    // The input layer has no weights.
+    for (uint32_t layer_i = 1; layer_i < layers_.size(); ++layer_i) {
+      Layer_t *layer = layers_[layer_i];
+      layer->OptimizerState.assign(state_size * layer->StateOffsets.back(), 0);
+    }
+  }
+  ++optimizer_step_;
+}
+
+void MFNetwork::CopyWeightsToPlan(const Layer_t *source, uint32_t neuron_i,
+                                  ExecutionPlan::Layer *layer) {
+  // This goes the same way as in BuildPlan(), where weights on the same input
+  // add up.
+  Neuron *neuron = source->Neurons[neuron_i];
+  const double *weights = neuron->GetWeightData();
+  const std::vector<uint32_t>& columns = source->WeightColumns[neuron_i];
+  double *row = layer->Weights.data() + neuron_i * layer->Stride;
+  for (uint32_t column : columns) {
+    row[column] = 0;
+  }
+  for (uint32_t i = 0; i < columns.size(); ++i) {
+    row[columns[i]] += weights[i];
+  }
+  layer->Biases[neuron_i] = neuron->GetBias();
+}
+
+bool MFNetwork::PropagateErrorBatch(const double *inputs,
+                                    const double *targets, size_t count) {
+  if (plan_stale_ && !BuildPlan()) {
+    return false;
+  }
+  if (!count) {
+    return true;
+  }
+
+  // Each shard of the batch gets its own gradient buffer. The shards only
+  // depend on the number of threads, and their gradients always get added
+  // up in the same order, so the results are exactly the same from one run
+  // to the next.
+  const size_t num_shards =
+      pool_ ? std::min<size_t>(count, pool_->GetNumThreads() + 1) : 1;
+  if (gradient_buffers_.size() < num_shards) {
+    gradient_buffers_.resize(num_shards);
+  }
+  auto compute_shards = [this, inputs, targets, count, num_shards](
+      uint32_t begin, uint32_t end) {
+    for (uint32_t shard_i = begin; shard_i < end; ++shard_i) {
+      const size_t start = count * shard_i / num_shards;
+      const size_t shard_end = count * (shard_i + 1) / num_shards;
+      ComputeGradients(inputs + start * num_inputs_,
+                       targets + start * num_outputs_, shard_end - start,
+                       &gradient_buffers_[shard_i]);
+    }
+  };
+  if (num_shards > 1) {
+    pool_->ParallelFor(0, num_shards, compute_shards);
+  } else {
+    compute_shards(0, 1);
+  }
+
+  // Add the shards together pairwise, in a tree, so that each level can be
+  // done in parallel and the total ends up in the first one.
+  for (size_t step = 1; step < num_shards; step *= 2) {
+    const uint32_t pairs = (num_shards - step + 2 * step - 1) / (2 * step);
+    auto add_pairs = [this, step, num_shards](uint32_t begin, uint32_t end) {
+      for (uint32_t pair_i = begin; pair_i < end; ++pair_i) {
+        const size_t to = pair_i * 2 * step;
+        if (to + step < num_shards) {
+          AddGradients(gradient_buffers_[to + step], &gradient_buffers_[to]);
+        }
+      }
+    };
+    if (pairs > 1) {
+      pool_->ParallelFor(0, pairs, add_pairs);
+    } else {
+      add_pairs(0, pairs);
+    }
+  }
+
+  ApplyGradients(gradient_buffers_[0], count);
+  return true;
+}
+
+void MFNetwork::ComputeGradients(const double *inputs, const double *targets,
+                                 size_t count, GradientBuffer *buffer) const {
+  const uint32_t num_layers = plan_.GetNumLayers();
+  buffer->Outputs.resize(num_layers);
+  buffer->Weights.resize(num_layers);
+  buffer->Biases.resize(num_layers);
+
+  // Run the whole batch forwards, keeping what comes out of every layer.
+  const double *in = inputs;
+  for (uint32_t layer_i = 0; layer_i < num_layers; ++layer_i) {
+    const ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+    buffer->Outputs[layer_i].resize(count * layer->Outputs);
+    buffer->Weights[layer_i].assign(
+        static_cast<size_t>(layer->Outputs) * layer->Inputs, 0);
+    buffer->Biases[layer_i].assign(layer->Outputs, 0);
+    plan_.RunLayerBatch(layer_i, in, count, buffer->Outputs[layer_i].data());
+    in = buffer->Outputs[layer_i].data();
+  }
+
+  // The network errors. Output layer neurons that don't feed a network output
+  // don't have any.
+  const std::vector<uint32_t>& output_indices = plan_.GetOutputIndices();
+  const uint32_t last_width = plan_.GetLayer(num_layers - 1)->Outputs;
+  buffer->Errors.assign(count * last_width, 0);
+  for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+    for (uint32_t i = 0; i < num_outputs_; ++i) {
+      const size_t neuron_i = sample_i * last_width + output_indices[i];
+      buffer->Errors[neuron_i] =
+          targets[sample_i * num_outputs_ + i] - in[neuron_i];
+    }
+  }
+
+  // Like PropagateError(), the errors for each layer are worked out from the
+  // errors of the one after it, before they get turned into signals.
+  for (int layer_i = num_layers - 1; layer_i >= 0; --layer_i) {
+    const ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+    const uint32_t width = layer->Outputs;
+    const uint32_t in_width = layer->Inputs;
+    if (layer_i > 0) {
+      buffer->NextErrors.resize(count * in_width);
+      for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+        plan_.RunLayerTransposed(layer_i, &buffer->Errors[sample_i * width],
+                                 &buffer->NextErrors[sample_i * in_width]);
+      }
+    }
+
+    ToSignals(layer, buffer->Outputs[layer_i].data(), count, buffer);
+
+    // Add up the gradient for every weight over the batch. Each neuron only
+    // touches its own row, and reads the inputs for each sample in order.
+    const double *layer_inputs =
+        layer_i ? buffer->Outputs[layer_i - 1].data() : inputs;
+    double *weights = buffer->Weights[layer_i].data();
+    double *biases = buffer->Biases[layer_i].data();
+    SplitNeurons(width, [layer, buffer, layer_inputs, count, width, in_width,
+                         weights, biases](uint32_t begin, uint32_t end) {
+      for (uint32_t neuron_i = begin; neuron_i < end; ++neuron_i) {
+        double *row = weights + static_cast<size_t>(neuron_i) * in_width;
+        for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+          const double signal = buffer->Errors[sample_i * width + neuron_i];
+          if (signal == 0) {
+            continue;
           }
-       }
+          biases[neuron_i] += signal;
+          const double *sample_inputs = layer_inputs + sample_i * in_width;
+          if (layer->Sparse) {
+            for (uint32_t k = layer->RowStarts[neuron_i];
+                 k < layer->RowStarts[neuron_i + 1]; ++k) {
+              const uint32_t column = layer->Columns[k];
+              row[column] += signal * sample_inputs[column];
+            }
+          } else {
+            kernels::Axpy(signal, sample_inputs, row, in_width);
+          }
+        }
+      }
+    });
+
+    buffer->Errors.swap(buffer->NextErrors);
+  }
+}
 
-       // Do this as long as it's not the input layer.
-       if (layer_i != 0) {
-         last_errors_output[neuron_i] = error;
-         CHECK(neuron->AdjustWeights(learning_rate_, momentum_, error),
-             "Failed to update neuron weights.");
+void MFNetwork::ToSignals(const ExecutionPlan::Layer *layer,
+                          const double *outputs, size_t count,
+                          GradientBuffer *buffer) const {
+  const uint32_t width = layer->Outputs;
+  buffer->Derivatives.resize(width);
+  for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+    const double *sample_outputs = outputs + sample_i * width;
+    if (layer->Type != ImpulseType::CUSTOM) {
+      ApplyDerivative(layer->Type, layer->Parameter, sample_outputs,
+                      buffer->Derivatives.data(), width);
+    } else {
+      for (uint32_t i = 0; i < width; ++i) {
+        buffer->Derivatives[i] =
+            layer->Impulses[i]->Derivative(sample_outputs[i]);
+      }
+    }
+    double *errors = &buffer->Errors[sample_i * width];
+    for (uint32_t i = 0; i < width; ++i) {
+      errors[i] *= buffer->Derivatives[i];
+    }
+  }
+}
+
+void MFNetwork::AddGradients(const GradientBuffer& from,
+                             GradientBuffer *to) const {
+  for (uint32_t layer_i = 0; layer_i < from.Weights.size(); ++layer_i) {
+    kernels::Axpy(1.0, from.Weights[layer_i].data(),
+                  to->Weights[layer_i].data(), from.Weights[layer_i].size());
+    kernels::Axpy(1.0, from.Biases[layer_i].data(),
+                  to->Biases[layer_i].data(), from.Biases[layer_i].size());
+  }
+}
+
+void MFNetwork::ApplyGradients(const GradientBuffer& gradients,
+                               size_t count) {
+  if (optimizer_) {
+    StartOptimizerStep();
+  }
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+    // The input layer isn't in the plan.
+    Layer_t *source = layers_[layer_i + 1];
+    const double *weight_gradients = gradients.Weights[layer_i].data();
+    const double *bias_gradients = gradients.Biases[layer_i].data();
+    const uint32_t in_width = layer->Inputs;
+
+    SplitNeurons(layer->Outputs, [this, layer, source, weight_gradients,
+                                  bias_gradients, in_width, count](
+        uint32_t begin, uint32_t end) {
+      std::vector<double> neuron_gradients;
+      for (uint32_t neuron_i = begin; neuron_i < end; ++neuron_i) {
+        // Hand the averages to the neuron in the order of its weights.
+        const double *row =
+            weight_gradients + static_cast<size_t>(neuron_i) * in_width;
+        Neuron *neuron = source->Neurons[neuron_i];
+        const std::vector<uint32_t>& columns =
+            source->WeightColumns[neuron_i];
+        neuron_gradients.resize(columns.size());
+        for (uint32_t i = 0; i < columns.size(); ++i) {
+          neuron_gradients[i] = row[columns[i]] / count;
+        }
+        if (optimizer_) {
+          neuron->Optimize(*optimizer_, optimizer_step_, 1.0,
+                           neuron_gradients.data(),
+                           bias_gradients[neuron_i] / count,
+                           source->OptimizerState.data() +
+                               source->StateOffsets[neuron_i],
+                           source->StateOffsets.back());
+        } else {
+          neuron->ApplyGradients(learning_rate_, momentum_,
+                                 neuron_gradients.data(),
+                                 bias_gradients[neuron_i] / count);
+        }
+        CopyWeightsToPlan(source, neuron_i, layer);
+      }
+    });
+    // Only the values of the weights changed, so the sparse matrices can be
+    // updated in place.
+    plan_.UpdateSparseWeights(layer);
+  }
+
+  // The plan has been kept up to date with the neurons, so it doesn't need to
+  // be rebuilt, but anything computed with the old weights is stale.
+  ++version_;
+}
+
+bool MFNetwork::PropagateErrorAsync(const double *inputs,
+                                    const double *targets, size_t count) {
+  if (plan_stale_ && !BuildPlan()) {
+    return false;
+  }
+  if (!count) {
+    return true;
+  }
+
+  // Each thread works through its own share of the samples, with its own
+  // scratch space.
+  const size_t num_shards =
+      pool_ ? std::min<size_t>(count, pool_->GetNumThreads() + 1) : 1;
+  if (gradient_buffers_.size() < num_shards) {
+    gradient_buffers_.resize(num_shards);
+  }
+  auto train_shards = [this, inputs, targets, count, num_shards](
+      uint32_t begin, uint32_t end) {
+    for (uint32_t shard_i = begin; shard_i < end; ++shard_i) {
+      const size_t shard_end = count * (shard_i + 1) / num_shards;
+      for (size_t sample_i = count * shard_i / num_shards;
+           sample_i < shard_end; ++sample_i) {
+        TrainSampleAsync(inputs + sample_i * num_inputs_,
+                         targets + sample_i * num_outputs_,
+                         &gradient_buffers_[shard_i]);
+      }
+    }
+  };
+  if (num_shards > 1) {
+    pool_->ParallelFor(0, num_shards, train_shards);
+  } else {
+    train_shards(0, 1);
+  }
+
+  SyncNeuronsFromPlan();
+  return true;
+}
+
+namespace {
+
+// Adds <delta> to <weight>, which other threads might be updating at the same
+// time. The relaxed load and store can't tear the weight, but they don't
+// order anything either, so an update that lands in between them is lost.
+// That's the Hogwild! bargain: losing the odd update is cheaper than locking.
+inline void AddRelaxed(double *weight, double delta) {
+  double value;
+  __atomic_load(weight, &value, __ATOMIC_RELAXED);
+  value += delta;
+  __atomic_store(weight, &value, __ATOMIC_RELAXED);
+}
+
+} // namespace
+
+void MFNetwork::TrainSampleAsync(const double *inputs, const double *targets,
+                                 GradientBuffer *buffer) {
+  RunSample(inputs, targets, buffer);
+
+  // This goes just like PropagateError(), except that each layer is updated
+  // straight in the plan.
+  for (int layer_i = plan_.GetNumLayers() - 1; layer_i >= 0; --layer_i) {
+    ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+    const uint32_t in_width = layer->Inputs;
+    const double *errors = buffer->Errors.data();
+    if (layer_i > 0) {
+      buffer->NextErrors.assign(in_width, 0);
+      double *next_errors = buffer->NextErrors.data();
+      if (layer->Sparse) {
+        // These are the weights that get updated, not the ones in the CSC
+        // form, so work through the rows.
+        for (uint32_t row = 0; row < layer->Outputs; ++row) {
+          if (errors[row] == 0) {
+            continue;
+          }
+          for (uint32_t k = layer->RowStarts[row];
+               k < layer->RowStarts[row + 1]; ++k) {
+            next_errors[layer->Columns[k]] +=
+                layer->RowWeights[k] * errors[row];
+          }
         }
       } else {
-        return false;
+        plan_.RunLayerTransposed(layer_i, errors, next_errors);
       }
     }
 
-    // Swap the last errors buffers for a new cycle.
-    last_errors_input.swap(last_errors_output);
-    last_errors_output.clear();
+    ToSignals(layer, buffer->Outputs[layer_i].data(), 1, buffer);
+    const double *layer_inputs =
+        layer_i ? buffer->Outputs[layer_i - 1].data() : inputs;
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      const double signal = buffer->Errors[row];
+      if (signal == 0) {
+        continue;
+      }
+      const double scale = learning_rate_ * signal;
+      AddRelaxed(&layer->Biases[row], scale);
+      // Inputs that are zero don't move their weights, so with sparse
+      // activations, most weights don't get touched at all.
+      if (layer->Sparse) {
+        for (uint32_t k = layer->RowStarts[row];
+             k < layer->RowStarts[row + 1]; ++k) {
+          const double input = layer_inputs[layer->Columns[k]];
+          if (input != 0) {
+            AddRelaxed(&layer->RowWeights[k], scale * input);
+          }
+        }
+      } else if (!layer->Connections.empty()) {
+        // Connections that don't exist have to stay at zero.
+        const uint32_t row_start = row * in_width;
+        for (auto connection = std::lower_bound(layer->Connections.begin(),
+                                                layer->Connections.end(),
+                                                row_start);
+             connection != layer->Connections.end() &&
+             *connection < row_start + in_width;
+             ++connection) {
+          const uint32_t column = *connection - row_start;
+          if (layer_inputs[column] != 0) {
+            AddRelaxed(&layer->Weights[row * layer->Stride + column],
+                       scale * layer_inputs[column]);
+          }
+        }
+      } else {
+        double *weights = layer->Weights.data() + row * layer->Stride;
+        for (uint32_t column = 0; column < in_width; ++column) {
+          if (layer_inputs[column] != 0) {
+            AddRelaxed(&weights[column], scale * layer_inputs[column]);
+          }
+        }
+      }
+    }
+
+    buffer->Errors.swap(buffer->NextErrors);
   }
+}
 
-  return true;
+void MFNetwork::SyncNeuronsFromPlan() {
+  std::vector<double> weights;
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    ExecutionPlan::Layer *layer = plan_.GetLayer(layer_i);
+    // The input layer isn't in the plan.
+    Layer_t *source = layers_[layer_i + 1];
+    if (layer->Sparse) {
+      // Sparse layers were updated in their CSR form.
+      for (uint32_t row = 0; row < layer->Outputs; ++row) {
+        for (uint32_t k = layer->RowStarts[row];
+             k < layer->RowStarts[row + 1]; ++k) {
+          layer->Weights[row * layer->Stride + layer->Columns[k]] =
+              layer->RowWeights[k];
+        }
+      }
+    }
+    plan_.FinishLayer(layer);
+
+    // When a neuron has more than one weight on the same input, the plan only
+    // has their sum, so the change gets split evenly between them.
+    std::vector<double> old_sums(layer->Inputs);
+    std::vector<uint32_t> counts(layer->Inputs);
+    for (uint32_t neuron_i = 0; neuron_i < layer->Outputs; ++neuron_i) {
+      Neuron *neuron = source->Neurons[neuron_i];
+      const std::vector<uint32_t>& columns = source->WeightColumns[neuron_i];
+      neuron->GetWeights(&weights);
+      for (uint32_t column : columns) {
+        old_sums[column] = 0;
+        counts[column] = 0;
+      }
+      for (uint32_t i = 0; i < columns.size(); ++i) {
+        old_sums[columns[i]] += weights[i];
+        ++counts[columns[i]];
+      }
+      const double *row = layer->Weights.data() + neuron_i * layer->Stride;
+      for (uint32_t i = 0; i < columns.size(); ++i) {
+        weights[i] += (row[columns[i]] - old_sums[columns[i]]) /
+                      counts[columns[i]];
+      }
+      // Momentum from earlier training carries on from the new weights.
+      neuron->UpdateWeights(weights);
+      neuron->SetBias(layer->Biases[neuron_i]);
+    }
+  }
+
+  // The plan is already up to date, but anything computed with the old
+  // weights is stale. So is the state the optimizer kept for them.
+  ++version_;
+  optimizer_step_ = 0;
 }
 
 bool MFNetwork::Clone(MFNetwork *dest) {
@@ -480,6 +1229,7 @@ bool MFNetwork::SetChromosome(uint64_t *chromosome) {
       neuron->SetBias(bias);
     }
   }
+  MarkChanged();
   return true;
 }
 
@@ -720,6 +1470,7 @@ size_t MFNetwork::Deserialize(const char *buffer) {
   initialized_ = basic_info[basic_info_index++];
   upper_ = basic_info[basic_info_index++];
   lower_ = basic_info[basic_info_index++];
+  input_values_.assign(num_inputs_, 0);
 
   // Retrieve weight info.
   int weight_info_index = 0;
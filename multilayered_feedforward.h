@@ -7,9 +7,13 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "execution_plan.h"
+#include "inference_cache.h"
 #include "network.h"
 #include "neuron.h"
+#include "optimizers.h"
 #include "output_functions.h"
+#include "thread_pool.h"
 
 // Contains the necessary code for representing a multilayed-feedforward neural
 // network.
@@ -44,12 +48,29 @@ class MFNetwork : public Network {
       return 0;
     }
   }
+  // Returns the number of inputs the network takes.
+  inline uint32_t GetNumInputs() const {
+    return num_inputs_;
+  }
+  // Returns the number of outputs the network produces.
+  inline uint32_t GetNumOutputs() const {
+    return num_outputs_;
+  }
   // Removes the layer at the specified index. Trying to remove the input or
   // output layers results in it returning false.
   bool RemoveLayer(uint32_t index);
   // Writes contents of array values to the inputs. Values must be the same
   // size as the number of inputs.
   void SetInputs(const double *values);
+  // Sets the inputs to all zeros, except for the <count> inputs at <indices>,
+  // which get the values in <values>. Each index should only appear once.
+  // This is meant for inputs that are mostly zero, like one-hot encodings. A
+  // compiled network only reads the weights for the nonzero inputs, and the
+  // next back propagation skips the weights on the zero ones, which also
+  // keeps their momentum from moving them. This lasts until the next call to
+  // SetInputs().
+  void SetSparseInputs(const uint32_t *indices, const double *values,
+                       size_t count);
   // Computes each neuron for the given inputs and writes the contents to the
   // array values. Values must be able to accomodate a number of items that is
   // at least the number of outputs. Returns true for success, false for
@@ -57,6 +78,53 @@ class MFNetwork : public Network {
   inline bool GetOutputs(double *values) {
     return DoUpdate(values);
   }
+  // Computes the outputs for <count> sets of inputs at once. <inputs> holds
+  // each set of inputs one after another, and <outputs> must have room for
+  // <count> times the number of outputs, which get written the same way. This
+  // always runs the compiled plan, building it first if necessary, but it does
+  // not affect what SetInputs() and GetOutputs() do. Returns true for success,
+  // false for failure.
+  bool GetOutputsBatch(const double *inputs, size_t count, double *outputs);
+  // Computes only the <count> outputs in <output_ids> for the current inputs,
+  // and writes them to <values> in the same order. Only the neurons that
+  // those outputs depend on get computed. Finding them takes a walk back
+  // through the network, so the last set of outputs asked for is remembered,
+  // and asking for the same ones again is cheap. Like GetOutputsBatch(), this
+  // always runs the compiled plan. Returns false if the network can't be run
+  // or any of the outputs don't exist.
+  bool GetOutputsSubset(const uint32_t *output_ids, size_t count,
+                        double *values);
+  // Computes the outputs for <inputs> using the compiled plan, keeping all
+  // the state for the call in <workspace>. Since it doesn't change the
+  // network, any number of threads can do this at once on the same network,
+  // as long as each has its own workspace and nothing modifies the network in
+  // the meantime. (The impulse functions get shared too, so they must not keep
+  // any state of their own.) Returns false if the network has not been
+  // compiled, or has changed since, in which case Compile() needs to be called
+  // again first.
+  bool Evaluate(const double *inputs, double *outputs,
+                InferenceWorkspace *workspace) const;
+  // The same as Evaluate(), but for <count> sets of inputs at once, laid out
+  // like they are for GetOutputsBatch().
+  bool EvaluateBatch(const double *inputs, size_t count, double *outputs,
+                     InferenceWorkspace *workspace) const;
+  // The same as Evaluate(), but with inputs given like they are for
+  // SetSparseInputs().
+  bool EvaluateSparse(const uint32_t *indices, const double *values,
+                      size_t count, double *outputs,
+                      InferenceWorkspace *workspace) const;
+  // Freezes the current layout, weights and impulse functions of the network
+  // into a flat ExecutionPlan, and makes GetOutputs() run that instead of
+  // walking the layer structures. Changing the network through any of its
+  // methods causes the plan to be rebuilt automatically on the next call to
+  // GetOutputs(). Returns false if the network can't be run in its current
+  // state.
+  bool Compile();
+  // Returns the compiled form of the network, building it first if necessary.
+  // Unlike Compile(), this doesn't make GetOutputs() use it. The plan belongs
+  // to the network, and changes along with it. Returns nullptr if the network
+  // can't be run in its current state.
+  const ExecutionPlan *GetExecutionPlan();
   // Normally, the network sets user-specific and random weights when they are
   // needed. Calling this function forces the network to set the weights right
   // now.
@@ -68,7 +136,9 @@ class MFNetwork : public Network {
   bool CheckInitialized();
   // Sets neuron to point to the neuron in the layer specified by layer_i, which
   // indexes from 0, starting with the input layer, and neuron_i, which indexes
-  // from 0. Returns nullptr upon failure.
+  // from 0. Returns nullptr upon failure. Because the neuron can be modified
+  // through the returned pointer, this also invalidates any compiled plan, so
+  // the changes should be made before the next call to GetOutputs().
   Neuron *GetNeuron(uint32_t layer_i, uint32_t neuron_i);
   // The following function sets all the neuron's weights to random values. Upper
   // and lower are the inclusive bounds of these values.
@@ -77,12 +147,14 @@ class MFNetwork : public Network {
     upper_ = upper;
     lower_ = lower;
     initialized_ = false;
+    MarkChanged();
   }
   // Sets all the weights in the network to <value>.
   void SetWeights(double value) {
     use_special_weights_ = 2;
     user_weight_ = value;
     initialized_ = false;
+    MarkChanged();
   }
   // Sets the weights on all the inputs going into <layer_i> to <values>.
   bool SetLayerWeights(uint32_t layer_i, const std::vector<double>& values);
@@ -92,6 +164,12 @@ class MFNetwork : public Network {
   // the index of said layer.
   bool SetLayerOutputFunctions(uint32_t layer_i,
       ImpulseFunction *impulse);
+  // Lets the compiled plan use a faster approximation of Sigmoid or TanH for
+  // the layer at <layer_i>, as described by ImpulseAccuracy. Everything that
+  // runs on the plan uses it: GetOutputs() and Evaluate() once the network is
+  // compiled, and GetOutputsBatch(), GetOutputsSubset() and all the training
+  // methods whether or not it is. Returns false to indicate a bad layer index.
+  bool SetLayerImpulseAccuracy(uint32_t layer_i, ImpulseAccuracy accuracy);
   // Sets the bias weight for all the neurons in the network.
   void SetBiases(double bias);
   // Sets the bias weight for all the neurons in a layer. Returns false to
@@ -105,6 +183,23 @@ class MFNetwork : public Network {
   // Copies the architechture of <source> into this network, but keeps the weights of
   // this network set to 1.
   bool CopyLayout(const MFNetwork& source);
+  // Lets the neurons in layers with at least <min_parallel_neurons> neurons be
+  // split up across the threads in <pool>, both when computing outputs with a
+  // compiled plan and when adjusting weights during back propagation. Smaller
+  // layers aren't worth the overhead of handing them out, so they stay on the
+  // calling thread. The pool must outlive the network, or be replaced with
+  // nullptr, which turns this off again.
+  void SetThreadPool(helpers::ThreadPool *pool,
+                     uint32_t min_parallel_neurons = kMinParallelNeurons);
+  // Puts <cache> in front of GetOutputs() and Evaluate(), so that inputs
+  // which have been seen before don't have to be run through the network
+  // again. Any change to the network, including training it, makes the
+  // outputs already in the cache invalid. Each network needs a cache of its
+  // own, which must outlive it, or be replaced with nullptr, which turns this
+  // off again.
+  inline void SetInferenceCache(InferenceCache *cache) {
+    cache_ = cache;
+  }
   // Allows the user to specify the learning rate coefficient for the
   // back-propagation algorithm. (The default is 0.01.)
   inline void SetLearningRate(const double rate) {
@@ -114,14 +209,56 @@ class MFNetwork : public Network {
   inline void SetMomentum(const double momentum) {
     momentum_ = momentum;
   }
+  // Has PropagateError() and PropagateErrorBatch() move the weights the way
+  // <optimizer> says to, instead of with the learning rate and momentum set
+  // above. The state it keeps for each weight starts over whenever this gets
+  // called, and whenever the network gets rebuilt, such as when weights are
+  // set, or trained with PropagateErrorAsync(), which doesn't use it. The
+  // optimizer must outlive the network, or be replaced with nullptr, which
+  // goes back to the default.
+  inline void SetOptimizer(Optimizer *optimizer) {
+    optimizer_ = optimizer;
+    optimizer_step_ = 0;
+  }
   // Propagates an error through the network, adjusting weights as it goes. You
   // give it a target value, and it calculates the error.
   // Although it can return false, the only time it should really do so is if
   // you're trying to propagate an error through a network which can't give you
-  // a valid output in the first place. <final_outputs> allows the user to
-  // provide output information to the function, saving the extra time to
-  // calculate it.
+  // a valid output in the first place. The error flows back through each layer
+  // of the compiled plan as a product with the transpose of its weights, which
+  // needs the output of every layer, so the network always gets run forwards
+  // first, and <final_outputs> is ignored. It's only still here so that
+  // existing callers don't break.
   bool PropagateError(const double *targets, double *final_outputs = nullptr);
+  // Trains on <count> samples at once. They all get run through the compiled
+  // plan together, their errors get propagated back through it together, and
+  // then each weight is adjusted just once, by the learning rate times its
+  // gradient averaged over the batch, plus momentum, (or by the optimizer, if
+  // there is one, given that average gradient.) This turns both passes
+  // into matrix-matrix work. <inputs> and <targets> are laid out like the
+  // inputs and outputs for GetOutputsBatch(). For a single sample, the weights
+  // change the same way they do with PropagateError(). With a thread pool,
+  // the batch gets split into a shard for each thread, (including the calling
+  // one,) which work out their gradients at the same time. The results only
+  // depend on the number of threads, not on how they get scheduled. Returns
+  // false if the network can't be run.
+  bool PropagateErrorBatch(const double *inputs, const double *targets,
+                           size_t count);
+  // Trains on each of <count> samples in turn, laid out like they are for
+  // PropagateErrorBatch(), much like calling PropagateError() on each of them,
+  // but on the compiled plan. With a thread pool, each thread takes a share of
+  // the samples, and they all update the same weights at the same time
+  // without any locking, in the style of Hogwild! Weights on inputs that are
+  // zero don't get touched, so when activations are sparse, threads rarely
+  // update the same weight, and losing the odd update costs less than
+  // keeping them in sync. Neither momentum nor the optimizer is used, and
+  // with more than one thread, the results depend on how the threads get
+  // scheduled. The neurons get brought up to date once all the samples are
+  // done. Momentum from PropagateError() and PropagateErrorBatch() is kept,
+  // but the optimizer starts over, since the weights have moved without it.
+  // Returns false if the network can't be run.
+  bool PropagateErrorAsync(const double *inputs, const double *targets,
+                           size_t count);
   // Constructs a network with the exact same architechture as this one. It
   // allocates it on the heap, and the caller MUST take ownership of it.
   // TODO(danielp): Get rid of this method, it's unnecessary and dumb.
@@ -171,6 +308,17 @@ class MFNetwork : public Network {
     // Specifies which neurons in the next layer the output from each neuron in
     // this layer is routed to.
     std::map<int, std::vector<int> > RoutingMap;
+    // How accurately the compiled plan computes the impulse functions.
+    ImpulseAccuracy Accuracy = ImpulseAccuracy::EXACT;
+    // For each neuron, the neuron in the previous layer that each of its
+    // weights applies to, in order. BuildPlan() fills this in.
+    std::vector<std::vector<uint32_t> > WeightColumns;
+    // Where the optimizer's state for each neuron's weights starts in
+    // OptimizerState. The state for its bias comes right after that for its
+    // weights, and the last entry is the total for the layer, which is how far
+    // apart the optimizer's arrays of state are. BuildPlan() fills this in.
+    std::vector<size_t> StateOffsets;
+    std::vector<double> OptimizerState;
   };
 
   // Writes an array representation of all the routes in the network, which can
@@ -192,7 +340,88 @@ class MFNetwork : public Network {
   // ensure that everything has properly initialized weights, and probably the
   // only solution that doesn't devolve into a complete mess.
   bool DoUpdate(double *values);
+  // Does the work of DoUpdate() by walking the layer structures, which is the
+  // only way to leave the neurons holding their inputs and outputs for
+  // back propagation.
+  bool UpdateLayers(double *values);
+  // Must be called whenever anything about the network changes. Makes sure
+  // that the plan gets rebuilt and that nothing stale comes out of the
+  // cache.
+  inline void MarkChanged() {
+    plan_stale_ = true;
+    ++version_;
+  }
+  // Everything needed to work out the gradients for part of a batch. Each
+  // shard of a batch gets one.
+  struct GradientBuffer {
+    // The outputs of each layer of plan_ for every sample.
+    std::vector<std::vector<double> > Outputs;
+    // The errors for the layer being worked on, and for the one before it.
+    std::vector<double> Errors;
+    std::vector<double> NextErrors;
+    // The derivatives of the impulse functions for one sample.
+    std::vector<double> Derivatives;
+    // For each layer, the gradient for each weight summed over the samples,
+    // with a row of Inputs values for each neuron, and the same for each
+    // bias.
+    std::vector<std::vector<double> > Weights;
+    std::vector<std::vector<double> > Biases;
+  };
+
+  // Runs <count> samples forwards and backwards through plan_, and puts the
+  // sum of their gradients in <buffer>. This doesn't change anything, so
+  // several can run at once with different buffers.
+  void ComputeGradients(const double *inputs, const double *targets,
+                        size_t count, GradientBuffer *buffer) const;
+  // Runs one sample forwards through plan_, keeping the outputs of each layer
+  // in <buffer>, and puts the network errors for <targets> in its Errors.
+  void RunSample(const double *inputs, const double *targets,
+                 GradientBuffer *buffer) const;
+  // Adjusts the weights of the neurons in the layer at <layer_i> in plan_,
+  // and of the plan itself, for one sample. <inputs> holds what came into the
+  // layer, and <signals> holds the signal for each neuron.
+  void AdjustLayer(uint32_t layer_i, const double *inputs,
+                   const double *signals, bool skip_zero_inputs);
+  // Counts another step for optimizer_, first setting up the state for every
+  // layer if it needs to start over.
+  void StartOptimizerStep();
+  // Copies the weights and bias of neuron <neuron_i> of <source> into the
+  // compiled <layer>.
+  void CopyWeightsToPlan(const Layer_t *source, uint32_t neuron_i,
+                         ExecutionPlan::Layer *layer);
+  // Multiplies the errors in <buffer> for <count> samples by the
+  // derivatives of the impulse functions of <layer> at <outputs>.
+  void ToSignals(const ExecutionPlan::Layer *layer, const double *outputs,
+                 size_t count, GradientBuffer *buffer) const;
+  // Back propagates one sample through plan_, updating the weights of each
+  // layer as it goes, for PropagateErrorAsync(). Several threads can run this
+  // at once with different buffers.
+  void TrainSampleAsync(const double *inputs, const double *targets,
+                        GradientBuffer *buffer);
+  // Copies the weights and biases in plan_ back into the neurons. Their
+  // momentum gets reset.
+  void SyncNeuronsFromPlan();
+  // Adds the gradients in <from> to the ones in <to>.
+  void AddGradients(const GradientBuffer& from, GradientBuffer *to) const;
+  // Adjusts the weights of the neurons, and of plan_, by the average of
+  // <gradients> over <count> samples.
+  void ApplyGradients(const GradientBuffer& gradients, size_t count);
+  // Calls <work> with ranges that together cover <size> neurons, split across
+  // the thread pool if there is one and there are enough of them.
+  template <typename Work>
+  void SplitNeurons(uint32_t size, const Work& work) const {
+    if (pool_ && size >= min_parallel_neurons_) {
+      pool_->ParallelFor(0, size, work);
+    } else {
+      work(0, size);
+    }
+  }
+  // Rebuilds plan_ from the current state of the layer structures. Returns
+  // false if the layers are not consistent with their routing maps.
+  bool BuildPlan();
 
+  // The default smallest layer that SetThreadPool() splits up.
+  static constexpr uint32_t kMinParallelNeurons = 256;
   // The number of elements in the basic_info array when serializing.
   const size_t kBasicInfoSize = 7;
   // The number of elements in the weight_info array when serializing.
@@ -214,6 +443,11 @@ class MFNetwork : public Network {
   double learning_rate_;
   // The momentum for backpropagation.
   double momentum_;
+  // What updates the weights instead of learning_rate_ and momentum_, if
+  // anything, and the number of steps it has taken since its state was set
+  // up, which is zero if it needs to start over.
+  Optimizer *optimizer_ = nullptr;
+  uint64_t optimizer_step_ = 0;
   // Whether or not the network is initialized.
   bool initialized_ = false;
   // A vector of all our hidden layers. The MFNetwork destructor is also
@@ -221,6 +455,42 @@ class MFNetwork : public Network {
   std::vector<Layer_t *> layers_;
   // A map used to temporarily store input for each neuron in a layer.
   std::map<int, std::vector<double> > layer_input_buffer_;
+  // The values most recently passed to SetInputs() or SetSparseInputs().
+  std::vector<double> input_values_;
+  // Whether the inputs came from SetSparseInputs(), and if so, the ones that
+  // were nonzero.
+  bool sparse_inputs_ = false;
+  std::vector<uint32_t> sparse_input_indices_;
+  std::vector<double> sparse_input_values_;
+  // The compiled form of the network, used once Compile() has been called.
+  ExecutionPlan plan_;
+  // Scratch space for running plan_, so that it doesn't have to allocate
+  // anything.
+  InferenceWorkspace workspace_;
+  // Scratch space for each shard in PropagateErrorBatch(), the first of which
+  // PropagateError() uses too.
+  std::vector<GradientBuffer> gradient_buffers_;
+  // The inputs for each neuron of a layer with custom routing, in the order
+  // of its weights, starting at the offset for the neuron.
+  std::vector<double> gathered_inputs_;
+  std::vector<size_t> gathered_offsets_;
+  // The neurons needed for the outputs last passed to GetOutputsSubset(),
+  // and whether they're still good for plan_.
+  ExecutionPlan::OutputCone cone_;
+  bool cone_valid_ = false;
+  // Whether GetOutputs() should run plan_.
+  bool use_plan_ = false;
+  // Whether the layer structures have changed since plan_ was built.
+  bool plan_stale_ = true;
+  // Goes up every time the network changes, so that cached outputs can be
+  // told apart from ones computed since.
+  uint64_t version_ = 0;
+  // Where outputs are cached, if anywhere.
+  InferenceCache *cache_ = nullptr;
+  // Workers for splitting up wide layers, if any, and the smallest layer that
+  // gets split.
+  helpers::ThreadPool *pool_ = nullptr;
+  uint32_t min_parallel_neurons_ = kMinParallelNeurons;
 };
 
 } //network
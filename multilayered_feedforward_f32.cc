@@ -0,0 +1,305 @@
+#include <string.h>
+
+#include <algorithm>
+#include <functional>
+
+#include "logger.h"
+#include "multilayered_feedforward_f32.h"
+#include "serialization.h"
+
+namespace network {
+
+using helpers::ReadValues;
+using helpers::WriteValues;
+
+static_assert(sizeof(float) * 2 == sizeof(uint64_t),
+              "Chromosomes pack two floats into each element.");
+
+bool MFNetworkF32::CopyFrom(MFNetwork *source) {
+  const ExecutionPlan *plan = source->GetExecutionPlan();
+  if (!plan) {
+    return false;
+  }
+  plan_.CopyFrom(*plan);
+
+  // Neurons own their default impulse functions, so we can't keep pointers to
+  // those.
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    ExecutionPlanF32::Layer *layer = plan_.GetLayer(layer_i);
+    for (ImpulseFunction *& impulse : layer->Impulses) {
+      if (impulse->GetType() == ImpulseType::DUMB) {
+        impulse = &default_impulse_;
+      }
+    }
+  }
+
+  input_values_.assign(plan_.GetNumInputs(), 0);
+  workspace_.Reserve(plan_);
+  return true;
+}
+
+void MFNetworkF32::SetInputs(const float *values) {
+  memcpy(input_values_.data(), values, sizeof(values[0]) * GetNumInputs());
+}
+
+bool MFNetworkF32::GetOutputs(float *values) {
+  return plan_.Run(input_values_.data(), values, &workspace_);
+}
+
+bool MFNetworkF32::GetOutputsBatch(const float *inputs, size_t count,
+                                   float *outputs) {
+  return plan_.RunBatch(inputs, count, outputs, &workspace_);
+}
+
+bool MFNetworkF32::Evaluate(const float *inputs, float *outputs,
+                            InferenceWorkspaceF32 *workspace) const {
+  return plan_.Run(inputs, outputs, workspace);
+}
+
+bool MFNetworkF32::EvaluateBatch(const float *inputs, size_t count,
+                                 float *outputs,
+                                 InferenceWorkspaceF32 *workspace) const {
+  return plan_.RunBatch(inputs, count, outputs, workspace);
+}
+
+bool MFNetworkF32::SetLayerOutputFunctions(uint32_t layer_i,
+                                           ImpulseFunction *impulse) {
+  if (!layer_i || layer_i > plan_.GetNumLayers()) {
+    return false;
+  }
+  ExecutionPlanF32::Layer *layer = plan_.GetLayer(layer_i - 1);
+  layer->Impulses.assign(layer->Outputs, impulse);
+  plan_.FinishLayer(layer);
+  return true;
+}
+
+bool MFNetworkF32::SetLayerImpulseAccuracy(uint32_t layer_i,
+                                           ImpulseAccuracy accuracy) {
+  if (!layer_i || layer_i > plan_.GetNumLayers()) {
+    return false;
+  }
+  plan_.GetLayer(layer_i - 1)->Accuracy = accuracy;
+  return true;
+}
+
+template <typename Visit>
+void MFNetworkF32::ForEachWeight(const Visit& visit) {
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    ExecutionPlanF32::Layer *layer = plan_.GetLayer(layer_i);
+    // Connections is sorted, so we can walk through it alongside the rows.
+    auto connection = layer->Connections.begin();
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      float *weights = layer->Weights.data() + row * layer->Stride;
+      if (layer->Connections.empty()) {
+        for (uint32_t column = 0; column < layer->Inputs; ++column) {
+          visit(weights[column]);
+        }
+      } else {
+        const uint32_t row_end = (row + 1) * layer->Inputs;
+        for (; connection != layer->Connections.end() &&
+               *connection < row_end; ++connection) {
+          visit(weights[*connection - row * layer->Inputs]);
+        }
+      }
+      visit(layer->Biases[row]);
+    }
+  }
+}
+
+size_t MFNetworkF32::GetNumWeights() const {
+  size_t total = 0;
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    const ExecutionPlanF32::Layer *layer = plan_.GetLayer(layer_i);
+    if (layer->Connections.empty()) {
+      total += layer->Outputs * layer->Inputs;
+    } else {
+      total += layer->Connections.size();
+    }
+    // Biases.
+    total += layer->Outputs;
+  }
+  return total;
+}
+
+size_t MFNetworkF32::GetChromosomeSize() {
+  return (GetNumWeights() + 1) / 2;
+}
+
+bool MFNetworkF32::GetChromosome(uint64_t *chromosome) {
+  if (!plan_.GetNumLayers()) {
+    return false;
+  }
+
+  // Any odd float at the end gets paired with a zero.
+  chromosome[GetChromosomeSize() - 1] = 0;
+  char *out = reinterpret_cast<char *>(chromosome);
+  ForEachWeight([&out](const float& weight) {
+    WriteValues(&weight, 1, &out);
+  });
+  return true;
+}
+
+bool MFNetworkF32::SetChromosome(uint64_t *chromosome) {
+  if (!plan_.GetNumLayers()) {
+    return false;
+  }
+
+  const char *in = reinterpret_cast<const char *>(chromosome);
+  ForEachWeight([&in](float& weight) {
+    ReadValues(&in, 1, &weight);
+  });
+  // The sparse matrices hold copies of the weights.
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    plan_.FinishLayer(plan_.GetLayer(layer_i));
+  }
+  return true;
+}
+
+size_t MFNetworkF32::GetSerializedSize() {
+  if (!plan_.GetNumLayers()) {
+    return 0;
+  }
+
+  // Number of inputs and number of layers.
+  size_t size = 2 * sizeof(uint32_t);
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    // Layer size, number of connections, and the connections.
+    size += 2 * sizeof(uint32_t);
+    size += plan_.GetLayer(layer_i)->Connections.size() * sizeof(uint32_t);
+  }
+  // Number of outputs, and where each one comes from.
+  size += sizeof(uint32_t);
+  size += GetNumOutputs() * sizeof(uint32_t);
+  // Chromosome size and chromosome.
+  size += sizeof(uint32_t);
+  size += GetChromosomeSize() * sizeof(uint64_t);
+
+  return size;
+}
+
+size_t MFNetworkF32::Serialize(char *buffer) {
+  char *const original_buffer = buffer;
+  if (!plan_.GetNumLayers()) {
+    return 0;
+  }
+
+  const uint32_t layout_info[] = {GetNumInputs(), plan_.GetNumLayers()};
+  WriteValues(layout_info, 2, &buffer);
+  for (uint32_t layer_i = 0; layer_i < plan_.GetNumLayers(); ++layer_i) {
+    const ExecutionPlanF32::Layer *layer = plan_.GetLayer(layer_i);
+    const uint32_t layer_info[] = {
+        layer->Outputs, static_cast<uint32_t>(layer->Connections.size())};
+    WriteValues(layer_info, 2, &buffer);
+    WriteValues(layer->Connections.data(), layer->Connections.size(),
+                &buffer);
+  }
+
+  const uint32_t num_outputs = GetNumOutputs();
+  WriteValues(&num_outputs, 1, &buffer);
+  WriteValues(plan_.GetOutputIndices().data(), num_outputs, &buffer);
+
+  const uint32_t size = GetChromosomeSize();
+  WriteValues(&size, 1, &buffer);
+  std::vector<uint64_t> chromosome(size);
+  GetChromosome(chromosome.data());
+  WriteValues(chromosome.data(), size, &buffer);
+
+  return buffer - original_buffer;
+}
+
+size_t MFNetworkF32::Deserialize(const char *buffer) {
+  const char *const original_buffer = buffer;
+
+  uint32_t layout_info[2];
+  ReadValues(&buffer, 2, layout_info);
+  plan_.Reset(layout_info[0]);
+  for (uint32_t layer_i = 0; layer_i < layout_info[1]; ++layer_i) {
+    uint32_t layer_info[2];
+    ReadValues(&buffer, 2, layer_info);
+    ExecutionPlanF32::Layer *layer = plan_.AddLayer(layer_info[0]);
+    layer->Connections.resize(layer_info[1]);
+    ReadValues(&buffer, layer_info[1], layer->Connections.data());
+    // Everything that builds on Connections expects it to be in order, with
+    // no repeats.
+    const uint64_t possible =
+        static_cast<uint64_t>(layer->Outputs) * layer->Inputs;
+    bool valid = std::adjacent_find(layer->Connections.begin(),
+                                    layer->Connections.end(),
+                                    std::greater_equal<uint32_t>()) ==
+        layer->Connections.end();
+    for (uint32_t connection : layer->Connections) {
+      if (connection >= possible) {
+        valid = false;
+      }
+    }
+    if (!valid) {
+      LOG(Level::ERROR, "Invalid connections in layer %u.", layer_i);
+      plan_.Reset(0);
+      return 0;
+    }
+    layer->Impulses.assign(layer->Outputs, &default_impulse_);
+    plan_.FinishLayer(layer);
+  }
+
+  uint32_t num_outputs;
+  ReadValues(&buffer, 1, &num_outputs);
+  std::vector<uint32_t> output_indices(num_outputs);
+  ReadValues(&buffer, num_outputs, output_indices.data());
+  for (uint32_t index : output_indices) {
+    if (!plan_.GetNumLayers() ||
+        index >= plan_.GetLayer(plan_.GetNumLayers() - 1)->Outputs) {
+      LOG(Level::ERROR, "Invalid output index %u.", index);
+      plan_.Reset(0);
+      return 0;
+    }
+  }
+  plan_.SetOutputIndices(output_indices);
+
+  uint32_t size;
+  ReadValues(&buffer, 1, &size);
+  if (size != GetChromosomeSize()) {
+    LOG(Level::ERROR, "Chromosome has %u elements instead of %zu.", size,
+        GetChromosomeSize());
+    plan_.Reset(0);
+    return 0;
+  }
+  std::vector<uint64_t> chromosome(size);
+  ReadValues(&buffer, size, chromosome.data());
+  SetChromosome(chromosome.data());
+
+  input_values_.assign(GetNumInputs(), 0);
+  workspace_.Reserve(plan_);
+  return buffer - original_buffer;
+}
+
+bool MFNetworkF32::SaveToFile(const char *path) {
+  const size_t buffer_size = GetSerializedSize();
+  if (!buffer_size) {
+    LOG(Level::ERROR, "Failed to get size of serialized network.");
+    return false;
+  }
+  std::vector<char> buffer(buffer_size);
+  const size_t bytes_written = Serialize(buffer.data());
+  if (bytes_written != buffer_size) {
+    LOG(Level::ERROR, "Wrote %zu bytes to buffer instead of %zu.",
+        bytes_written, buffer_size);
+    return false;
+  }
+  return helpers::WriteFile(path, buffer);
+}
+
+bool MFNetworkF32::ReadFromFile(const char *path) {
+  std::vector<char> buffer;
+  if (!helpers::ReadFile(path, &buffer)) {
+    return false;
+  }
+  const size_t bytes_processed = Deserialize(buffer.data());
+  if (bytes_processed != buffer.size()) {
+    LOG(Level::ERROR, "Deserialized %zu bytes instead of %zu.",
+        bytes_processed, buffer.size());
+    return false;
+  }
+  return true;
+}
+
+} //network
@@ -0,0 +1,100 @@
+#ifndef NEURAL_NETWORK_MULTILAYERED_FEEDFORWARD_F32_H_
+#define NEURAL_NETWORK_MULTILAYERED_FEEDFORWARD_F32_H_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "execution_plan.h"
+#include "multilayered_feedforward.h"
+#include "network.h"
+#include "output_functions.h"
+#include "thread_pool.h"
+
+// A single-precision version of a multilayered feedforward network. It keeps
+// its weights and activations in float, which halves the memory traffic of
+// inference and fits twice as many values in each vector register, at the cost
+// of the last few digits of precision. Its layout comes from an MFNetwork, and
+// it can't be changed or trained with back propagation afterwards, but the
+// weights can be evolved with a genetic algorithm, and the whole network can be
+// saved and restored.
+
+namespace network {
+
+class MFNetworkF32 : public Network {
+ public:
+  MFNetworkF32() = default;
+  virtual ~MFNetworkF32() = default;
+  // Replaces this network with a copy of <source>, rounding all the weights to
+  // float. The impulse functions are shared with <source>, so the ones that
+  // were set on it must outlive this network. Returns false if <source> can't
+  // be run in its current state.
+  bool CopyFrom(MFNetwork *source);
+  // Returns the number of inputs the network takes.
+  inline uint32_t GetNumInputs() const {
+    return plan_.GetNumInputs();
+  }
+  // Returns the number of outputs the network produces.
+  inline uint32_t GetNumOutputs() const {
+    return plan_.GetNumOutputs();
+  }
+  // These work just like they do for MFNetwork.
+  void SetInputs(const float *values);
+  bool GetOutputs(float *values);
+  bool GetOutputsBatch(const float *inputs, size_t count, float *outputs);
+  // Like MFNetwork::Evaluate(), this can be called from any number of threads
+  // at once, as long as each has its own workspace.
+  bool Evaluate(const float *inputs, float *outputs,
+                InferenceWorkspaceF32 *workspace) const;
+  bool EvaluateBatch(const float *inputs, size_t count, float *outputs,
+                     InferenceWorkspaceF32 *workspace) const;
+  // Sets the same impulse function for all the neurons in a layer. Layers are
+  // indexed like they are in MFNetwork, so the first hidden layer is 1. Since
+  // impulse functions aren't serialized, this is how they get restored after
+  // Deserialize(). Returns false to indicate a bad layer index.
+  bool SetLayerOutputFunctions(uint32_t layer_i, ImpulseFunction *impulse);
+  // Works like MFNetwork::SetLayerImpulseAccuracy().
+  bool SetLayerImpulseAccuracy(uint32_t layer_i, ImpulseAccuracy accuracy);
+  // Works like MFNetwork::SetThreadPool().
+  inline void SetThreadPool(helpers::ThreadPool *pool,
+                            uint32_t min_parallel_neurons) {
+    plan_.SetThreadPool(pool, min_parallel_neurons);
+  }
+  // The chromosome holds the weights of each neuron followed by its bias, in
+  // the same order as MFNetwork, but packs two floats into each element, so
+  // it's half the size.
+  virtual size_t GetChromosomeSize();
+  virtual bool GetChromosome(uint64_t *chromosome);
+  virtual bool SetChromosome(uint64_t *chromosome);
+  // Serialization works like it does for MFNetwork, including the fact that
+  // impulse functions aren't saved. After deserializing, every neuron uses
+  // DumbOutputer until it is given something else.
+  size_t GetSerializedSize();
+  size_t Serialize(char *buffer);
+  size_t Deserialize(const char *buffer);
+  bool SaveToFile(const char *path);
+  bool ReadFromFile(const char *path);
+
+  DISSALOW_COPY_AND_ASSIGN(MFNetworkF32);
+
+ private:
+  // Calls <visit> with a reference to every weight and bias in the network,
+  // in chromosome order.
+  template <typename Visit>
+  void ForEachWeight(const Visit& visit);
+  // The total number of weights and biases in the network.
+  size_t GetNumWeights() const;
+
+  // Everything about the network lives in here.
+  ExecutionPlanF32 plan_;
+  // Scratch space for running plan_.
+  InferenceWorkspaceF32 workspace_;
+  // The values most recently passed to SetInputs().
+  std::vector<float> input_values_;
+  // Used by any neuron that doesn't have an impulse function from the user.
+  DumbOutputer default_impulse_;
+};
+
+} //network
+
+#endif
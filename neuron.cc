@@ -1,5 +1,6 @@
 #include <stdint.h>
 
+#include "kernels.h"
 #include "neuron.h"
 
 namespace network {
@@ -7,8 +8,7 @@ namespace network {
 Neuron::Neuron() :
     // The default impulse function is no impulse function, aka. DumbOutputer.
     impulse_(new DumbOutputer()),
-    bias_(0),
-    weight_i_(-1) {}
+    bias_(0) {}
 
 Neuron::~Neuron() {
   if (own_impulse_) {
@@ -24,66 +24,105 @@ void Neuron::SetWeights(const std::vector<double>& values) {
   for (uint32_t i = 0; i < weights_.size(); ++i) {
     delta_weights_.push_back(0);
   }
+}
 
-  Reset();
+void Neuron::UpdateWeights(const std::vector<double>& values) {
+  if (values.size() != weights_.size()) {
+    SetWeights(values);
+    return;
+  }
+  weights_ = values;
 }
 
-bool Neuron::AdjustWeights(double learning_rate, double momentum, double error) {
-  std::vector<double> weights_buffer;
+bool Neuron::AdjustWeights(double learning_rate, double momentum, double error,
+                           bool skip_zero_inputs/* = false*/) {
   if (weights_.size() == inputs_.size()) {
-    double signal = impulse_->Derivative(last_output_) * error;
-    // Adjust bias, which is basically a weight with the input permanently set
-    // at 1.
-    SetBias(bias_ + (learning_rate * signal));
+    ApplySignal(learning_rate, momentum,
+                impulse_->Derivative(last_output_) * error, inputs_.data(),
+                skip_zero_inputs);
+    return true;
+  }
+
+  return false;
+}
 
+void Neuron::ApplySignal(double learning_rate, double momentum, double signal,
+                         const double *inputs,
+                         bool skip_zero_inputs/* = false*/) {
+  // Adjust bias, which is basically a weight with the input permanently set
+  // at 1.
+  SetBias(bias_ + (learning_rate * signal));
+
+  if (skip_zero_inputs) {
     for (uint32_t i = 0; i < weights_.size(); ++i) {
-      double delta = learning_rate * signal * inputs_[i];
-      delta += delta_weights_[i] * momentum;
-      weights_[i] += delta;
-      weights_buffer.push_back(delta);
+      if (inputs[i] != 0) {
+        const double delta = learning_rate * signal * inputs[i] +
+                             momentum * delta_weights_[i];
+        weights_[i] += delta;
+        delta_weights_[i] = delta;
+      }
     }
-    delta_weights_.swap(weights_buffer);
-    return true;
+  } else {
+    kernels::MomentumUpdate(learning_rate * signal, momentum, inputs,
+                            delta_weights_.data(), weights_.data(),
+                            weights_.size());
   }
+}
 
-  return false;
+void Neuron::ApplyGradients(double learning_rate, double momentum,
+                            const double *gradients, double bias_gradient) {
+  SetBias(bias_ + (learning_rate * bias_gradient));
+  kernels::MomentumUpdate(learning_rate, momentum, gradients,
+                          delta_weights_.data(), weights_.data(),
+                          weights_.size());
+}
+
+void Neuron::Optimize(const Optimizer& optimizer, uint64_t step,
+                      double scale, const double *values,
+                      double bias_gradient, double *state, size_t stride,
+                      bool skip_zero_values/* = false*/) {
+  const size_t size = weights_.size();
+  if (skip_zero_values) {
+    // Update each run of nonzero values in one go.
+    size_t begin = 0;
+    while (begin < size) {
+      if (values[begin] == 0) {
+        ++begin;
+        continue;
+      }
+      size_t end = begin + 1;
+      while (end < size && values[end] != 0) {
+        ++end;
+      }
+      optimizer.Update(scale, values + begin, end - begin, step,
+                       state + begin, stride, weights_.data() + begin);
+      begin = end;
+    }
+  } else {
+    optimizer.Update(scale, values, size, step, state, stride,
+                     weights_.data());
+  }
+
+  // The bias is basically a weight with the input permanently set at 1.
+  const double one = 1;
+  optimizer.Update(bias_gradient, &one, 1, step, state + size, stride,
+                   &bias_);
 }
 
 bool Neuron::GetOutput(double *output) {
   if (inputs_.size() == weights_.size()) {
     // Calculate the initial sum.
     double sum = bias_;
-    for (uint32_t i = 0; i < inputs_.size(); ++i) {
-      sum += inputs_[i] * weights_[i];
-    }
+    sum += kernels::Dot(inputs_.data(), weights_.data(), inputs_.size());
 
     // Apply the impulse function.
     *output = impulse_->Function(sum);
     last_output_ = *output;
 
-    // Save the current weights.
-    old_weights_ = weights_;
-
     return true;
   } else {
     return false;
   }
 }
 
-bool Neuron::GetLastWeight(double *weight) {
-  if (weight_i_ >= 0) {
-    *weight = old_weights_[weight_i_--];
-    return true;
-  }
-  return false;
-}
-
-void Neuron::Reset() {
-  if (weights_.empty()) {
-    weight_i_ = -1;
-  } else {
-    weight_i_ = weights_.size() - 1;
-  }
-}
-
 } //network
@@ -3,8 +3,12 @@
 
 // A very simple neuron class.
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include <vector>
 
+#include "optimizers.h"
 #include "output_functions.h"
 
 namespace network {
@@ -38,12 +42,46 @@ public:
   }
   // Sets the neuron's input's weights to the contents of a vector.
   void SetWeights(const std::vector<double>& values);
-  // Changes the weights according to a back propagated signal.
-  bool AdjustWeights(double learning_rate, double momentum, double signal);
+  // Like SetWeights(), but for weights that were only moved along, such as by
+  // training outside of the neuron, so each one keeps its momentum. If the
+  // number of weights changes, the momentum starts over.
+  void UpdateWeights(const std::vector<double>& values);
+  // Changes the weights according to a back propagated signal. If
+  // <skip_zero_inputs> is true, weights on inputs that are zero don't change
+  // at all, instead of just following their momentum.
+  bool AdjustWeights(double learning_rate, double momentum, double signal,
+                     bool skip_zero_inputs = false);
+  // Does the work of AdjustWeights(), but with <signal> already multiplied by
+  // the derivative of the impulse function, and with the input for each
+  // weight given in <inputs>, rather than the ones from the last output. Each
+  // weight gets its momentum update in place.
+  void ApplySignal(double learning_rate, double momentum, double signal,
+                   const double *inputs, bool skip_zero_inputs = false);
+  // Changes each weight by <learning_rate> times its entry in <gradients>,
+  // plus momentum, and the bias by <learning_rate> times <bias_gradient>. This
+  // is how a whole mini-batch gets applied at once, after the gradients for
+  // every sample in it have been added up. <gradients> must have one entry for
+  // each weight.
+  void ApplyGradients(double learning_rate, double momentum,
+                      const double *gradients, double bias_gradient);
+  // Moves the weights and the bias the way <optimizer> says to. The gradient
+  // for each weight is <scale> times its entry in <values>, and the gradient
+  // for the bias is <bias_gradient>. <state> holds the optimizer's state for
+  // the weights, followed by the bias, laid out like Optimizer::Update()
+  // expects. If <skip_zero_values> is true, weights whose entry in <values>
+  // is zero are left alone entirely, state and all.
+  void Optimize(const Optimizer& optimizer, uint64_t step, double scale,
+                const double *values, double bias_gradient, double *state,
+                size_t stride, bool skip_zero_values = false);
   // Gets the neuron's current weights.
   inline void GetWeights(std::vector<double> *weights) {
     *weights = weights_;
   }
+  // Returns the neuron's current weights without copying them. The pointer
+  // is only good until the number of weights changes.
+  inline const double *GetWeightData() const {
+    return weights_.data();
+  }
   // Gets the neuron's current inputs.
   inline void GetInputs(std::vector<double> *inputs) {
     *inputs = inputs_;
@@ -55,11 +93,6 @@ public:
   inline int GetNumWeights() {
     return weights_.size();
   }
-  // The following two functions are used for the back propagation algorithm.
-  // Returns weights in from the list in reverse order.
-  bool GetLastWeight(double *weight);
-  // The next thing GetLastWeight will return is at the end of the weights list.
-  void Reset();
 
 private:
   // The neuron's impulse function.
@@ -68,16 +101,12 @@ private:
   bool own_impulse_ = true;
   // The bias weight.
   double bias_;
-  // The index of the weight that GetLastWeight will return next.
-  int weight_i_;
   // The last output of this neuron.
   double last_output_;
   // The value of the neuron's inputs.
   std::vector<double> inputs_;
   // The value of the weight on each input.
   std::vector<double> weights_;
-  // The value of the weights before they were changed by backpropagation.
-  std::vector<double> old_weights_;
   // The last change to each of our weights.
   std::vector<double> delta_weights_;
 };
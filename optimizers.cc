@@ -0,0 +1,79 @@
+#include <math.h>
+
+#include "kernels.h"
+#include "optimizers.h"
+
+namespace network {
+
+Momentum::Momentum(double learning_rate/* = 0.01*/,
+                   double momentum/* = 0.5*/) :
+    learning_rate_(learning_rate),
+    momentum_(momentum) {}
+
+void Momentum::Update(double scale, const double *values, size_t size,
+                      uint64_t /*step*/, double *state, size_t /*stride*/,
+                      double *weights) const {
+  kernels::MomentumUpdate(learning_rate_ * scale, momentum_, values, state,
+                          weights, size);
+}
+
+Nesterov::Nesterov(double learning_rate/* = 0.01*/,
+                   double momentum/* = 0.9*/) :
+    learning_rate_(learning_rate),
+    momentum_(momentum) {}
+
+void Nesterov::Update(double scale, const double *values, size_t size,
+                      uint64_t /*step*/, double *state, size_t /*stride*/,
+                      double *weights) const {
+  kernels::NesterovUpdate(learning_rate_ * scale, momentum_, values, state,
+                          weights, size);
+}
+
+Adagrad::Adagrad(double learning_rate/* = 0.01*/,
+                 double epsilon/* = 1e-8*/) :
+    learning_rate_(learning_rate),
+    epsilon_(epsilon) {}
+
+void Adagrad::Update(double scale, const double *values, size_t size,
+                     uint64_t /*step*/, double *state, size_t /*stride*/,
+                     double *weights) const {
+  // The squares just keep adding up.
+  kernels::RmsUpdate(scale, 1, 1, learning_rate_, epsilon_, values, state,
+                     weights, size);
+}
+
+RmsProp::RmsProp(double learning_rate/* = 0.001*/, double decay/* = 0.9*/,
+                 double epsilon/* = 1e-8*/) :
+    learning_rate_(learning_rate),
+    decay_(decay),
+    epsilon_(epsilon) {}
+
+void RmsProp::Update(double scale, const double *values, size_t size,
+                     uint64_t /*step*/, double *state, size_t /*stride*/,
+                     double *weights) const {
+  kernels::RmsUpdate(scale, decay_, 1 - decay_, learning_rate_, epsilon_,
+                     values, state, weights, size);
+}
+
+Adam::Adam(double learning_rate/* = 0.001*/, double beta1/* = 0.9*/,
+           double beta2/* = 0.999*/, double epsilon/* = 1e-8*/) :
+    learning_rate_(learning_rate),
+    beta1_(beta1),
+    beta2_(beta2),
+    epsilon_(epsilon) {}
+
+void Adam::Update(double scale, const double *values, size_t size,
+                  uint64_t step, double *state, size_t stride,
+                  double *weights) const {
+  // Dividing the averages by (1 - beta^step) makes up for them starting out
+  // at zero. Folding that into the learning rate and epsilon gives exactly
+  // the same steps, without any extra work for each weight.
+  const double mean_correction = 1 - pow(beta1_, step);
+  const double square_correction = sqrt(1 - pow(beta2_, step));
+  kernels::AdamUpdate(scale, beta1_, beta2_,
+                      learning_rate_ * square_correction / mean_correction,
+                      epsilon_ * square_correction, values, state,
+                      state + stride, weights, size);
+}
+
+} //network
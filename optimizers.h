@@ -0,0 +1,132 @@
+#ifndef NEURAL_NET_OPTIMIZERS_H_
+#define NEURAL_NET_OPTIMIZERS_H_
+
+// Update rules for back propagation, which decide how far each weight moves
+// given its gradient. By default, MFNetwork uses plain momentum with the
+// learning rate and momentum set on the network, but any of these can be
+// plugged in instead. Each one keeps a few values of state for every weight,
+// which the network keeps in one contiguous buffer for each layer, and does
+// all its work for a whole neuron in one fused, vectorized kernel.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "macros.h"
+
+namespace network {
+
+// A basic superclass for optimizers.
+class Optimizer {
+ public:
+  Optimizer() = default;
+  virtual ~Optimizer() = default;
+  // Returns how many values of state the optimizer keeps for each weight.
+  virtual uint32_t GetStateSize() const = 0;
+  // Moves each of <size> weights by one step. The gradient for weights[i] is
+  // scale * values[i], and points the way that the weight should go to make
+  // the error smaller. <state> is where the state for weights[0] starts, and
+  // each of the GetStateSize() arrays of state is <stride> after the one
+  // before it. State starts out as zero. <step> counts the steps taken so
+  // far, including this one, so it starts at 1.
+  virtual void Update(double scale, const double *values, size_t size,
+                      uint64_t step, double *state, size_t stride,
+                      double *weights) const = 0;
+
+  DISSALOW_COPY_AND_ASSIGN(Optimizer);
+};
+
+// Plain momentum, just like the default, except that the bias gets momentum
+// too.
+class Momentum : public Optimizer {
+ public:
+  explicit Momentum(double learning_rate = 0.01, double momentum = 0.5);
+  virtual uint32_t GetStateSize() const {
+    return 1;
+  }
+  virtual void Update(double scale, const double *values, size_t size,
+                      uint64_t step, double *state, size_t stride,
+                      double *weights) const;
+
+ private:
+  double learning_rate_;
+  double momentum_;
+};
+
+// Nesterov momentum, which works out the step from where the momentum is
+// about to take the weights, rather than from where they are.
+class Nesterov : public Optimizer {
+ public:
+  explicit Nesterov(double learning_rate = 0.01, double momentum = 0.9);
+  virtual uint32_t GetStateSize() const {
+    return 1;
+  }
+  virtual void Update(double scale, const double *values, size_t size,
+                      uint64_t step, double *state, size_t stride,
+                      double *weights) const;
+
+ private:
+  double learning_rate_;
+  double momentum_;
+};
+
+// Adagrad, which scales the learning rate for each weight down by the size of
+// all the gradients it has seen so far, so that weights with rare gradients
+// still learn quickly.
+class Adagrad : public Optimizer {
+ public:
+  explicit Adagrad(double learning_rate = 0.01, double epsilon = 1e-8);
+  virtual uint32_t GetStateSize() const {
+    return 1;
+  }
+  virtual void Update(double scale, const double *values, size_t size,
+                      uint64_t step, double *state, size_t stride,
+                      double *weights) const;
+
+ private:
+  double learning_rate_;
+  double epsilon_;
+};
+
+// RMSProp, which is like Adagrad, but only remembers recent gradients, with
+// the old ones fading by <decay> every step.
+class RmsProp : public Optimizer {
+ public:
+  explicit RmsProp(double learning_rate = 0.001, double decay = 0.9,
+                   double epsilon = 1e-8);
+  virtual uint32_t GetStateSize() const {
+    return 1;
+  }
+  virtual void Update(double scale, const double *values, size_t size,
+                      uint64_t step, double *state, size_t stride,
+                      double *weights) const;
+
+ private:
+  double learning_rate_;
+  double decay_;
+  double epsilon_;
+};
+
+// Adam, which keeps decaying averages of both the gradients and their
+// squares, and moves each weight by the one over the square root of the
+// other. The averages start out at zero, which is corrected for.
+class Adam : public Optimizer {
+ public:
+  explicit Adam(double learning_rate = 0.001, double beta1 = 0.9,
+                double beta2 = 0.999, double epsilon = 1e-8);
+  virtual uint32_t GetStateSize() const {
+    return 2;
+  }
+  virtual void Update(double scale, const double *values, size_t size,
+                      uint64_t step, double *state, size_t stride,
+                      double *weights) const;
+
+ private:
+  double learning_rate_;
+  double beta1_;
+  double beta2_;
+  double epsilon_;
+};
+
+} //network
+
+#endif
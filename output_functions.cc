@@ -1,7 +1,141 @@
+#include <algorithm>
+#include <cmath>
+#include <typeinfo>
+
 #include "logger.h"
 #include "output_functions.h"
 
 namespace network {
+namespace {
+
+// Beyond this, the rational approximation of tanh is within rounding error
+// of +/-1.
+constexpr double kRationalClamp = 7.90531110763549805;
+
+// A rational approximation of tanh. (These are the coefficients that Eigen
+// uses for its fast float tanh.)
+template <typename Scalar>
+inline Scalar RationalTanh(Scalar x) {
+  if (x != x) {
+    // Clamping would turn NaN into -1.
+    return x;
+  }
+  const Scalar clamp = kRationalClamp;
+  x = std::min(clamp, std::max(-clamp, x));
+  const Scalar x2 = x * x;
+  Scalar p = -2.76076847742355e-16;
+  p = p * x2 + Scalar(2.00018790482477e-13);
+  p = p * x2 - Scalar(8.60467152213735e-11);
+  p = p * x2 + Scalar(5.12229709037114e-08);
+  p = p * x2 + Scalar(1.48572235717979e-05);
+  p = p * x2 + Scalar(6.37261928875436e-04);
+  p = p * x2 + Scalar(4.89352455891786e-03);
+  Scalar q = 1.19825839466702e-06;
+  q = q * x2 + Scalar(1.18534705686654e-04);
+  q = q * x2 + Scalar(2.26843463243900e-03);
+  q = q * x2 + Scalar(4.89352518554385e-03);
+  return x * p / q;
+}
+
+// The number of intervals in the tanh table, and the largest input in it.
+constexpr int kTableSize = 4096;
+constexpr double kTableRange = 8;
+
+// Holds tanh at evenly spaced points over [-kTableRange, kTableRange].
+struct TanhTable {
+  TanhTable() {
+    for (int i = 0; i <= kTableSize; ++i) {
+      Values[i] = tanh(-kTableRange + 2 * kTableRange * i / kTableSize);
+    }
+    // Makes interpolating at the very top of the range safe.
+    Values[kTableSize + 1] = Values[kTableSize];
+  }
+
+  double Values[kTableSize + 2];
+};
+
+inline double TableTanh(const TanhTable& table, double x) {
+  if (x != x) {
+    // Clamping would turn NaN into the bottom of the table.
+    return x;
+  }
+  double position = (x + kTableRange) * (kTableSize / (2 * kTableRange));
+  position = std::min<double>(kTableSize, std::max(0.0, position));
+  const int i = static_cast<int>(position);
+  const double fraction = position - i;
+  return table.Values[i] + (table.Values[i + 1] - table.Values[i]) * fraction;
+}
+
+// Builds the table the first time it's needed.
+const TanhTable& GetTanhTable() {
+  static const TanhTable table;
+  return table;
+}
+
+// ApplyImpulse() for either precision.
+template <typename Scalar>
+void ApplyImpulseTo(ImpulseType type, double parameter, Scalar *values,
+                    size_t size, ImpulseAccuracy accuracy) {
+  // Sigmoid(x) is the same as 0.5 + 0.5 * tanh(x / 2), so the approximations
+  // only have to handle tanh.
+  if (accuracy == ImpulseAccuracy::RATIONAL) {
+    if (type == ImpulseType::TANH) {
+      for (size_t i = 0; i < size; ++i) {
+        values[i] = RationalTanh(values[i]);
+      }
+      return;
+    } else if (type == ImpulseType::SIGMOID) {
+      for (size_t i = 0; i < size; ++i) {
+        const Scalar half = 0.5;
+        values[i] = half + half * RationalTanh(half * values[i]);
+      }
+      return;
+    }
+  } else if (accuracy == ImpulseAccuracy::TABLE) {
+    const TanhTable& table = GetTanhTable();
+    if (type == ImpulseType::TANH) {
+      for (size_t i = 0; i < size; ++i) {
+        values[i] = TableTanh(table, values[i]);
+      }
+      return;
+    } else if (type == ImpulseType::SIGMOID) {
+      for (size_t i = 0; i < size; ++i) {
+        values[i] = 0.5 + 0.5 * TableTanh(table, 0.5 * values[i]);
+      }
+      return;
+    }
+  }
+
+  switch (type) {
+    case ImpulseType::DUMB:
+      break;
+    case ImpulseType::THRESHOLD:
+      for (size_t i = 0; i < size; ++i) {
+        values[i] = values[i] >= parameter ? 1 : 0;
+      }
+      break;
+    case ImpulseType::SIGMOID:
+      for (size_t i = 0; i < size; ++i) {
+        values[i] = 1 / (1 + std::exp(-values[i]));
+      }
+      break;
+    case ImpulseType::TANH:
+      for (size_t i = 0; i < size; ++i) {
+        values[i] = std::tanh(values[i]);
+      }
+      break;
+    case ImpulseType::LINEAR:
+      for (size_t i = 0; i < size; ++i) {
+        values[i] *= static_cast<Scalar>(parameter);
+      }
+      break;
+    case ImpulseType::CUSTOM:
+      CHECK(false, "Custom impulse functions must be applied individually.");
+      break;
+  }
+}
+
+} // namespace
 
 double ImpulseFunction::Derivative(double output) {
   CHECK(false, 
@@ -9,6 +143,24 @@ double ImpulseFunction::Derivative(double output) {
   return 0;
 }
 
+ImpulseType ImpulseFunction::GetType() const {
+  // This looks at the exact class rather than asking it, since subclasses
+  // would otherwise inherit the type of whatever they were derived from.
+  const std::type_info& type = typeid(*this);
+  if (type == typeid(DumbOutputer)) {
+    return ImpulseType::DUMB;
+  } else if (type == typeid(Threshold)) {
+    return ImpulseType::THRESHOLD;
+  } else if (type == typeid(Sigmoid)) {
+    return ImpulseType::SIGMOID;
+  } else if (type == typeid(TanH)) {
+    return ImpulseType::TANH;
+  } else if (type == typeid(Linear)) {
+    return ImpulseType::LINEAR;
+  }
+  return ImpulseType::CUSTOM;
+}
+
 double Threshold::Function(double input) {
   if (input >= threshold_) {
     return 1;
@@ -17,4 +169,69 @@ double Threshold::Function(double input) {
   }
 }
 
+// These loops do the same thing as the Function() and Derivative() methods
+// above, but without any virtual calls, so the compiler can inline and
+// vectorize them.
+
+ImpulseType GetCommonImpulseType(const std::vector<ImpulseFunction *>& impulses,
+                                 double *parameter) {
+  *parameter = 0;
+  if (impulses.empty() || !impulses[0]) {
+    return ImpulseType::CUSTOM;
+  }
+  const ImpulseType type = impulses[0]->GetType();
+  const double common_parameter = impulses[0]->GetParameter();
+  for (ImpulseFunction *impulse : impulses) {
+    if (!impulse || impulse->GetType() != type ||
+        impulse->GetParameter() != common_parameter) {
+      return ImpulseType::CUSTOM;
+    }
+  }
+  *parameter = common_parameter;
+  return type;
+}
+
+void ApplyImpulse(ImpulseType type, double parameter, double *values,
+                  size_t size,
+                  ImpulseAccuracy accuracy/* = ImpulseAccuracy::EXACT*/) {
+  ApplyImpulseTo(type, parameter, values, size, accuracy);
+}
+
+void ApplyImpulse(ImpulseType type, double parameter, float *values,
+                  size_t size,
+                  ImpulseAccuracy accuracy/* = ImpulseAccuracy::EXACT*/) {
+  ApplyImpulseTo(type, parameter, values, size, accuracy);
+}
+
+void ApplyDerivative(ImpulseType type, double parameter,
+                     const double *outputs, double *derivatives, size_t size) {
+  switch (type) {
+    case ImpulseType::DUMB:
+      for (size_t i = 0; i < size; ++i) {
+        derivatives[i] = 1;
+      }
+      break;
+    case ImpulseType::SIGMOID:
+      for (size_t i = 0; i < size; ++i) {
+        derivatives[i] = outputs[i] * (1 - outputs[i]);
+      }
+      break;
+    case ImpulseType::TANH:
+      for (size_t i = 0; i < size; ++i) {
+        derivatives[i] = 1 - outputs[i] * outputs[i];
+      }
+      break;
+    case ImpulseType::LINEAR:
+      for (size_t i = 0; i < size; ++i) {
+        derivatives[i] = parameter;
+      }
+      break;
+    case ImpulseType::THRESHOLD:
+    case ImpulseType::CUSTOM:
+      CHECK(false,
+          "Attempt to take derivative of non-differentiable function.");
+      break;
+  }
+}
+
 } //network
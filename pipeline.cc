@@ -0,0 +1,238 @@
+#include <string.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "pipeline.h"
+
+namespace network {
+namespace internal {
+
+constexpr size_t SampleRing::kCacheLineSize;
+constexpr int SampleRing::kSpinCount;
+
+SampleRing::SampleRing(size_t capacity, size_t width) :
+    head_(0),
+    tail_(0),
+    capacity_(capacity ? capacity : 1),
+    // Even samples with nothing in them need a slot to point to.
+    width_(width ? width : 1),
+    slots_(capacity_ * width_),
+    sleepers_(0) {}
+
+double *SampleRing::BeginPush() {
+  const size_t tail = tail_.load(std::memory_order_relaxed);
+  // Acquire, so that the consumer is done reading the slot before we write to
+  // it.
+  if (tail - head_.load(std::memory_order_acquire) == capacity_) {
+    return nullptr;
+  }
+  return slots_.data() + (tail % capacity_) * width_;
+}
+
+double *SampleRing::WaitPush() {
+  return Wait([this]() { return BeginPush(); });
+}
+
+void SampleRing::FinishPush() {
+  // Release, so that the sample is written before the consumer can see it.
+  tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+  Notify();
+}
+
+const double *SampleRing::BeginPop() {
+  const size_t head = head_.load(std::memory_order_relaxed);
+  if (head == tail_.load(std::memory_order_acquire)) {
+    return nullptr;
+  }
+  return slots_.data() + (head % capacity_) * width_;
+}
+
+const double *SampleRing::WaitPop() {
+  return Wait([this]() { return BeginPop(); });
+}
+
+void SampleRing::FinishPop() {
+  head_.store(head_.load(std::memory_order_relaxed) + 1,
+              std::memory_order_release);
+  Notify();
+}
+
+void SampleRing::Close() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+  }
+  condition_.notify_all();
+}
+
+template <typename Attempt>
+auto SampleRing::Wait(const Attempt& attempt) -> decltype(attempt()) {
+  for (int i = 0; i < kSpinCount; ++i) {
+    auto result = attempt();
+    if (result) {
+      return result;
+    }
+    std::this_thread::yield();
+  }
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  sleepers_.fetch_add(1, std::memory_order_relaxed);
+  // This pairs with the fence in Notify(). Either the other side sees that
+  // we're going to sleep, or we see what it just did.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  decltype(attempt()) result;
+  while (!(result = attempt()) && !closed_) {
+    condition_.wait(lock);
+  }
+  sleepers_.fetch_sub(1, std::memory_order_relaxed);
+  return result;
+}
+
+void SampleRing::Notify() {
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (sleepers_.load(std::memory_order_relaxed)) {
+    // Taking the lock makes sure the sleeper is either still checking the
+    // ring or already waiting, so the signal can't get lost.
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    condition_.notify_all();
+  }
+}
+
+} // internal
+
+constexpr size_t InferencePipeline::kDefaultRingCapacity;
+
+InferencePipeline::InferencePipeline(const ExecutionPlan *plan,
+                                     uint32_t num_stages,
+                                     size_t ring_capacity/* =
+                                         kDefaultRingCapacity*/) :
+    plan_(plan) {
+  const uint32_t num_layers = plan_->GetNumLayers();
+  CHECK(num_layers, "Cannot build a pipeline from an empty plan.");
+  num_stages = std::min(std::max(num_stages, 1U), num_layers);
+
+  // Balance the stages by the number of weights in them, which is what the
+  // time spent on each layer mostly comes down to.
+  std::vector<uint64_t> costs(num_layers);
+  uint64_t total = 0;
+  for (uint32_t layer_i = 0; layer_i < num_layers; ++layer_i) {
+    const ExecutionPlan::Layer *layer = plan_->GetLayer(layer_i);
+    costs[layer_i] = layer->Connections.empty() ?
+        static_cast<uint64_t>(layer->Inputs) * layer->Outputs :
+        layer->Connections.size();
+    total += costs[layer_i];
+  }
+  uint32_t end = 0;
+  uint64_t done = 0;
+  for (uint32_t stage_i = 0; stage_i + 1 < num_stages; ++stage_i) {
+    const uint64_t target = total * (stage_i + 1) / num_stages;
+    // Every stage gets at least one layer, and leaves at least one for each
+    // of the stages after it. Beyond that, a layer goes in this stage if most
+    // of it would come before the target.
+    done += costs[end++];
+    const uint32_t last_end = num_layers - (num_stages - stage_i - 1);
+    while (end < last_end && done + costs[end] / 2 <= target) {
+      done += costs[end++];
+    }
+    stage_ends_.push_back(end);
+  }
+  stage_ends_.push_back(num_layers);
+
+  rings_.push_back(new internal::SampleRing(ring_capacity,
+                                            plan_->GetNumInputs()));
+  for (uint32_t stage_i = 0; stage_i + 1 < num_stages; ++stage_i) {
+    const uint32_t width = plan_->GetLayer(stage_ends_[stage_i] - 1)->Outputs;
+    rings_.push_back(new internal::SampleRing(ring_capacity, width));
+  }
+  rings_.push_back(new internal::SampleRing(ring_capacity,
+                                            plan_->GetNumOutputs()));
+
+  for (uint32_t stage_i = 0; stage_i < num_stages; ++stage_i) {
+    threads_.emplace_back(&InferencePipeline::StageLoop, this, stage_i);
+  }
+}
+
+InferencePipeline::~InferencePipeline() {
+  // Closing the rings wakes up the stages and tells them to exit.
+  for (internal::SampleRing *ring : rings_) {
+    ring->Close();
+  }
+  for (std::thread& thread : threads_) {
+    thread.join();
+  }
+  for (internal::SampleRing *ring : rings_) {
+    delete ring;
+  }
+}
+
+void InferencePipeline::Push(const double *inputs) {
+  internal::SampleRing *ring = rings_.front();
+  double *slot = ring->WaitPush();
+  memcpy(slot, inputs, sizeof(inputs[0]) * plan_->GetNumInputs());
+  ring->FinishPush();
+}
+
+void InferencePipeline::Pop(double *outputs) {
+  internal::SampleRing *ring = rings_.back();
+  const double *slot = ring->WaitPop();
+  memcpy(outputs, slot, sizeof(outputs[0]) * plan_->GetNumOutputs());
+  ring->FinishPop();
+}
+
+bool InferencePipeline::TryPop(double *outputs) {
+  internal::SampleRing *ring = rings_.back();
+  const double *slot = ring->BeginPop();
+  if (!slot) {
+    return false;
+  }
+  memcpy(outputs, slot, sizeof(outputs[0]) * plan_->GetNumOutputs());
+  ring->FinishPop();
+  return true;
+}
+
+void InferencePipeline::StageLoop(uint32_t stage_i) {
+  const uint32_t begin = stage_i ? stage_ends_[stage_i - 1] : 0;
+  const uint32_t end = stage_ends_[stage_i];
+  const bool last_stage = stage_i + 1 == stage_ends_.size();
+  internal::SampleRing *in_ring = rings_[stage_i];
+  internal::SampleRing *out_ring = rings_[stage_i + 1];
+  const std::vector<uint32_t>& output_indices = plan_->GetOutputIndices();
+
+  std::vector<double> front(plan_->GetMaxWidth());
+  std::vector<double> back(plan_->GetMaxWidth());
+  while (true) {
+    // The rings only return nullptr once the pipeline is being destroyed.
+    const double *in = in_ring->WaitPop();
+    if (!in) {
+      return;
+    }
+    double *slot = out_ring->WaitPush();
+    if (!slot) {
+      return;
+    }
+
+    for (uint32_t layer_i = begin; layer_i < end; ++layer_i) {
+      double *out;
+      if (layer_i + 1 == end && !last_stage) {
+        // The next stage reads straight out of the ring.
+        out = slot;
+      } else {
+        out = (in == front.data()) ? back.data() : front.data();
+      }
+      plan_->RunLayer(layer_i, in, out);
+      in = out;
+    }
+    if (last_stage) {
+      for (uint32_t i = 0; i < output_indices.size(); ++i) {
+        slot[i] = in[output_indices[i]];
+      }
+    }
+
+    in_ring->FinishPop();
+    out_ring->FinishPush();
+  }
+}
+
+} //network
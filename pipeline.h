@@ -0,0 +1,143 @@
+#ifndef NEURAL_NET_PIPELINE_H_
+#define NEURAL_NET_PIPELINE_H_
+
+// Streams samples through a deep network with its layers spread across
+// several threads. The layers are split into stages with about the same
+// number of weights each, every stage runs on its own thread, and samples
+// are passed from one stage to the next through lock-free rings. While one
+// stage works on a sample, the stage before it can already be working on the
+// next one, so with enough cores, throughput goes up with the number of
+// stages. Samples come out in the order they went in. A thread that has
+// nothing to do spins for a little while, and then goes to sleep until there
+// is, so an idle pipeline doesn't use up any cores.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "execution_plan.h"
+#include "macros.h"
+
+namespace network {
+namespace internal {
+
+// A fixed-size queue of samples, each an array of <width> doubles, for
+// exactly one producer thread and one consumer thread. Passing samples
+// through never takes a lock. Only a side that has been waiting a while goes
+// to sleep, and then the other side takes a lock to wake it up. The samples
+// live in the ring itself, so the producer writes straight into a free slot,
+// and the consumer reads straight out of a full one.
+class SampleRing {
+ public:
+  SampleRing(size_t capacity, size_t width);
+  // Returns a slot to write the next sample to, or nullptr if the ring is
+  // full. The sample isn't visible to the consumer until FinishPush().
+  double *BeginPush();
+  // Like BeginPush(), but waits for a free slot. Returns nullptr only if the
+  // ring gets closed.
+  double *WaitPush();
+  void FinishPush();
+  // Returns the oldest sample, or nullptr if the ring is empty. The slot
+  // isn't reused until FinishPop().
+  const double *BeginPop();
+  // Like BeginPop(), but waits for a sample. Returns nullptr only if the
+  // ring gets closed.
+  const double *WaitPop();
+  void FinishPop();
+  // Wakes up anything waiting on the ring, and makes all waits from now on
+  // return nullptr.
+  void Close();
+
+  DISSALOW_COPY_AND_ASSIGN(SampleRing);
+
+ private:
+  // The size of a cache line, as far as padding goes.
+  static constexpr size_t kCacheLineSize = 64;
+  // How many times a wait checks the ring before it goes to sleep.
+  static constexpr int kSpinCount = 256;
+
+  // Calls <attempt> until it returns something other than nullptr, going to
+  // sleep if that takes too long. Returns nullptr if the ring gets closed.
+  template <typename Attempt>
+  auto Wait(const Attempt& attempt) -> decltype(attempt());
+  // Wakes up the other side if it's asleep.
+  void Notify();
+
+  // Indices keep counting up, and wrap around the slots. The consumer owns
+  // head_, and the producer owns tail_. They're padded out onto separate cache
+  // lines so that the two threads don't fight over them. (C++11 can't
+  // allocate anything aligned to more than the usual, so padding is the best
+  // we can do.)
+  std::atomic<size_t> head_;
+  char head_padding_[kCacheLineSize];
+  std::atomic<size_t> tail_;
+  char tail_padding_[kCacheLineSize];
+  const size_t capacity_;
+  const size_t width_;
+  std::vector<double> slots_;
+  // How many threads are asleep, or about to be. Threads only go to sleep or
+  // get woken up with mutex_ held.
+  std::atomic<int> sleepers_;
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  // Set by Close(). Protected by mutex_.
+  bool closed_ = false;
+};
+
+} // internal
+
+class InferencePipeline {
+ public:
+  // The default number of samples that can wait between two stages.
+  static constexpr size_t kDefaultRingCapacity = 64;
+
+  // Splits the layers of <plan> into <num_stages> stages, (or one per layer,
+  // if there are fewer layers than that,) and starts a thread for each. The
+  // plan must not change or be destroyed while the pipeline is around.
+  InferencePipeline(const ExecutionPlan *plan, uint32_t num_stages,
+                    size_t ring_capacity = kDefaultRingCapacity);
+  // Stops the stages. Samples that haven't been popped yet are lost.
+  ~InferencePipeline();
+  // Feeds one set of inputs into the pipeline, waiting for room if it's
+  // full. Only one thread should push at a time.
+  void Push(const double *inputs);
+  // Writes the outputs for the oldest sample that hasn't been popped yet to
+  // <outputs>, waiting for it to come out if necessary. Only one thread
+  // should pop at a time, though it doesn't have to be the one pushing. A
+  // single thread that does both has to pop before it pushes more samples
+  // than the pipeline can hold.
+  void Pop(double *outputs);
+  // Like Pop(), but returns false right away if no outputs are ready.
+  bool TryPop(double *outputs);
+  // Returns the number of stages.
+  inline uint32_t GetNumStages() const {
+    return stage_ends_.size();
+  }
+  // Returns the index of the first layer after stage <stage_i>.
+  inline uint32_t GetStageEnd(uint32_t stage_i) const {
+    return stage_ends_[stage_i];
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(InferencePipeline);
+
+ private:
+  // What the thread for <stage_i> runs.
+  void StageLoop(uint32_t stage_i);
+
+  const ExecutionPlan *plan_;
+  // The layer that each stage ends before. Stage <i> starts where stage
+  // <i - 1> ends.
+  std::vector<uint32_t> stage_ends_;
+  // Ring <i> feeds stage <i>, and the last one holds the network outputs.
+  std::vector<internal::SampleRing *> rings_;
+  std::vector<std::thread> threads_;
+};
+
+} //network
+
+#endif
@@ -0,0 +1,357 @@
+#include <math.h>
+
+#include <algorithm>
+
+#include "execution_plan.h"
+#include "kernels.h"
+#include "logger.h"
+#include "quantized_network.h"
+#include "serialization.h"
+
+namespace network {
+
+using helpers::ReadValues;
+using helpers::WriteValues;
+
+namespace {
+
+// The largest magnitude of a quantized value. We leave out -128 so that the
+// range is symmetric.
+constexpr float kMaxQuantized = 127;
+
+// Returns the scale that maps values up to <max_magnitude> onto the full
+// quantized range.
+inline float GetScale(double max_magnitude) {
+  return max_magnitude > 0 ? max_magnitude / kMaxQuantized : 1;
+}
+
+inline int8_t QuantizeValue(float value) {
+  return std::min(kMaxQuantized, std::max(-kMaxQuantized, rintf(value)));
+}
+
+} // namespace
+
+void QuantizedWorkspace::Reserve(const QuantizedNetwork& network) {
+  const size_t size = network.GetMaxWidth();
+  if (front_buffer_.size() < size) {
+    front_buffer_.resize(size);
+    back_buffer_.resize(size);
+    quantized_buffer_.resize(size);
+  }
+}
+
+QuantizedNetwork::~QuantizedNetwork() {
+  for (Layer *layer : layers_) {
+    delete layer;
+  }
+}
+
+void QuantizedNetwork::Reset(uint32_t inputs) {
+  for (Layer *layer : layers_) {
+    delete layer;
+  }
+  layers_.clear();
+  output_indices_.clear();
+  num_inputs_ = inputs;
+  max_width_ = inputs;
+}
+
+QuantizedNetwork::Layer *QuantizedNetwork::AddLayer(uint32_t outputs) {
+  Layer *layer = new Layer();
+  layer->Inputs = layers_.empty() ? num_inputs_ : layers_.back()->Outputs;
+  layer->Outputs = outputs;
+  layer->Stride = AlignedStride<int8_t>(layer->Inputs);
+  layer->Weights.Resize(layer->Stride * outputs);
+  layer->Scales.assign(outputs, 1);
+  layer->Biases.assign(outputs, 0);
+  layer->InputScale = 1;
+  layer->Impulses.assign(outputs, &default_impulse_);
+  layers_.push_back(layer);
+
+  max_width_ = std::max(max_width_, outputs);
+  return layer;
+}
+
+bool QuantizedNetwork::Quantize(MFNetwork *source, const double *calibration,
+    size_t count,
+    QuantizationGranularity granularity/* = PER_NEURON*/,
+    QuantizationReport *report/* = nullptr*/) {
+  const ExecutionPlan *plan = source->GetExecutionPlan();
+  if (!plan || !count) {
+    return false;
+  }
+
+  // Find the largest value that goes into each layer.
+  const uint32_t num_inputs = plan->GetNumInputs();
+  const uint32_t num_layers = plan->GetNumLayers();
+  std::vector<double> max_inputs(num_layers, 0);
+  std::vector<double> front(plan->GetMaxWidth());
+  std::vector<double> back(plan->GetMaxWidth());
+  for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+    const double *in = calibration + sample_i * num_inputs;
+    for (uint32_t layer_i = 0; layer_i < num_layers; ++layer_i) {
+      const uint32_t width = plan->GetLayer(layer_i)->Inputs;
+      for (uint32_t i = 0; i < width; ++i) {
+        max_inputs[layer_i] = std::max(max_inputs[layer_i], fabs(in[i]));
+      }
+      double *out = (in == front.data()) ? back.data() : front.data();
+      plan->RunLayer(layer_i, in, out);
+      in = out;
+    }
+  }
+
+  Reset(num_inputs);
+  for (uint32_t layer_i = 0; layer_i < num_layers; ++layer_i) {
+    const ExecutionPlan::Layer *from = plan->GetLayer(layer_i);
+    Layer *layer = AddLayer(from->Outputs);
+    layer->InputScale = GetScale(max_inputs[layer_i]);
+
+    double layer_max = 0;
+    std::vector<double> row_max(from->Outputs, 0);
+    for (uint32_t row = 0; row < from->Outputs; ++row) {
+      const double *weights = from->Weights.data() + row * from->Stride;
+      for (uint32_t column = 0; column < from->Inputs; ++column) {
+        row_max[row] = std::max(row_max[row], fabs(weights[column]));
+      }
+      layer_max = std::max(layer_max, row_max[row]);
+    }
+
+    for (uint32_t row = 0; row < from->Outputs; ++row) {
+      const float weight_scale = GetScale(
+          granularity == QuantizationGranularity::PER_NEURON ? row_max[row]
+                                                             : layer_max);
+      const double *weights = from->Weights.data() + row * from->Stride;
+      int8_t *quantized = layer->Weights.data() + row * layer->Stride;
+      for (uint32_t column = 0; column < from->Inputs; ++column) {
+        quantized[column] = QuantizeValue(weights[column] / weight_scale);
+      }
+      layer->Scales[row] = weight_scale * layer->InputScale;
+      layer->Biases[row] = from->Biases[row];
+
+      // Neurons own their default impulse functions, so we can't keep
+      // pointers to those.
+      if (from->Impulses[row]->GetType() != ImpulseType::DUMB) {
+        layer->Impulses[row] = from->Impulses[row];
+      }
+    }
+    layer->Type = GetCommonImpulseType(layer->Impulses, &layer->Parameter);
+    layer->Accuracy = from->Accuracy;
+  }
+  output_indices_ = plan->GetOutputIndices();
+  workspace_.Reserve(*this);
+
+  if (report) {
+    const uint32_t num_outputs = GetNumOutputs();
+    std::vector<double> expected(num_outputs);
+    std::vector<float> inputs(num_inputs);
+    std::vector<float> actual(num_outputs);
+    InferenceWorkspace workspace;
+    *report = QuantizationReport();
+    report->Samples = count;
+    size_t agreements = 0;
+    double total_error = 0;
+    for (size_t sample_i = 0; sample_i < count; ++sample_i) {
+      const double *sample = calibration + sample_i * num_inputs;
+      std::copy(sample, sample + num_inputs, inputs.begin());
+      plan->Run(sample, expected.data(), &workspace);
+      GetOutputs(inputs.data(), actual.data());
+
+      for (uint32_t i = 0; i < num_outputs; ++i) {
+        const double error = fabs(expected[i] - actual[i]);
+        report->MaxError = std::max(report->MaxError, error);
+        report->MaxOutput = std::max(report->MaxOutput, fabs(expected[i]));
+        total_error += error;
+      }
+      if (std::max_element(expected.begin(), expected.end()) -
+              expected.begin() ==
+          std::max_element(actual.begin(), actual.end()) - actual.begin()) {
+        ++agreements;
+      }
+    }
+    report->MeanError = total_error / (count * num_outputs);
+    report->ArgmaxAgreement = static_cast<double>(agreements) / count;
+  }
+
+  return true;
+}
+
+bool QuantizedNetwork::Evaluate(const float *inputs, float *outputs,
+                                QuantizedWorkspace *workspace) const {
+  if (layers_.empty()) {
+    return false;
+  }
+  workspace->Reserve(*this);
+
+  float *const front = workspace->GetFrontBuffer();
+  float *const back = workspace->GetBackBuffer();
+  int8_t *const quantized = workspace->GetQuantizedBuffer();
+  const float *in = inputs;
+  float *out = front;
+  for (const Layer *layer : layers_) {
+    const float inverse_scale = 1 / layer->InputScale;
+    for (uint32_t i = 0; i < layer->Inputs; ++i) {
+      quantized[i] = QuantizeValue(in[i] * inverse_scale);
+    }
+
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      const int32_t sum = kernels::DotInt8(
+          layer->Weights.data() + row * layer->Stride, quantized,
+          layer->Inputs);
+      out[row] = sum * layer->Scales[row] + layer->Biases[row];
+    }
+
+    if (layer->Type != ImpulseType::CUSTOM) {
+      ApplyImpulse(layer->Type, layer->Parameter, out, layer->Outputs,
+                   layer->Accuracy);
+    } else {
+      for (uint32_t row = 0; row < layer->Outputs; ++row) {
+        out[row] = layer->Impulses[row]->Function(out[row]);
+      }
+    }
+
+    in = out;
+    out = (out == front) ? back : front;
+  }
+
+  for (uint32_t i = 0; i < output_indices_.size(); ++i) {
+    outputs[i] = in[output_indices_[i]];
+  }
+  return true;
+}
+
+bool QuantizedNetwork::SetLayerOutputFunctions(uint32_t layer_i,
+                                               ImpulseFunction *impulse) {
+  if (!layer_i || layer_i > layers_.size()) {
+    return false;
+  }
+  Layer *layer = layers_[layer_i - 1];
+  layer->Impulses.assign(layer->Outputs, impulse);
+  layer->Type = GetCommonImpulseType(layer->Impulses, &layer->Parameter);
+  return true;
+}
+
+bool QuantizedNetwork::SetLayerImpulseAccuracy(uint32_t layer_i,
+                                               ImpulseAccuracy accuracy) {
+  if (!layer_i || layer_i > layers_.size()) {
+    return false;
+  }
+  layers_[layer_i - 1]->Accuracy = accuracy;
+  return true;
+}
+
+size_t QuantizedNetwork::GetSerializedSize() const {
+  if (layers_.empty()) {
+    return 0;
+  }
+
+  // Number of inputs and number of layers.
+  size_t size = 2 * sizeof(uint32_t);
+  for (const Layer *layer : layers_) {
+    // Layer size and input scale.
+    size += sizeof(uint32_t) + sizeof(float);
+    // Scales and biases.
+    size += 2 * layer->Outputs * sizeof(float);
+    // Weights, without the padding at the end of each row.
+    size += layer->Outputs * layer->Inputs * sizeof(int8_t);
+  }
+  // Number of outputs, and where each one comes from.
+  size += sizeof(uint32_t);
+  size += GetNumOutputs() * sizeof(uint32_t);
+
+  return size;
+}
+
+size_t QuantizedNetwork::Serialize(char *buffer) const {
+  char *const original_buffer = buffer;
+  if (layers_.empty()) {
+    return 0;
+  }
+
+  const uint32_t layout_info[] = {num_inputs_,
+                                  static_cast<uint32_t>(layers_.size())};
+  WriteValues(layout_info, 2, &buffer);
+  for (const Layer *layer : layers_) {
+    WriteValues(&layer->Outputs, 1, &buffer);
+    WriteValues(&layer->InputScale, 1, &buffer);
+    WriteValues(layer->Scales.data(), layer->Outputs, &buffer);
+    WriteValues(layer->Biases.data(), layer->Outputs, &buffer);
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      WriteValues(layer->Weights.data() + row * layer->Stride, layer->Inputs,
+                  &buffer);
+    }
+  }
+
+  const uint32_t num_outputs = GetNumOutputs();
+  WriteValues(&num_outputs, 1, &buffer);
+  WriteValues(output_indices_.data(), num_outputs, &buffer);
+
+  return buffer - original_buffer;
+}
+
+size_t QuantizedNetwork::Deserialize(const char *buffer) {
+  const char *const original_buffer = buffer;
+
+  uint32_t layout_info[2];
+  ReadValues(&buffer, 2, layout_info);
+  Reset(layout_info[0]);
+  for (uint32_t layer_i = 0; layer_i < layout_info[1]; ++layer_i) {
+    uint32_t outputs;
+    ReadValues(&buffer, 1, &outputs);
+    Layer *layer = AddLayer(outputs);
+    ReadValues(&buffer, 1, &layer->InputScale);
+    ReadValues(&buffer, outputs, layer->Scales.data());
+    ReadValues(&buffer, outputs, layer->Biases.data());
+    for (uint32_t row = 0; row < outputs; ++row) {
+      ReadValues(&buffer, layer->Inputs,
+                 layer->Weights.data() + row * layer->Stride);
+    }
+    layer->Type = GetCommonImpulseType(layer->Impulses, &layer->Parameter);
+  }
+
+  uint32_t num_outputs;
+  ReadValues(&buffer, 1, &num_outputs);
+  output_indices_.resize(num_outputs);
+  ReadValues(&buffer, num_outputs, output_indices_.data());
+  for (uint32_t index : output_indices_) {
+    if (layers_.empty() || index >= layers_.back()->Outputs) {
+      LOG(Level::ERROR, "Invalid output index %u.", index);
+      Reset(0);
+      return 0;
+    }
+  }
+
+  workspace_.Reserve(*this);
+  return buffer - original_buffer;
+}
+
+bool QuantizedNetwork::SaveToFile(const char *path) const {
+  const size_t buffer_size = GetSerializedSize();
+  if (!buffer_size) {
+    LOG(Level::ERROR, "Failed to get size of serialized network.");
+    return false;
+  }
+  std::vector<char> buffer(buffer_size);
+  const size_t bytes_written = Serialize(buffer.data());
+  if (bytes_written != buffer_size) {
+    LOG(Level::ERROR, "Wrote %zu bytes to buffer instead of %zu.",
+        bytes_written, buffer_size);
+    return false;
+  }
+  return helpers::WriteFile(path, buffer);
+}
+
+bool QuantizedNetwork::ReadFromFile(const char *path) {
+  std::vector<char> buffer;
+  if (!helpers::ReadFile(path, &buffer)) {
+    return false;
+  }
+  const size_t bytes_processed = Deserialize(buffer.data());
+  if (bytes_processed != buffer.size()) {
+    LOG(Level::ERROR, "Deserialized %zu bytes instead of %zu.",
+        bytes_processed, buffer.size());
+    return false;
+  }
+  return true;
+}
+
+} //network
@@ -0,0 +1,172 @@
+#ifndef NEURAL_NET_QUANTIZED_NETWORK_H_
+#define NEURAL_NET_QUANTIZED_NETWORK_H_
+
+// An int8 version of a trained multilayered feedforward network, for fast,
+// compact inference. Each weight is stored as an 8-bit integer along with a
+// scale for its neuron (or its whole layer), and the values coming into each
+// layer get scaled into 8 bits as well, so that every weighted sum is an
+// integer dot product. The scales for the values coming into each layer are
+// picked by running a set of calibration inputs through the full-precision
+// network.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "aligned_array.h"
+#include "macros.h"
+#include "multilayered_feedforward.h"
+#include "output_functions.h"
+
+namespace network {
+
+class QuantizedNetwork;
+
+// How many weights share each scale.
+enum class QuantizationGranularity {
+  // One scale for each neuron. This is more accurate, since a neuron with
+  // small weights doesn't lose precision to one with large weights.
+  PER_NEURON = 0,
+  // One scale for each layer.
+  PER_LAYER
+};
+
+// How the quantized network compares to the full-precision one on the
+// calibration data.
+struct QuantizationReport {
+  // The number of calibration samples.
+  size_t Samples = 0;
+  // The largest and mean absolute difference between a quantized output and
+  // the same full-precision output.
+  double MaxError = 0;
+  double MeanError = 0;
+  // The largest absolute value of any full-precision output, to put the
+  // errors in perspective.
+  double MaxOutput = 0;
+  // The fraction of samples for which the largest output is the same one in
+  // both networks. For classifiers, this is how often they agree.
+  double ArgmaxAgreement = 0;
+};
+
+// Scratch space for running a quantized network. Like InferenceWorkspace,
+// it means that running the network doesn't allocate anything, and that
+// several threads can share one network.
+class QuantizedWorkspace {
+ public:
+  QuantizedWorkspace() = default;
+  // Makes sure there is room to run <network>.
+  void Reserve(const QuantizedNetwork& network);
+  inline float *GetFrontBuffer() {
+    return front_buffer_.data();
+  }
+  inline float *GetBackBuffer() {
+    return back_buffer_.data();
+  }
+  inline int8_t *GetQuantizedBuffer() {
+    return quantized_buffer_.data();
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(QuantizedWorkspace);
+
+ private:
+  // Layer outputs go back and forth between these.
+  std::vector<float> front_buffer_;
+  std::vector<float> back_buffer_;
+  // The inputs to the current layer, after they've been quantized.
+  std::vector<int8_t> quantized_buffer_;
+};
+
+class QuantizedNetwork {
+ public:
+  QuantizedNetwork() = default;
+  ~QuantizedNetwork();
+  // Replaces this network with a quantized copy of <source>. <calibration>
+  // holds <count> sets of inputs, one after another, which should look like
+  // what the network will see in practice. If <report> isn't nullptr, it gets
+  // filled in with how well the quantized network matches <source> on them.
+  // The impulse functions are shared with <source>, like they are for
+  // MFNetworkF32. Returns false if <source> can't be run, or <count> is 0.
+  bool Quantize(MFNetwork *source, const double *calibration, size_t count,
+                QuantizationGranularity granularity =
+                    QuantizationGranularity::PER_NEURON,
+                QuantizationReport *report = nullptr);
+  // Returns the number of inputs the network takes.
+  inline uint32_t GetNumInputs() const {
+    return num_inputs_;
+  }
+  // Returns the number of outputs the network produces.
+  inline uint32_t GetNumOutputs() const {
+    return output_indices_.size();
+  }
+  // Returns the number of values in the widest layer, including the inputs.
+  inline uint32_t GetMaxWidth() const {
+    return max_width_;
+  }
+  // Runs <inputs> through the network and writes the results to <outputs>.
+  // Returns false if the network is empty.
+  bool Evaluate(const float *inputs, float *outputs,
+                QuantizedWorkspace *workspace) const;
+  // The same, using a workspace that belongs to the network.
+  inline bool GetOutputs(const float *inputs, float *outputs) {
+    return Evaluate(inputs, outputs, &workspace_);
+  }
+  // Sets the same impulse function for all the neurons in a layer, which is
+  // indexed like it is in MFNetwork. Impulse functions aren't serialized, so
+  // this is how they get restored after Deserialize(). Returns false to
+  // indicate a bad layer index.
+  bool SetLayerOutputFunctions(uint32_t layer_i, ImpulseFunction *impulse);
+  // Works like MFNetwork::SetLayerImpulseAccuracy().
+  bool SetLayerImpulseAccuracy(uint32_t layer_i, ImpulseAccuracy accuracy);
+  // Serialization works like it does for MFNetworkF32. Each weight takes up a
+  // single byte.
+  size_t GetSerializedSize() const;
+  size_t Serialize(char *buffer) const;
+  size_t Deserialize(const char *buffer);
+  bool SaveToFile(const char *path) const;
+  bool ReadFromFile(const char *path);
+
+  DISSALOW_COPY_AND_ASSIGN(QuantizedNetwork);
+
+ private:
+  // A single quantized layer.
+  struct Layer {
+    uint32_t Inputs;
+    uint32_t Outputs;
+    // The distance between the starts of two rows of Weights.
+    uint32_t Stride;
+    // Row <i> holds the quantized weights for neuron <i>.
+    AlignedArray<int8_t> Weights;
+    // What to multiply the integer sum for each neuron by to get the real
+    // one. This is the scale of the inputs times the scale of the weights.
+    std::vector<float> Scales;
+    std::vector<float> Biases;
+    // Inputs are divided by this and rounded to get their 8-bit values.
+    float InputScale;
+    // The impulse functions, just like in ExecutionPlan::Layer.
+    std::vector<ImpulseFunction *> Impulses;
+    ImpulseType Type = ImpulseType::CUSTOM;
+    double Parameter = 0;
+    ImpulseAccuracy Accuracy = ImpulseAccuracy::EXACT;
+  };
+
+  // Discards all layers and sets the number of inputs.
+  void Reset(uint32_t inputs);
+  // Appends a layer with <outputs> neurons, taking its inputs from the layer
+  // before it.
+  Layer *AddLayer(uint32_t outputs);
+
+  uint32_t num_inputs_ = 0;
+  // The layers, in order. We are responsible for freeing these.
+  std::vector<Layer *> layers_;
+  // The last layer neuron that feeds each network output.
+  std::vector<uint32_t> output_indices_;
+  uint32_t max_width_ = 0;
+  // Scratch space for GetOutputs().
+  QuantizedWorkspace workspace_;
+  // Used by any neuron that doesn't have an impulse function from the user.
+  DumbOutputer default_impulse_;
+};
+
+} //network
+
+#endif
@@ -0,0 +1,55 @@
+#include <stdio.h>
+
+#include "logger.h"
+#include "serialization.h"
+
+namespace helpers {
+
+bool WriteFile(const char *path, const std::vector<char>& buffer) {
+  FILE *out_file = fopen(path, "wb");
+  if (!out_file) {
+    LOG(Level::ERROR, "Failed to open %s for writing.", path);
+    return false;
+  }
+  const size_t bytes_to_file =
+      fwrite(buffer.data(), sizeof(buffer[0]), buffer.size(), out_file);
+  fclose(out_file);
+  if (bytes_to_file != buffer.size()) {
+    LOG(Level::ERROR, "Wrote %zu bytes to file instead of %zu.",
+        bytes_to_file, buffer.size());
+    return false;
+  }
+
+  return true;
+}
+
+bool ReadFile(const char *path, std::vector<char> *buffer) {
+  FILE *in_file = fopen(path, "rb");
+  if (!in_file) {
+    LOG(Level::ERROR, "Failed to open %s for reading.", path);
+    return false;
+  }
+
+  fseek(in_file, 0L, SEEK_END);
+  const long length = ftell(in_file);
+  fseek(in_file, 0L, SEEK_SET);
+  if (length <= 0) {
+    LOG(Level::ERROR, "%s is empty.", path);
+    fclose(in_file);
+    return false;
+  }
+
+  buffer->resize(length);
+  const size_t bytes_read =
+      fread(buffer->data(), sizeof((*buffer)[0]), length, in_file);
+  fclose(in_file);
+  if (bytes_read != static_cast<size_t>(length)) {
+    LOG(Level::ERROR, "Read %zu bytes from file instead of %ld.", bytes_read,
+        length);
+    return false;
+  }
+
+  return true;
+}
+
+} // helpers
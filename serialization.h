@@ -0,0 +1,37 @@
+#ifndef NEURAL_NET_SERIALIZATION_H_
+#define NEURAL_NET_SERIALIZATION_H_
+
+// Small helpers for the compact network formats, which get packed into a flat
+// buffer before going to a file.
+
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+namespace helpers {
+
+// Copies <count> values to <buffer> and moves it past them.
+template <typename T>
+inline void WriteValues(const T *values, size_t count, char **buffer) {
+  memcpy(*buffer, values, sizeof(values[0]) * count);
+  *buffer += sizeof(values[0]) * count;
+}
+
+// Copies <count> values from <buffer> and moves it past them.
+template <typename T>
+inline void ReadValues(const char **buffer, size_t count, T *values) {
+  memcpy(values, *buffer, sizeof(values[0]) * count);
+  *buffer += sizeof(values[0]) * count;
+}
+
+// Writes the contents of <buffer> to the file at <path>, replacing it. Returns
+// false if anything goes wrong.
+bool WriteFile(const char *path, const std::vector<char>& buffer);
+// Replaces the contents of <buffer> with the contents of the file at <path>.
+// Returns false if the file can't be read or is empty.
+bool ReadFile(const char *path, std::vector<char> *buffer);
+
+} // helpers
+
+#endif
@@ -0,0 +1,185 @@
+#include <ctype.h>
+
+#include <cmath>
+#include <vector>
+
+#include "execution_plan.h"
+#include "logger.h"
+#include "source_exporter.h"
+
+namespace network {
+namespace {
+
+// Enough digits that every double reads back exactly.
+#define DOUBLE_FORMAT "%.17g"
+
+// Writes the C++ expression for the impulse function <type> applied to the
+// variable <value>.
+void WriteImpulse(FILE *out, ImpulseType type, double parameter,
+                  const char *value) {
+  switch (type) {
+    case ImpulseType::DUMB:
+      fprintf(out, "%s", value);
+      break;
+    case ImpulseType::THRESHOLD:
+      fprintf(out, "(%s >= " DOUBLE_FORMAT " ? 1.0 : 0.0)", value, parameter);
+      break;
+    case ImpulseType::SIGMOID:
+      fprintf(out, "1 / (1 + exp(-%s))", value);
+      break;
+    case ImpulseType::TANH:
+      fprintf(out, "tanh(%s)", value);
+      break;
+    case ImpulseType::LINEAR:
+      fprintf(out, DOUBLE_FORMAT " * %s", parameter, value);
+      break;
+    case ImpulseType::CUSTOM:
+      CHECK(false, "Custom impulse functions can't be exported.");
+      break;
+  }
+}
+
+// Writes <count> values as part of an array initializer, starting on a new
+// line.
+void WriteArray(FILE *out, const double *values, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    fprintf(out, "%s" DOUBLE_FORMAT ",", (i % 4) ? " " : "\n    ", values[i]);
+  }
+}
+
+// Returns false if anything in <plan> can't be written out as source.
+bool CheckExportable(const ExecutionPlan& plan) {
+  for (uint32_t layer_i = 0; layer_i < plan.GetNumLayers(); ++layer_i) {
+    const ExecutionPlan::Layer *layer = plan.GetLayer(layer_i);
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      if (layer->Impulses[row]->GetType() == ImpulseType::CUSTOM) {
+        LOG(Level::ERROR, "Neuron %u in layer %u has a custom impulse "
+            "function.", row, layer_i + 1);
+        return false;
+      }
+      const double *weights = layer->Weights.data() + row * layer->Stride;
+      for (uint32_t column = 0; column < layer->Inputs; ++column) {
+        if (!std::isfinite(weights[column])) {
+          LOG(Level::ERROR, "Neuron %u in layer %u has a weight of %f.", row,
+              layer_i + 1, weights[column]);
+          return false;
+        }
+      }
+      if (!std::isfinite(layer->Biases[row])) {
+        LOG(Level::ERROR, "Neuron %u in layer %u has a bias of %f.", row,
+            layer_i + 1, layer->Biases[row]);
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+} // namespace
+
+bool ExportSource(MFNetwork *network, const char *name, FILE *out) {
+  const ExecutionPlan *plan = network->GetExecutionPlan();
+  if (!plan || !CheckExportable(*plan)) {
+    return false;
+  }
+
+  // Header guard.
+  char guard[256];
+  size_t guard_size = 0;
+  for (const char *c = name; *c && guard_size < sizeof(guard) - 1; ++c) {
+    guard[guard_size++] = toupper(*c);
+  }
+  guard[guard_size] = '\0';
+  fprintf(out, "// Generated from a trained network. Do not edit.\n\n");
+  fprintf(out, "#ifndef NEURAL_NET_EXPORTED_%s_H_\n", guard);
+  fprintf(out, "#define NEURAL_NET_EXPORTED_%s_H_\n\n", guard);
+  fprintf(out, "#include <math.h>\n\n");
+  fprintf(out, "namespace %s {\n\n", name);
+  fprintf(out, "constexpr unsigned kNumInputs = %u;\n", plan->GetNumInputs());
+  fprintf(out, "constexpr unsigned kNumOutputs = %u;\n\n",
+          plan->GetNumOutputs());
+
+  // Weights and biases for each layer. The weights are stored row-major,
+  // with one row for each neuron.
+  for (uint32_t layer_i = 0; layer_i < plan->GetNumLayers(); ++layer_i) {
+    const ExecutionPlan::Layer *layer = plan->GetLayer(layer_i);
+    fprintf(out, "constexpr double kLayer%uWeights[%u] = {", layer_i,
+            layer->Outputs * layer->Inputs);
+    for (uint32_t row = 0; row < layer->Outputs; ++row) {
+      WriteArray(out, layer->Weights.data() + row * layer->Stride,
+                 layer->Inputs);
+    }
+    fprintf(out, "\n};\n");
+    fprintf(out, "constexpr double kLayer%uBiases[%u] = {", layer_i,
+            layer->Outputs);
+    WriteArray(out, layer->Biases.data(), layer->Outputs);
+    fprintf(out, "\n};\n\n");
+  }
+
+  fprintf(out, "inline void Evaluate(const double *inputs, double *outputs) {"
+          "\n");
+  for (uint32_t layer_i = 0; layer_i < plan->GetNumLayers(); ++layer_i) {
+    const ExecutionPlan::Layer *layer = plan->GetLayer(layer_i);
+    char in[32];
+    if (layer_i) {
+      snprintf(in, sizeof(in), "layer%u", layer_i - 1);
+    } else {
+      snprintf(in, sizeof(in), "inputs");
+    }
+    fprintf(out, "  double layer%u[%u];\n", layer_i, layer->Outputs);
+    fprintf(out, "  for (unsigned i = 0; i < %u; ++i) {\n", layer->Outputs);
+    fprintf(out, "    double sum = kLayer%uBiases[i];\n", layer_i);
+    fprintf(out, "    for (unsigned j = 0; j < %u; ++j) {\n", layer->Inputs);
+    fprintf(out, "      sum += kLayer%uWeights[i * %u + j] * %s[j];\n",
+            layer_i, layer->Inputs, in);
+    fprintf(out, "    }\n");
+    fprintf(out, "    layer%u[i] = ", layer_i);
+    if (layer->Type != ImpulseType::CUSTOM) {
+      WriteImpulse(out, layer->Type, layer->Parameter, "sum");
+    } else {
+      fprintf(out, "sum");
+    }
+    fprintf(out, ";\n  }\n");
+
+    if (layer->Type == ImpulseType::CUSTOM) {
+      // The neurons use different built-in functions, so each one gets its
+      // own line.
+      for (uint32_t row = 0; row < layer->Outputs; ++row) {
+        const ImpulseFunction *impulse = layer->Impulses[row];
+        char value[32];
+        snprintf(value, sizeof(value), "layer%u[%u]", layer_i, row);
+        fprintf(out, "  %s = ", value);
+        WriteImpulse(out, impulse->GetType(), impulse->GetParameter(), value);
+        fprintf(out, ";\n");
+      }
+    }
+  }
+
+  const std::vector<uint32_t>& output_indices = plan->GetOutputIndices();
+  for (uint32_t i = 0; i < output_indices.size(); ++i) {
+    fprintf(out, "  outputs[%u] = layer%u[%u];\n", i,
+            plan->GetNumLayers() - 1, output_indices[i]);
+  }
+  fprintf(out, "}\n\n");
+  fprintf(out, "} // %s\n\n", name);
+  fprintf(out, "#endif\n");
+
+  return true;
+}
+
+bool ExportSourceToFile(MFNetwork *network, const char *name,
+                        const char *path) {
+  FILE *out_file = fopen(path, "w");
+  if (!out_file) {
+    LOG(Level::ERROR, "Failed to open %s for writing.", path);
+    return false;
+  }
+  const bool success = ExportSource(network, name, out_file);
+  fclose(out_file);
+  if (!success) {
+    remove(path);
+  }
+  return success;
+}
+
+} //network
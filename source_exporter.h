@@ -0,0 +1,37 @@
+#ifndef NEURAL_NET_SOURCE_EXPORTER_H_
+#define NEURAL_NET_SOURCE_EXPORTER_H_
+
+// Turns a trained network into standalone C++ source code, so that it can be
+// compiled right into a program. The generated header has no dependencies
+// besides <math.h>, keeps all its weights in constexpr arrays, and has a single
+// Evaluate() function that doesn't allocate anything or branch on anything but
+// its loop counters.
+
+#include <stdio.h>
+
+#include "multilayered_feedforward.h"
+
+namespace network {
+
+// Writes a header to <out> that computes the same thing as <network>. All of
+// it goes in a namespace called <name>, which must be a valid C++ identifier,
+// and looks like this:
+//
+//   namespace <name> {
+//   constexpr unsigned kNumInputs = ...;
+//   constexpr unsigned kNumOutputs = ...;
+//   inline void Evaluate(const double *inputs, double *outputs);
+//   }
+//
+// Only the built-in impulse functions can be exported, and they are always
+// computed exactly, regardless of any ImpulseAccuracy settings. Returns false,
+// without writing anything, if the network can't be run or uses a custom
+// impulse function.
+bool ExportSource(MFNetwork *network, const char *name, FILE *out);
+// The same thing, but writes the header to the file at <path>.
+bool ExportSourceToFile(MFNetwork *network, const char *name,
+                        const char *path);
+
+} //network
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef NEURAL_NET_STATIC_NETWORK_H_
+#define NEURAL_NET_STATIC_NETWORK_H_
+
+// A multilayered feedforward network whose shape is fixed at compile time.
+// For small networks, like the ones in control loops, walking the layer
+// structures of MFNetwork or even running an ExecutionPlan costs more than
+// the actual math. Here, every weight lives in a std::array inside the
+// network object, every loop has a constant trip count that the compiler can
+// unroll completely, and the impulse function gets called directly instead of
+// through a pointer, so that it can be inlined.
+//
+// For example, StaticMFNetwork<TanH, 16, 32, 32, 4> has 16 inputs, two hidden
+// layers of 32 neurons and 4 outputs, all using TanH. (The sizes come last
+// because a template parameter pack has to.)
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <array>
+#include <utility>
+
+#include "execution_plan.h"
+#include "multilayered_feedforward.h"
+
+namespace network {
+namespace internal {
+
+// The last of a list of sizes.
+template <uint32_t... Sizes>
+struct LastSize;
+template <uint32_t Last>
+struct LastSize<Last> {
+  static constexpr uint32_t kValue = Last;
+};
+template <uint32_t First, uint32_t... Rest>
+struct LastSize<First, Rest...> : LastSize<Rest...> {};
+
+// Holds the layers of a StaticMFNetwork, each one nested inside the layer
+// before it. The first size is the number of inputs to the first layer.
+template <uint32_t... Sizes>
+struct StaticLayers;
+
+// There's nothing after the last layer, so this just hands over the outputs.
+template <uint32_t Outputs>
+struct StaticLayers<Outputs> {
+  template <typename Activation>
+  inline void Run(Activation *activation,
+                  const std::array<double, Outputs>& in,
+                  const std::array<uint32_t, Outputs>& output_indices,
+                  double *outputs) const {
+    for (uint32_t i = 0; i < Outputs; ++i) {
+      outputs[i] = in[output_indices[i]];
+    }
+  }
+
+  inline bool CopyFrom(const ExecutionPlan& plan, uint32_t layer_i) {
+    return layer_i == plan.GetNumLayers();
+  }
+};
+
+template <uint32_t Inputs, uint32_t Outputs, uint32_t... Rest>
+struct StaticLayers<Inputs, Outputs, Rest...> {
+  // Row-major, one row per neuron.
+  std::array<double, Inputs * Outputs> Weights;
+  std::array<double, Outputs> Biases;
+  StaticLayers<Outputs, Rest...> Next;
+
+  template <typename Activation, size_t NumOutputs>
+  inline void Run(Activation *activation, const std::array<double, Inputs>& in,
+                  const std::array<uint32_t, NumOutputs>& output_indices,
+                  double *outputs) const {
+    std::array<double, Outputs> out;
+    for (uint32_t i = 0; i < Outputs; ++i) {
+      double sum = Biases[i];
+      for (uint32_t j = 0; j < Inputs; ++j) {
+        sum += Weights[i * Inputs + j] * in[j];
+      }
+      out[i] = activation->Function(sum);
+    }
+    Next.Run(activation, out, output_indices, outputs);
+  }
+
+  // Copies this layer and the ones after it from <plan>, starting at
+  // <layer_i>. Returns false if the plan has a different shape.
+  bool CopyFrom(const ExecutionPlan& plan, uint32_t layer_i) {
+    if (layer_i >= plan.GetNumLayers()) {
+      return false;
+    }
+    const ExecutionPlan::Layer *layer = plan.GetLayer(layer_i);
+    if (layer->Inputs != Inputs || layer->Outputs != Outputs) {
+      return false;
+    }
+    for (uint32_t i = 0; i < Outputs; ++i) {
+      for (uint32_t j = 0; j < Inputs; ++j) {
+        Weights[i * Inputs + j] = layer->Weights[i * layer->Stride + j];
+      }
+      Biases[i] = layer->Biases[i];
+    }
+    return Next.CopyFrom(plan, layer_i + 1);
+  }
+};
+
+} // internal
+
+template <typename Activation, uint32_t Inputs, uint32_t... Sizes>
+class StaticMFNetwork {
+ public:
+  static_assert(sizeof...(Sizes) >= 2,
+                "A network needs at least one hidden layer and an output "
+                "layer.");
+
+  static constexpr uint32_t kNumInputs = Inputs;
+  static constexpr uint32_t kNumOutputs = internal::LastSize<Sizes...>::kValue;
+
+  // Any arguments get passed on to the constructor of the impulse function.
+  // All weights start out at zero.
+  template <typename... Args>
+  explicit StaticMFNetwork(Args&&... args) :
+      activation_(std::forward<Args>(args)...),
+      layers_() {
+    for (uint32_t i = 0; i < kNumOutputs; ++i) {
+      output_indices_[i] = i;
+    }
+  }
+  // Copies the weights from <source>, which has to have exactly the same
+  // shape. The impulse functions of <source> are ignored. Returns false if
+  // the shapes don't match, or <source> can't be run.
+  bool CopyFrom(MFNetwork *source) {
+    const ExecutionPlan *plan = source->GetExecutionPlan();
+    if (!plan || plan->GetNumInputs() != kNumInputs ||
+        plan->GetNumOutputs() != kNumOutputs ||
+        !layers_.CopyFrom(*plan, 0)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < kNumOutputs; ++i) {
+      output_indices_[i] = plan->GetOutputIndices()[i];
+    }
+    return true;
+  }
+  // Loads a network saved with MFNetwork::SaveToFile(). Returns false if it
+  // can't be read or has a different shape.
+  bool ReadFromFile(const char *path) {
+    MFNetwork source(Inputs, kNumOutputs, 1);
+    return source.ReadFromFile(path) && CopyFrom(&source);
+  }
+  // Computes the outputs for <inputs>. Nothing gets allocated, and the network
+  // isn't changed, so this is safe to call from several threads at once as
+  // long as the impulse function doesn't keep any state.
+  inline void Evaluate(const double *inputs, double *outputs) const {
+    std::array<double, Inputs> in;
+    for (uint32_t i = 0; i < Inputs; ++i) {
+      in[i] = inputs[i];
+    }
+    layers_.Run(&activation_, in, output_indices_, outputs);
+  }
+
+ private:
+  // Impulse functions don't have const methods, but the built-in ones don't
+  // change when they're called either.
+  mutable Activation activation_;
+  internal::StaticLayers<Inputs, Sizes...> layers_;
+  // The last layer neuron that feeds each network output.
+  std::array<uint32_t, kNumOutputs> output_indices_;
+};
+
+// These need definitions outside the class before C++17.
+template <typename Activation, uint32_t Inputs, uint32_t... Sizes>
+constexpr uint32_t StaticMFNetwork<Activation, Inputs, Sizes...>::kNumInputs;
+template <typename Activation, uint32_t Inputs, uint32_t... Sizes>
+constexpr uint32_t StaticMFNetwork<Activation, Inputs, Sizes...>::kNumOutputs;
+
+} //network
+
+#endif
@@ -48,27 +48,74 @@ bool SupervisedLearner::Learn(double error, int max_iterations/* = -1*/) {
     testing_data.assign(training_data_.begin() + split + 1,
         training_data_.end());
   }
+  // Pack the testing inputs together so they can be run as one batch.
+  std::vector<double> testing_inputs;
+  for (TrainingItem item : testing_data) {
+    testing_inputs.insert(testing_inputs.end(), item.InputData,
+        item.InputData + num_inputs_);
+  }
+  std::vector<double> testing_outputs(testing_data.size() * num_outputs_);
+  // Where each batch gets packed together, if we're using batches, or the
+  // whole training set, if we're training asynchronously.
+  std::vector<double> batch_inputs;
+  std::vector<double> batch_targets;
   while (max_iterations == -1 || cycle < max_iterations) {
     current_error = 0;
     // Set input based on training data.
     std::random_shuffle(training_data.begin(), training_data.end());
-    for (TrainingItem item : training_data) {
-      trainee_->SetInputs(item.InputData);
-      // Do BackPropagation
-      if (!trainee_->PropagateError(item.ExpectedOutput)) {
+    if (asynchronous_) {
+      batch_inputs.clear();
+      batch_targets.clear();
+      for (TrainingItem item : training_data) {
+        batch_inputs.insert(batch_inputs.end(), item.InputData,
+            item.InputData + num_inputs_);
+        batch_targets.insert(batch_targets.end(), item.ExpectedOutput,
+            item.ExpectedOutput + num_outputs_);
+      }
+      if (!trainee_->PropagateErrorAsync(batch_inputs.data(),
+                                         batch_targets.data(),
+                                         training_data.size())) {
         return false;
       }
+    } else if (batch_size_ == 1) {
+      for (TrainingItem item : training_data) {
+        trainee_->SetInputs(item.InputData);
+        // Do BackPropagation
+        if (!trainee_->PropagateError(item.ExpectedOutput)) {
+          return false;
+        }
+      }
+    } else {
+      for (size_t start = 0; start < training_data.size();
+           start += batch_size_) {
+        const size_t count =
+            std::min<size_t>(batch_size_, training_data.size() - start);
+        batch_inputs.clear();
+        batch_targets.clear();
+        for (size_t item_i = start; item_i < start + count; ++item_i) {
+          const TrainingItem& item = training_data[item_i];
+          batch_inputs.insert(batch_inputs.end(), item.InputData,
+              item.InputData + num_inputs_);
+          batch_targets.insert(batch_targets.end(), item.ExpectedOutput,
+              item.ExpectedOutput + num_outputs_);
+        }
+        if (!trainee_->PropagateErrorBatch(batch_inputs.data(),
+                                           batch_targets.data(), count)) {
+          return false;
+        }
+      }
     }
 
-    for (TrainingItem item : testing_data) {
-      trainee_->SetInputs(item.InputData);
-      double outputs [num_outputs_];
-      if (!trainee_->GetOutputs(outputs)) {
-        return false;
-      }
+    if (!trainee_->GetOutputsBatch(testing_inputs.data(), testing_data.size(),
+                                   testing_outputs.data())) {
+      return false;
+    }
+    for (uint32_t item_i = 0; item_i < testing_data.size(); ++item_i) {
+      const double *outputs = &testing_outputs[item_i * num_outputs_];
       // Calculate cumulative error.
       for (uint32_t i = 0; i < num_outputs_; ++i) {
-        current_error += pow(item.ExpectedOutput[i] - outputs[i], 2);
+        current_error +=
+            pow(testing_data[item_i].ExpectedOutput[i] - outputs[i], 2);
       }
     }
     current_error /= 2;
@@ -23,6 +23,21 @@ class SupervisedLearner {
   // Runs backpropagation iterations until the error is less than <error>, or
   // <max_iterations> iterations have been performed.
   bool Learn(double error, int max_iterations = -1);
+  // Makes Learn() train on <size> items at a time, adjusting the weights once
+  // for each batch instead of once for each item. Batches make much better
+  // use of SIMD and threads, though they might need a higher learning rate to
+  // learn as quickly. If the network has a thread pool, each batch also gets
+  // split up across its threads. The default is 1, which trains on each item
+  // on its own.
+  inline void SetBatchSize(uint32_t size) {
+    batch_size_ = size ? size : 1;
+  }
+  // Makes Learn() train asynchronously, with the network's thread pool, as
+  // described for MFNetwork::PropagateErrorAsync(). This takes precedence over
+  // the batch size.
+  inline void SetAsynchronous(bool asynchronous) {
+    asynchronous_ = asynchronous;
+  }
 
   DISSALOW_COPY_AND_ASSIGN(SupervisedLearner);
 
@@ -37,6 +52,8 @@ class SupervisedLearner {
   std::vector<TrainingItem> training_data_;
   network::MFNetwork *trainee_;
   uint32_t num_inputs_, num_outputs_;
+  uint32_t batch_size_ = 1;
+  bool asynchronous_ = false;
 };
 
 } // algorithm
@@ -0,0 +1,118 @@
+// Tests for the batch scheduler.
+
+#include <stdlib.h>
+
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../batch_scheduler.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+
+namespace network {
+namespace test {
+
+class BatchSchedulerTest : public ::testing::Test {
+ protected:
+  BatchSchedulerTest() : network_(4, 2, 8) {}
+
+  virtual void SetUp() {
+    network_.AddHiddenLayer();
+    network_.RandomWeights(-1, 1);
+    network_.SetOutputFunctions(&tanh_);
+    ASSERT_TRUE(network_.Compile());
+  }
+
+  // Makes up some inputs for request <i>.
+  static std::vector<double> MakeInputs(int i) {
+    return std::vector<double>({0.1 * i, -0.2 * i, 1, (i % 7) - 3.0});
+  }
+
+  // Checks that <outputs> are what the network gives for <inputs>.
+  void ExpectCorrect(const std::vector<double>& inputs,
+                     const std::vector<double>& outputs) {
+    ASSERT_EQ(2u, outputs.size());
+    double expected [2];
+    InferenceWorkspace workspace;
+    ASSERT_TRUE(network_.Evaluate(inputs.data(), expected, &workspace));
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_NEAR(expected[i], outputs[i], 1e-12);
+    }
+  }
+
+  TanH tanh_;
+  MFNetwork network_;
+};
+
+TEST_F(BatchSchedulerTest, BatchingTest) {
+  // Requests that all arrive at once should get batched together.
+  BatchScheduler scheduler(&network_, 16, 100000);
+  std::vector<std::future<std::vector<double> > > futures;
+  for (int i = 0; i < 64; ++i) {
+    futures.push_back(scheduler.Submit(MakeInputs(i).data()));
+  }
+  for (int i = 0; i < 64; ++i) {
+    ExpectCorrect(MakeInputs(i), futures[i].get());
+  }
+  EXPECT_EQ(64u, scheduler.GetNumRequests());
+  EXPECT_LT(scheduler.GetNumBatches(), 64u);
+}
+
+TEST_F(BatchSchedulerTest, MaxWaitTest) {
+  // A lone request shouldn't wait for a batch that never fills up.
+  BatchScheduler scheduler(&network_, 16, 1000);
+  for (int i = 0; i < 3; ++i) {
+    std::future<std::vector<double> > outputs =
+        scheduler.Submit(MakeInputs(i).data());
+    ASSERT_EQ(std::future_status::ready,
+              outputs.wait_for(std::chrono::seconds(10)));
+    ExpectCorrect(MakeInputs(i), outputs.get());
+  }
+  EXPECT_EQ(3u, scheduler.GetNumBatches());
+}
+
+TEST_F(BatchSchedulerTest, LoadTest) {
+  // Simulate several clients sending requests one after another.
+  BatchScheduler scheduler(&network_, 8, 200);
+  std::vector<std::thread> clients;
+  for (int client = 0; client < 6; ++client) {
+    clients.emplace_back([this, &scheduler, client]() {
+      for (int i = 0; i < 50; ++i) {
+        const std::vector<double> inputs = MakeInputs(client * 50 + i);
+        ExpectCorrect(inputs, scheduler.Submit(inputs.data()).get());
+      }
+    });
+  }
+  for (std::thread& client : clients) {
+    client.join();
+  }
+  EXPECT_EQ(300u, scheduler.GetNumRequests());
+}
+
+TEST_F(BatchSchedulerTest, ShutdownTest) {
+  // Destroying the scheduler should still finish everything submitted.
+  std::vector<std::future<std::vector<double> > > futures;
+  {
+    BatchScheduler scheduler(&network_, 4, 1000000);
+    for (int i = 0; i < 10; ++i) {
+      futures.push_back(scheduler.Submit(MakeInputs(i).data()));
+    }
+  }
+  for (int i = 0; i < 10; ++i) {
+    ExpectCorrect(MakeInputs(i), futures[i].get());
+  }
+}
+
+TEST(BatchSchedulerFailureTest, UncompiledTest) {
+  // A network that can't be evaluated gives back empty outputs.
+  MFNetwork network(2, 1, 3);
+  network.AddHiddenLayer();
+  BatchScheduler scheduler(&network);
+  const double inputs [] = {1, 2};
+  EXPECT_TRUE(scheduler.Submit(inputs).get().empty());
+}
+
+} // test
+} // network
@@ -0,0 +1,169 @@
+// Tests for incremental evaluation.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../execution_plan.h"
+#include "../incremental_evaluator.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+
+namespace network {
+namespace test {
+namespace {
+
+const uint32_t kInputs = 64;
+const uint32_t kOutputs = 3;
+
+// Returns a random value between -1 and 1.
+double RandomValue() {
+  return (rand() % 2001 - 1000) / 1000.0;
+}
+
+// Checks that <evaluator> gives the same outputs as running <plan> directly.
+void ExpectMatches(const ExecutionPlan& plan, IncrementalEvaluator *evaluator,
+                   const std::vector<double>& inputs) {
+  InferenceWorkspace workspace;
+  double expected [kOutputs];
+  double actual [kOutputs];
+  ASSERT_TRUE(plan.Run(inputs.data(), expected, &workspace));
+  ASSERT_TRUE(evaluator->Evaluate(inputs.data(), actual));
+  for (uint32_t i = 0; i < kOutputs; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-12);
+  }
+}
+
+} // namespace
+
+TEST(IncrementalEvaluatorTest, DenseTest) {
+  // Changing a few inputs at a time should give the same results as running
+  // the whole network.
+  MFNetwork network(kInputs, kOutputs, 16);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.1);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+
+  IncrementalEvaluator evaluator(plan);
+  std::vector<double> inputs(kInputs);
+  for (double& input : inputs) {
+    input = RandomValue();
+  }
+  ExpectMatches(*plan, &evaluator, inputs);
+  EXPECT_EQ(0u, evaluator.GetIncrementalLayers());
+
+  for (int tick = 0; tick < 50; ++tick) {
+    inputs[rand() % kInputs] = RandomValue();
+    inputs[rand() % kInputs] = RandomValue();
+    ExpectMatches(*plan, &evaluator, inputs);
+    // Only the first layer has few enough changes coming in.
+    EXPECT_EQ(1u, evaluator.GetIncrementalLayers());
+  }
+
+  // Changing everything should fall back on computing everything.
+  for (double& input : inputs) {
+    input = RandomValue();
+  }
+  ExpectMatches(*plan, &evaluator, inputs);
+  EXPECT_EQ(0u, evaluator.GetIncrementalLayers());
+}
+
+TEST(IncrementalEvaluatorTest, SparseTest) {
+  // With sparse routing, changes should only reach the neurons that they're
+  // connected to.
+  MFNetwork network(kInputs, kOutputs, 16);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  for (uint32_t i = 0; i < kInputs; ++i) {
+    network.SetOutputRoute(0, i, std::vector<int>({static_cast<int>(i % 16)}));
+  }
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+  ASSERT_TRUE(plan->GetLayer(0)->Sparse);
+
+  IncrementalEvaluator evaluator(plan);
+  std::vector<double> inputs(kInputs, 0.5);
+  ExpectMatches(*plan, &evaluator, inputs);
+  for (int tick = 0; tick < 50; ++tick) {
+    inputs[rand() % kInputs] = RandomValue();
+    ExpectMatches(*plan, &evaluator, inputs);
+    // A single change to the first layer is only one change to the second.
+    EXPECT_EQ(2u, evaluator.GetIncrementalLayers());
+  }
+
+  // Nothing changing shouldn't change anything.
+  ExpectMatches(*plan, &evaluator, inputs);
+}
+
+TEST(IncrementalEvaluatorTest, RefreshTest) {
+  // Every so often, everything should be computed from scratch.
+  MFNetwork network(kInputs, kOutputs, 8);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+
+  IncrementalEvaluator evaluator(plan);
+  evaluator.SetRefreshInterval(3);
+  std::vector<double> inputs(kInputs, 0);
+  for (int tick = 0; tick < 9; ++tick) {
+    inputs[tick] = 1;
+    ExpectMatches(*plan, &evaluator, inputs);
+    EXPECT_EQ(tick % 3 ? 1u : 0u, evaluator.GetIncrementalLayers());
+  }
+
+  // After a reset, the next call has to compute everything too.
+  evaluator.Reset();
+  inputs[0] = 0;
+  ExpectMatches(*plan, &evaluator, inputs);
+  EXPECT_EQ(0u, evaluator.GetIncrementalLayers());
+}
+
+TEST(IncrementalEvaluatorTest, NonFiniteTest) {
+  // An input going to infinity and back shouldn't leave the sums broken
+  // until the next refresh.
+  MFNetwork network(kInputs, kOutputs, 16);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.1);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+
+  IncrementalEvaluator evaluator(plan);
+  std::vector<double> inputs(kInputs);
+  for (double& input : inputs) {
+    input = RandomValue();
+  }
+  ExpectMatches(*plan, &evaluator, inputs);
+
+  double outputs [kOutputs];
+  for (double bad : {INFINITY, NAN}) {
+    const double old_input = inputs[5];
+    inputs[5] = bad;
+    ASSERT_TRUE(evaluator.Evaluate(inputs.data(), outputs));
+    inputs[5] = old_input;
+    ExpectMatches(*plan, &evaluator, inputs);
+    ASSERT_TRUE(evaluator.Evaluate(inputs.data(), outputs));
+    for (double output : outputs) {
+      EXPECT_TRUE(std::isfinite(output));
+    }
+    // Once everything is finite again, changes can be added in as usual.
+    inputs[7] = RandomValue();
+    ExpectMatches(*plan, &evaluator, inputs);
+    EXPECT_EQ(1u, evaluator.GetIncrementalLayers());
+  }
+}
+
+} // test
+} // network
@@ -0,0 +1,131 @@
+// Tests for the inference cache.
+
+#include <stdint.h>
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../inference_cache.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+
+namespace network {
+namespace test {
+
+TEST(InferenceCacheTest, LookupTest) {
+  // Outputs should come back only for the same inputs and version.
+  InferenceCache cache(8);
+  const double inputs [] = {1, 2, 3};
+  const double outputs [] = {0.5, -0.5};
+  double found [2];
+  EXPECT_FALSE(cache.Lookup(inputs, 3, 0, found, 2));
+  cache.Insert(inputs, 3, 0, outputs, 2);
+  ASSERT_TRUE(cache.Lookup(inputs, 3, 0, found, 2));
+  EXPECT_EQ(0.5, found[0]);
+  EXPECT_EQ(-0.5, found[1]);
+
+  const double other_inputs [] = {1, 2, 4};
+  EXPECT_FALSE(cache.Lookup(other_inputs, 3, 0, found, 2));
+  EXPECT_FALSE(cache.Lookup(inputs, 3, 1, found, 2));
+  EXPECT_EQ(1u, cache.GetHits());
+  EXPECT_EQ(3u, cache.GetMisses());
+
+  cache.ResetCounters();
+  EXPECT_EQ(0u, cache.GetHits());
+  EXPECT_EQ(0u, cache.GetMisses());
+  cache.Clear();
+  EXPECT_EQ(0u, cache.GetSize());
+  EXPECT_FALSE(cache.Lookup(inputs, 3, 0, found, 2));
+}
+
+TEST(InferenceCacheTest, EvictionTest) {
+  // With a single shard, the least recently used entry should go first.
+  InferenceCache cache(2, 1);
+  const double a = 1, b = 2, c = 3;
+  double found;
+  cache.Insert(&a, 1, 0, &a, 1);
+  cache.Insert(&b, 1, 0, &b, 1);
+  // Using <a> makes <b> the oldest.
+  ASSERT_TRUE(cache.Lookup(&a, 1, 0, &found, 1));
+  cache.Insert(&c, 1, 0, &c, 1);
+  EXPECT_EQ(2u, cache.GetSize());
+  EXPECT_TRUE(cache.Lookup(&a, 1, 0, &found, 1));
+  EXPECT_FALSE(cache.Lookup(&b, 1, 0, &found, 1));
+  EXPECT_TRUE(cache.Lookup(&c, 1, 0, &found, 1));
+  EXPECT_EQ(3.0, found);
+}
+
+TEST(InferenceCacheTest, ConcurrentTest) {
+  // Several threads using the cache at once shouldn't lose anything.
+  InferenceCache cache(1000);
+  std::vector<std::thread> threads;
+  for (int thread_i = 0; thread_i < 4; ++thread_i) {
+    threads.emplace_back([&cache, thread_i]() {
+      for (int i = 0; i < 200; ++i) {
+        const double inputs [] = {static_cast<double>(thread_i),
+                                  static_cast<double>(i)};
+        const double output = thread_i * 1000 + i;
+        cache.Insert(inputs, 2, 0, &output, 1);
+        double found;
+        EXPECT_TRUE(cache.Lookup(inputs, 2, 0, &found, 1));
+        EXPECT_EQ(output, found);
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(800u, cache.GetHits());
+  EXPECT_EQ(0u, cache.GetMisses());
+}
+
+TEST(InferenceCacheTest, NetworkTest) {
+  // The network should use the cache for repeated inputs, and stop using old
+  // entries once it changes.
+  MFNetwork network(3, 2, 4);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  InferenceCache cache(16);
+  network.SetInferenceCache(&cache);
+
+  const double inputs [] = {0.5, 1, -1};
+  double first [2];
+  double second [2];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(first));
+  ASSERT_TRUE(network.GetOutputs(second));
+  EXPECT_EQ(1u, cache.GetHits());
+  EXPECT_EQ(1u, cache.GetMisses());
+  EXPECT_EQ(0, memcmp(first, second, sizeof(first)));
+
+  // Training changes the weights, so the next call has to miss.
+  const double targets [] = {1, 0};
+  ASSERT_TRUE(network.PropagateError(targets));
+  ASSERT_TRUE(network.GetOutputs(second));
+  EXPECT_EQ(2u, cache.GetMisses());
+  EXPECT_NE(0, memcmp(first, second, sizeof(first)));
+
+  // So does setting them directly.
+  const size_t size = network.GetChromosomeSize();
+  uint64_t chromosome [size];
+  ASSERT_TRUE(network.GetChromosome(chromosome));
+  ASSERT_TRUE(network.SetChromosome(chromosome));
+  ASSERT_TRUE(network.GetOutputs(first));
+  EXPECT_EQ(3u, cache.GetMisses());
+
+  // Evaluate() shares the cache once the network is compiled.
+  ASSERT_TRUE(network.Compile());
+  InferenceWorkspace workspace;
+  ASSERT_TRUE(network.Evaluate(inputs, second, &workspace));
+  EXPECT_EQ(2u, cache.GetHits());
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(first[i], second[i], 1e-12);
+  }
+}
+
+} // test
+} // network
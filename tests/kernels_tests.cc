@@ -0,0 +1,328 @@
+// Tests for the SIMD kernels.
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../kernels.h"
+
+namespace network {
+namespace kernels {
+namespace test {
+
+// Sizes that exercise both the vector loops and the scalar tails.
+const size_t kSizes[] = {0, 1, 3, 4, 7, 8, 15, 16, 17, 33, 100};
+
+// Fills a vector with some values between -1 and 1.
+std::vector<double> RandomVector(size_t size) {
+  std::vector<double> values(size);
+  for (double& value : values) {
+    value = (rand() % 2001 - 1000) / 1000.0;
+  }
+  return values;
+}
+
+// Runs a test body once for every instruction set that this CPU supports,
+// and then goes back to the best one.
+class KernelsTest : public ::testing::TestWithParam<InstructionSet> {
+ protected:
+  virtual void SetUp() {
+    if (!SetInstructionSet(GetParam())) {
+      skip_ = true;
+    }
+  }
+  virtual void TearDown() {
+    SetInstructionSet(GetSupportedInstructionSet());
+  }
+
+  bool skip_ = false;
+};
+
+TEST_P(KernelsTest, DotTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> a = RandomVector(size);
+    std::vector<double> b = RandomVector(size);
+    double expected = 0;
+    for (size_t i = 0; i < size; ++i) {
+      expected += a[i] * b[i];
+    }
+    EXPECT_NEAR(expected, Dot(a.data(), b.data(), size), 1e-12);
+  }
+}
+
+TEST_P(KernelsTest, Dot4Test) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> weights = RandomVector(size);
+    std::vector<double> inputs[4];
+    const double *input_pointers[4];
+    double sums[4];
+    for (int k = 0; k < 4; ++k) {
+      inputs[k] = RandomVector(size);
+      input_pointers[k] = inputs[k].data();
+      sums[k] = k;
+    }
+    Dot4(weights.data(), input_pointers, size, sums);
+    for (int k = 0; k < 4; ++k) {
+      double expected = k;
+      for (size_t i = 0; i < size; ++i) {
+        expected += weights[i] * inputs[k][i];
+      }
+      EXPECT_NEAR(expected, sums[k], 1e-12);
+    }
+  }
+}
+
+TEST_P(KernelsTest, FloatDotTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> a = RandomVector(size);
+    std::vector<double> b = RandomVector(size);
+    std::vector<float> a_f(a.begin(), a.end());
+    std::vector<float> b_f(b.begin(), b.end());
+    double expected = 0;
+    for (size_t i = 0; i < size; ++i) {
+      expected += a_f[i] * b_f[i];
+    }
+    EXPECT_NEAR(expected, Dot(a_f.data(), b_f.data(), size), 1e-5);
+  }
+}
+
+TEST_P(KernelsTest, FloatDot4Test) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> weights = RandomVector(size);
+    std::vector<float> weights_f(weights.begin(), weights.end());
+    std::vector<float> inputs[4];
+    const float *input_pointers[4];
+    float sums[4];
+    for (int k = 0; k < 4; ++k) {
+      std::vector<double> input = RandomVector(size);
+      inputs[k].assign(input.begin(), input.end());
+      input_pointers[k] = inputs[k].data();
+      sums[k] = k;
+    }
+    Dot4(weights_f.data(), input_pointers, size, sums);
+    for (int k = 0; k < 4; ++k) {
+      double expected = k;
+      for (size_t i = 0; i < size; ++i) {
+        expected += weights_f[i] * inputs[k][i];
+      }
+      EXPECT_NEAR(expected, sums[k], 1e-5);
+    }
+  }
+}
+
+TEST_P(KernelsTest, DotInt8Test) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<int8_t> a(size);
+    std::vector<int8_t> b(size);
+    int32_t expected = 0;
+    for (size_t i = 0; i < size; ++i) {
+      // Make sure we hit the extremes.
+      a[i] = (i % 5) ? rand() % 255 - 127 : -127;
+      b[i] = (i % 3) ? rand() % 255 - 127 : 127;
+      expected += a[i] * b[i];
+    }
+    EXPECT_EQ(expected, DotInt8(a.data(), b.data(), size));
+  }
+}
+
+TEST_P(KernelsTest, AxpyTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> x = RandomVector(size);
+    std::vector<double> y = RandomVector(size);
+    std::vector<double> expected = y;
+    for (size_t i = 0; i < size; ++i) {
+      expected[i] += 0.5 * x[i];
+    }
+    Axpy(0.5, x.data(), y.data(), size);
+    for (size_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(expected[i], y[i], 1e-15);
+    }
+  }
+}
+
+TEST_P(KernelsTest, FloatAxpyTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> x = RandomVector(size);
+    std::vector<double> y = RandomVector(size);
+    std::vector<float> x_f(x.begin(), x.end());
+    std::vector<float> y_f(y.begin(), y.end());
+    std::vector<float> expected = y_f;
+    for (size_t i = 0; i < size; ++i) {
+      expected[i] += 0.5f * x_f[i];
+    }
+    Axpy(0.5f, x_f.data(), y_f.data(), size);
+    for (size_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(expected[i], y_f[i], 1e-6);
+    }
+  }
+}
+
+TEST_P(KernelsTest, SparseDotTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    // Pick out every third element of a longer vector, like a sparse row
+    // would.
+    std::vector<double> x = RandomVector(size * 3 + 1);
+    std::vector<float> x_f(x.begin(), x.end());
+    std::vector<double> values = RandomVector(size);
+    std::vector<float> values_f(values.begin(), values.end());
+    std::vector<uint32_t> indices(size);
+    double expected = 0;
+    double expected_f = 0;
+    for (size_t i = 0; i < size; ++i) {
+      indices[i] = i * 3 + rand() % 2;
+      expected += values[i] * x[indices[i]];
+      expected_f += values_f[i] * x_f[indices[i]];
+    }
+    EXPECT_NEAR(expected, SparseDot(values.data(), indices.data(), size,
+                                    x.data()), 1e-12);
+    EXPECT_NEAR(expected_f, SparseDot(values_f.data(), indices.data(), size,
+                                      x_f.data()), 1e-5);
+  }
+}
+
+TEST_P(KernelsTest, MomentumUpdateTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> inputs = RandomVector(size);
+    std::vector<double> deltas = RandomVector(size);
+    std::vector<double> weights = RandomVector(size);
+    std::vector<double> expected_deltas(size);
+    std::vector<double> expected_weights(size);
+    for (size_t i = 0; i < size; ++i) {
+      expected_deltas[i] = 0.1 * inputs[i] + 0.5 * deltas[i];
+      expected_weights[i] = weights[i] + expected_deltas[i];
+    }
+    MomentumUpdate(0.1, 0.5, inputs.data(), deltas.data(), weights.data(),
+                   size);
+    for (size_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(expected_deltas[i], deltas[i], 1e-15);
+      EXPECT_NEAR(expected_weights[i], weights[i], 1e-15);
+    }
+  }
+}
+
+TEST_P(KernelsTest, NesterovUpdateTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> inputs = RandomVector(size);
+    std::vector<double> velocities = RandomVector(size);
+    std::vector<double> weights = RandomVector(size);
+    std::vector<double> expected_velocities(size);
+    std::vector<double> expected_weights(size);
+    for (size_t i = 0; i < size; ++i) {
+      expected_velocities[i] = 0.9 * velocities[i] + 0.1 * inputs[i];
+      expected_weights[i] =
+          weights[i] + 0.1 * inputs[i] + 0.9 * expected_velocities[i];
+    }
+    NesterovUpdate(0.1, 0.9, inputs.data(), velocities.data(),
+                   weights.data(), size);
+    for (size_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(expected_velocities[i], velocities[i], 1e-15);
+      EXPECT_NEAR(expected_weights[i], weights[i], 1e-15);
+    }
+  }
+}
+
+TEST_P(KernelsTest, RmsUpdateTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> inputs = RandomVector(size);
+    std::vector<double> squares = RandomVector(size);
+    std::vector<double> weights = RandomVector(size);
+    std::vector<double> expected_squares(size);
+    std::vector<double> expected_weights(size);
+    for (size_t i = 0; i < size; ++i) {
+      // The squares are never negative.
+      squares[i] = fabs(squares[i]);
+      const double gradient = 2 * inputs[i];
+      expected_squares[i] = 0.9 * squares[i] + 0.1 * gradient * gradient;
+      expected_weights[i] = weights[i] + 0.01 * gradient /
+                            (sqrt(expected_squares[i]) + 1e-8);
+    }
+    RmsUpdate(2, 0.9, 0.1, 0.01, 1e-8, inputs.data(), squares.data(),
+              weights.data(), size);
+    for (size_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(expected_squares[i], squares[i], 1e-15);
+      EXPECT_NEAR(expected_weights[i], weights[i], 1e-12);
+    }
+  }
+}
+
+TEST_P(KernelsTest, AdamUpdateTest) {
+  if (skip_) {
+    return;
+  }
+  for (size_t size : kSizes) {
+    std::vector<double> inputs = RandomVector(size);
+    std::vector<double> means = RandomVector(size);
+    std::vector<double> squares = RandomVector(size);
+    std::vector<double> weights = RandomVector(size);
+    std::vector<double> expected_means(size);
+    std::vector<double> expected_squares(size);
+    std::vector<double> expected_weights(size);
+    for (size_t i = 0; i < size; ++i) {
+      squares[i] = fabs(squares[i]);
+      const double gradient = 0.5 * inputs[i];
+      expected_means[i] = 0.9 * means[i] + 0.1 * gradient;
+      expected_squares[i] = 0.999 * squares[i] + 0.001 * gradient * gradient;
+      expected_weights[i] = weights[i] + 0.001 * expected_means[i] /
+                            (sqrt(expected_squares[i]) + 1e-8);
+    }
+    AdamUpdate(0.5, 0.9, 0.999, 0.001, 1e-8, inputs.data(), means.data(),
+               squares.data(), weights.data(), size);
+    for (size_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(expected_means[i], means[i], 1e-15);
+      EXPECT_NEAR(expected_squares[i], squares[i], 1e-15);
+      EXPECT_NEAR(expected_weights[i], weights[i], 1e-12);
+    }
+  }
+}
+
+INSTANTIATE_TEST_CASE_P(InstructionSets, KernelsTest,
+    ::testing::Values(InstructionSet::SCALAR, InstructionSet::SSE2,
+                      InstructionSet::AVX2, InstructionSet::AVX512));
+
+TEST(DispatchTest, PicksBestTest) {
+  // We should start out using the best kernels available.
+  EXPECT_EQ(GetSupportedInstructionSet(), GetInstructionSet());
+  // We should always be able to fall back on the scalar ones.
+  EXPECT_TRUE(SetInstructionSet(InstructionSet::SCALAR));
+  EXPECT_EQ(InstructionSet::SCALAR, GetInstructionSet());
+  EXPECT_TRUE(SetInstructionSet(GetSupportedInstructionSet()));
+}
+
+} // test
+} // kernels
+} // network
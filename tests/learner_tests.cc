@@ -56,5 +56,38 @@ TEST(BasicTests, SineWaveTest) {
   network.GetOutputs(actual);
 }
 
+TEST(BasicTests, MiniBatchTest) {
+  // Training in batches should still fit a simple function.
+  network::MFNetwork network(1, 1, 6);
+  network.AddHiddenLayer();
+  network::Sigmoid sigmoid;
+  network.RandomWeights(-1, 1);
+  network.SetOutputFunctions(&sigmoid);
+  network.SetLearningRate(0.5);
+  SupervisedLearner learner(&network);
+  learner.SetBatchSize(4);
+
+  double inputs [10];
+  double outputs [10];
+  for (int i = 0; i < 10; ++i) {
+    inputs[i] = i / 10.0;
+    outputs[i] = 0.25 + 0.5 * inputs[i];
+    learner.AddTrainingData(&inputs[i], &outputs[i]);
+  }
+  auto get_error = [&]() {
+    double actual [10];
+    EXPECT_TRUE(network.GetOutputsBatch(inputs, 10, actual));
+    double error = 0;
+    for (int i = 0; i < 10; ++i) {
+      error += pow(outputs[i] - actual[i], 2);
+    }
+    return error;
+  };
+
+  const double initial_error = get_error();
+  EXPECT_TRUE(learner.Learn(0.001, 2000));
+  EXPECT_LT(get_error(), initial_error);
+}
+
 } // test
 } // algorithm
@@ -1,12 +1,39 @@
 // Tests for multilayered feedforward network.
 
+#include <math.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <new>
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "../logger.h"
 #include "../multilayered_feedforward.h"
+#include "../multilayered_feedforward_f32.h"
 #include "../output_functions.h"
+#include "../thread_pool.h"
+
+// Counts every allocation made through operator new, so that we can check
+// that inference doesn't allocate anything. (These are kept out of line so
+// that GCC doesn't pair up malloc() and free() with the wrong calls when it
+// inlines them.)
+static size_t g_allocations = 0;
+
+__attribute__((noinline)) void *operator new(size_t size) {
+  ++g_allocations;
+  void *memory = malloc(size ? size : 1);
+  if (!memory) {
+    throw std::bad_alloc();
+  }
+  return memory;
+}
+
+__attribute__((noinline)) void operator delete(void *memory) noexcept {
+  free(memory);
+}
 
 namespace network {
 namespace test {
@@ -145,6 +172,1325 @@ TEST(BackPropagationTests, DecreasingErrorTest) {
   EXPECT_LE(final_error, initial_error);
 }
 
+TEST(CompiledTests, MatchesLayersTest) {
+  // Does a compiled network give the same results as walking the layers?
+  MFNetwork network(3, 2, 6);
+  network.AddHiddenLayer();
+  network.AddHiddenLayer(4);
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.25);
+  Sigmoid sigmoid;
+  TanH tanh;
+  network.SetOutputFunctions(&sigmoid);
+  network.SetLayerOutputFunctions(2, &tanh);
+  // Give it some custom routing too.
+  std::vector<int> routes = {0, 2, 2, 3};
+  network.SetOutputRoute(1, 3, routes);
+
+  MFNetwork compiled(3, 2, 6);
+  compiled.AddHiddenLayer();
+  compiled.AddHiddenLayer(4);
+  compiled.CopyLayout(network);
+  size_t size = network.GetChromosomeSize();
+  ASSERT_GT(size, 0u);
+  uint64_t chromosome [size];
+  ASSERT_TRUE(network.GetChromosome(chromosome));
+  ASSERT_TRUE(compiled.SetChromosome(chromosome));
+  compiled.SetOutputFunctions(&sigmoid);
+  compiled.SetLayerOutputFunctions(2, &tanh);
+  ASSERT_TRUE(compiled.Compile());
+
+  double inputs [] = {0.5, -1.5, 2};
+  double expected [2];
+  double actual [2];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(expected));
+  compiled.SetInputs(inputs);
+  ASSERT_TRUE(compiled.GetOutputs(actual));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-12);
+  }
+
+  // Changing the network should cause the plan to be rebuilt.
+  network.SetLayerBiases(3, -1);
+  compiled.SetLayerBiases(3, -1);
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(expected));
+  ASSERT_TRUE(compiled.GetOutputs(actual));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-12);
+  }
+}
+
+TEST(CompiledTests, BatchTest) {
+  // Does running a batch give the same results as running each sample?
+  MFNetwork network(2, 3, 5);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-2, 2);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+
+  // Use an odd number of samples so that not everything fits into a block.
+  constexpr size_t kSamples = 7;
+  double inputs [kSamples * 2];
+  for (size_t i = 0; i < kSamples * 2; ++i) {
+    inputs[i] = 0.3 * i - 1;
+  }
+  double batch_outputs [kSamples * 3];
+  ASSERT_TRUE(network.GetOutputsBatch(inputs, kSamples, batch_outputs));
+
+  for (size_t i = 0; i < kSamples; ++i) {
+    double outputs [3];
+    network.SetInputs(inputs + i * 2);
+    ASSERT_TRUE(network.GetOutputs(outputs));
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR(outputs[j], batch_outputs[i * 3 + j], 1e-12);
+    }
+  }
+}
+
+TEST(CompiledTests, LargeBatchTest) {
+  // Big batches get run in chunks, which shouldn't change the results, and
+  // the workspace shouldn't have to grow to fit the whole batch.
+  MFNetwork network(2, 3, 5);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-2, 2);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+
+  constexpr size_t kSamples = 1000;
+  std::vector<double> inputs(kSamples * 2);
+  for (size_t i = 0; i < kSamples * 2; ++i) {
+    inputs[i] = ((i * 7919) % 200) / 100.0 - 1;
+  }
+  std::vector<double> batch_outputs(kSamples * 3);
+  ASSERT_TRUE(network.GetOutputsBatch(inputs.data(), 300,
+                                      batch_outputs.data()));
+  const size_t allocations = g_allocations;
+  ASSERT_TRUE(network.GetOutputsBatch(inputs.data(), kSamples,
+                                      batch_outputs.data()));
+  EXPECT_EQ(allocations, g_allocations);
+
+  for (size_t i = 0; i < kSamples; ++i) {
+    double outputs [3];
+    network.SetInputs(&inputs[i * 2]);
+    ASSERT_TRUE(network.GetOutputs(outputs));
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR(outputs[j], batch_outputs[i * 3 + j], 1e-12);
+    }
+  }
+}
+
+TEST(CompiledTests, NoAllocationTest) {
+  // Once it's warmed up, a compiled network should not allocate any memory to
+  // compute outputs.
+  MFNetwork network(4, 2, 16);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  ASSERT_TRUE(network.Compile());
+
+  double inputs [8] = {0.1, 0.2, 0.3, 0.4, -0.1, -0.2, -0.3, -0.4};
+  double outputs [4];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(outputs));
+  ASSERT_TRUE(network.GetOutputsBatch(inputs, 2, outputs));
+
+  const size_t allocations = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    network.SetInputs(inputs + (i % 2) * 4);
+    network.GetOutputs(outputs);
+    network.GetOutputsBatch(inputs, 2, outputs);
+  }
+  EXPECT_EQ(allocations, g_allocations);
+}
+
+TEST(CompiledTests, BackPropNoAllocationTest) {
+  // Training one sample at a time shouldn't allocate any memory either, even
+  // when the weights of a sparse layer change.
+  MFNetwork network(2, 3, 20);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  for (int i = 0; i < 20; ++i) {
+    network.SetOutputRoute(1, i, std::vector<int>({i, (i * 7 + 3) % 20}));
+  }
+  ASSERT_TRUE(network.Compile());
+  ASSERT_TRUE(network.GetExecutionPlan()->GetLayer(1)->Sparse);
+
+  double inputs [6] = {0.1, 0.2, 0.3, -0.1, -0.2, -0.3};
+  double targets [2] = {0.2, 0.8};
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.PropagateError(targets));
+
+  const size_t allocations = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    network.SetInputs(inputs + (i % 2) * 3);
+    network.PropagateError(targets);
+  }
+  EXPECT_EQ(allocations, g_allocations);
+}
+
+TEST(CompiledTests, ThreadPoolNoAllocationTest) {
+  // Splitting layers across a thread pool shouldn't allocate anything either.
+  helpers::ThreadPool pool(3);
+  MFNetwork network(4, 2, 40);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  network.SetThreadPool(&pool, 8);
+  ASSERT_TRUE(network.Compile());
+
+  double inputs [8] = {0.1, 0.2, 0.3, 0.4, -0.1, -0.2, -0.3, -0.4};
+  double outputs [4];
+  double targets [4] = {0.2, 0.8, 0.8, 0.2};
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(outputs));
+  ASSERT_TRUE(network.GetOutputsBatch(inputs, 2, outputs));
+  ASSERT_TRUE(network.PropagateError(targets));
+
+  const size_t allocations = g_allocations;
+  for (int i = 0; i < 100; ++i) {
+    network.SetInputs(inputs + (i % 2) * 4);
+    network.GetOutputs(outputs);
+    network.GetOutputsBatch(inputs, 2, outputs);
+    network.PropagateError(targets + (i % 2) * 2);
+  }
+  EXPECT_EQ(allocations, g_allocations);
+}
+
+TEST(CompiledTests, ConcurrentEvaluateTest) {
+  // Can several threads use the same compiled network at once?
+  MFNetwork network(3, 2, 32);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+
+  // It shouldn't work until the network is compiled.
+  InferenceWorkspace workspace;
+  double inputs [3] = {0.1, 0.2, 0.3};
+  double outputs [2];
+  EXPECT_FALSE(network.Evaluate(inputs, outputs, &workspace));
+  ASSERT_TRUE(network.Compile());
+
+  // Get the answers we expect with one thread first.
+  constexpr int kSamples = 200;
+  std::vector<double> all_inputs(kSamples * 3);
+  std::vector<double> expected(kSamples * 2);
+  for (int i = 0; i < kSamples * 3; ++i) {
+    all_inputs[i] = (i % 17) / 8.0 - 1;
+  }
+  for (int i = 0; i < kSamples; ++i) {
+    ASSERT_TRUE(network.Evaluate(&all_inputs[i * 3], &expected[i * 2],
+                                 &workspace));
+  }
+
+  constexpr int kThreads = 4;
+  std::vector<int> mismatches(kThreads, 0);
+  std::vector<std::thread> threads;
+  for (int thread_i = 0; thread_i < kThreads; ++thread_i) {
+    threads.emplace_back([&, thread_i]() {
+      InferenceWorkspace thread_workspace;
+      for (int pass = 0; pass < 20; ++pass) {
+        for (int i = 0; i < kSamples; ++i) {
+          double thread_outputs [2];
+          if (!network.Evaluate(&all_inputs[i * 3], thread_outputs,
+                                &thread_workspace) ||
+              thread_outputs[0] != expected[i * 2] ||
+              thread_outputs[1] != expected[i * 2 + 1]) {
+            ++mismatches[thread_i];
+          }
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int count : mismatches) {
+    EXPECT_EQ(0, count);
+  }
+
+  // Changing the network should stop it from working until it's recompiled.
+  network.SetBiases(1);
+  EXPECT_FALSE(network.Evaluate(inputs, outputs, &workspace));
+  ASSERT_TRUE(network.Compile());
+  EXPECT_TRUE(network.Evaluate(inputs, outputs, &workspace));
+}
+
+TEST(BackPropagationTests, BatchTest) {
+  // A batch of the same sample twice should have the same average gradient
+  // as that sample alone, so it should change the weights exactly like
+  // PropagateError() does. This includes a sparse layer.
+  MFNetwork single(3, 2, 20);
+  single.AddHiddenLayers(2);
+  single.RandomWeights(-1, 1);
+  single.SetMomentum(0);
+  TanH tanh;
+  single.SetOutputFunctions(&tanh);
+  for (int i = 0; i < 20; ++i) {
+    single.SetOutputRoute(1, i, std::vector<int>({i, (i * 7 + 3) % 20}));
+  }
+  ASSERT_TRUE(single.ForceWeightUpdate());
+
+  MFNetwork batched(3, 2, 20);
+  batched.AddHiddenLayers(2);
+  batched.CopyLayout(single);
+  const size_t size = single.GetChromosomeSize();
+  std::vector<uint64_t> chromosome(size);
+  ASSERT_TRUE(single.GetChromosome(chromosome.data()));
+  ASSERT_TRUE(batched.SetChromosome(chromosome.data()));
+  batched.SetMomentum(0);
+  batched.SetOutputFunctions(&tanh);
+  const ExecutionPlan *plan = batched.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+  EXPECT_TRUE(plan->GetLayer(1)->Sparse);
+
+  const double inputs [6] = {0.5, -0.25, 1, 0.5, -0.25, 1};
+  const double targets [4] = {0.3, -0.6, 0.3, -0.6};
+  for (int i = 0; i < 5; ++i) {
+    single.SetInputs(inputs);
+    ASSERT_TRUE(single.PropagateError(targets));
+    ASSERT_TRUE(batched.PropagateErrorBatch(inputs, targets, 2));
+  }
+
+  std::vector<uint64_t> expected(size);
+  std::vector<uint64_t> actual(size);
+  ASSERT_TRUE(single.GetChromosome(expected.data()));
+  ASSERT_TRUE(batched.GetChromosome(actual.data()));
+  for (size_t i = 0; i < size; ++i) {
+    double expected_weight, actual_weight;
+    memcpy(&expected_weight, &expected[i], sizeof(expected_weight));
+    memcpy(&actual_weight, &actual[i], sizeof(actual_weight));
+    EXPECT_NEAR(expected_weight, actual_weight, 1e-12);
+  }
+
+  // The plan gets updated in place, so it should agree with the layers.
+  double expected_outputs [2];
+  double actual_outputs [2];
+  single.SetInputs(inputs);
+  ASSERT_TRUE(single.GetOutputs(expected_outputs));
+  ASSERT_TRUE(batched.GetOutputsBatch(inputs, 1, actual_outputs));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected_outputs[i], actual_outputs[i], 1e-12);
+  }
+}
+
+TEST(BackPropagationTests, BatchDecreasingErrorTest) {
+  // Training on batches of different samples should bring the error down.
+  MFNetwork network(2, 1, 8);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  network.SetLearningRate(0.5);
+
+  constexpr size_t kSamples = 8;
+  double inputs [kSamples * 2];
+  double targets [kSamples];
+  for (size_t i = 0; i < kSamples; ++i) {
+    inputs[i * 2] = i / 8.0;
+    inputs[i * 2 + 1] = 1 - i / 8.0;
+    targets[i] = 0.2 + 0.6 * (i % 2);
+  }
+  auto get_error = [&]() {
+    double outputs [kSamples];
+    EXPECT_TRUE(network.GetOutputsBatch(inputs, kSamples, outputs));
+    double error = 0;
+    for (size_t i = 0; i < kSamples; ++i) {
+      error += (targets[i] - outputs[i]) * (targets[i] - outputs[i]);
+    }
+    return error;
+  };
+
+  const double initial_error = get_error();
+  for (int i = 0; i < 200; ++i) {
+    ASSERT_TRUE(network.PropagateErrorBatch(inputs, targets, kSamples));
+  }
+  EXPECT_LT(get_error(), initial_error);
+}
+
+TEST(BackPropagationTests, DataParallelBatchTest) {
+  // Splitting batches across threads should give the same weights every
+  // time, and the same weights as one thread, up to rounding.
+  constexpr int kNetworks = 3;
+  MFNetwork *networks [kNetworks];
+  helpers::ThreadPool pool(3);
+  Sigmoid sigmoid;
+  std::vector<uint64_t> chromosome;
+  for (int i = 0; i < kNetworks; ++i) {
+    networks[i] = new MFNetwork(5, 3, 24);
+    networks[i]->AddHiddenLayers(2);
+    networks[i]->SetOutputFunctions(&sigmoid);
+    if (!i) {
+      networks[i]->RandomWeights(-1, 1);
+      ASSERT_TRUE(networks[i]->ForceWeightUpdate());
+      chromosome.resize(networks[i]->GetChromosomeSize());
+      ASSERT_TRUE(networks[i]->GetChromosome(chromosome.data()));
+    } else {
+      ASSERT_TRUE(networks[i]->SetChromosome(chromosome.data()));
+      // Small enough that the layers get split up too.
+      networks[i]->SetThreadPool(&pool, 8);
+    }
+  }
+
+  constexpr size_t kSamples = 37;
+  std::vector<double> inputs(kSamples * 5);
+  std::vector<double> targets(kSamples * 3);
+  for (size_t i = 0; i < inputs.size(); ++i) {
+    inputs[i] = ((i * 7919) % 100) / 50.0 - 1;
+  }
+  for (size_t i = 0; i < targets.size(); ++i) {
+    targets[i] = ((i * 104729) % 100) / 100.0;
+  }
+  for (int step = 0; step < 10; ++step) {
+    for (MFNetwork *network : networks) {
+      ASSERT_TRUE(network->PropagateErrorBatch(inputs.data(), targets.data(),
+                                               kSamples));
+    }
+  }
+
+  std::vector<std::vector<uint64_t> > weights(kNetworks,
+      std::vector<uint64_t>(chromosome.size()));
+  for (int i = 0; i < kNetworks; ++i) {
+    ASSERT_TRUE(networks[i]->GetChromosome(weights[i].data()));
+  }
+  EXPECT_EQ(weights[1], weights[2]);
+  for (size_t i = 0; i < chromosome.size(); ++i) {
+    double expected, actual;
+    memcpy(&expected, &weights[0][i], sizeof(expected));
+    memcpy(&actual, &weights[1][i], sizeof(actual));
+    EXPECT_NEAR(expected, actual, 1e-12);
+  }
+
+  for (MFNetwork *network : networks) {
+    delete network;
+  }
+}
+
+TEST(BackPropagationTests, AsyncTest) {
+  // With only one thread, asynchronous training should do exactly what
+  // PropagateError() does without momentum. This includes a sparse layer.
+  MFNetwork single(3, 2, 20);
+  single.AddHiddenLayers(2);
+  single.RandomWeights(-1, 1);
+  single.SetMomentum(0);
+  TanH tanh;
+  single.SetOutputFunctions(&tanh);
+  for (int i = 0; i < 20; ++i) {
+    single.SetOutputRoute(1, i, std::vector<int>({i, (i * 7 + 3) % 20}));
+  }
+  ASSERT_TRUE(single.ForceWeightUpdate());
+
+  MFNetwork async(3, 2, 20);
+  async.AddHiddenLayers(2);
+  async.CopyLayout(single);
+  const size_t size = single.GetChromosomeSize();
+  std::vector<uint64_t> chromosome(size);
+  ASSERT_TRUE(single.GetChromosome(chromosome.data()));
+  ASSERT_TRUE(async.SetChromosome(chromosome.data()));
+  async.SetOutputFunctions(&tanh);
+  const ExecutionPlan *plan = async.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+  EXPECT_TRUE(plan->GetLayer(1)->Sparse);
+
+  const double inputs [9] = {0.5, -0.25, 1, 0, 0.75, -1, 0.1, 0, 0};
+  const double targets [6] = {0.3, -0.6, 0.9, 0, -0.2, 0.4};
+  for (int i = 0; i < 3; ++i) {
+    for (int j = 0; j < 3; ++j) {
+      single.SetInputs(inputs + j * 3);
+      ASSERT_TRUE(single.PropagateError(targets + j * 2));
+    }
+    ASSERT_TRUE(async.PropagateErrorAsync(inputs, targets, 3));
+  }
+
+  std::vector<uint64_t> expected(size);
+  std::vector<uint64_t> actual(size);
+  ASSERT_TRUE(single.GetChromosome(expected.data()));
+  ASSERT_TRUE(async.GetChromosome(actual.data()));
+  for (size_t i = 0; i < size; ++i) {
+    double expected_weight, actual_weight;
+    memcpy(&expected_weight, &expected[i], sizeof(expected_weight));
+    memcpy(&actual_weight, &actual[i], sizeof(actual_weight));
+    EXPECT_NEAR(expected_weight, actual_weight, 1e-12);
+  }
+
+  // The plan should still agree with the layers.
+  double expected_outputs [2];
+  double actual_outputs [2];
+  single.SetInputs(inputs);
+  ASSERT_TRUE(single.GetOutputs(expected_outputs));
+  ASSERT_TRUE(async.GetOutputsBatch(inputs, 1, actual_outputs));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected_outputs[i], actual_outputs[i], 1e-12);
+  }
+}
+
+TEST(BackPropagationTests, AsyncKeepsMomentumTest) {
+  // Asynchronous training shouldn't throw away the momentum built up by
+  // PropagateError(). With a learning rate of zero, it doesn't move anything,
+  // so training afterwards should go exactly as if it never happened.
+  MFNetwork network(2, 1, 4);
+  network.AddHiddenLayer();
+  network.SetWeights(0);
+  std::vector<uint64_t> chromosome(network.GetChromosomeSize());
+  for (size_t i = 0; i < chromosome.size(); ++i) {
+    double weight = ((i * 7919) % 200) / 100.0 - 1;
+    memcpy(&chromosome[i], &weight, sizeof(weight));
+  }
+  MFNetwork async(2, 1, 4);
+  async.AddHiddenLayer();
+  ASSERT_TRUE(network.SetChromosome(chromosome.data()));
+  ASSERT_TRUE(async.SetChromosome(chromosome.data()));
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  async.SetOutputFunctions(&sigmoid);
+
+  const double inputs [2] = {0.5, -0.25};
+  const double target = 0.9;
+  for (MFNetwork *trained : {&network, &async}) {
+    trained->SetInputs(inputs);
+    ASSERT_TRUE(trained->PropagateError(&target));
+  }
+  async.SetLearningRate(0);
+  ASSERT_TRUE(async.PropagateErrorAsync(inputs, &target, 1));
+  async.SetLearningRate(0.01);
+  for (MFNetwork *trained : {&network, &async}) {
+    trained->SetInputs(inputs);
+    ASSERT_TRUE(trained->PropagateError(&target));
+  }
+
+  std::vector<uint64_t> expected(chromosome.size());
+  std::vector<uint64_t> actual(chromosome.size());
+  ASSERT_TRUE(network.GetChromosome(expected.data()));
+  ASSERT_TRUE(async.GetChromosome(actual.data()));
+  for (size_t i = 0; i < chromosome.size(); ++i) {
+    double expected_weight, actual_weight;
+    memcpy(&expected_weight, &expected[i], sizeof(expected_weight));
+    memcpy(&actual_weight, &actual[i], sizeof(actual_weight));
+    EXPECT_NEAR(expected_weight, actual_weight, 1e-12);
+  }
+}
+
+TEST(BackPropagationTests, AsyncThreadsTest) {
+  // Several threads training at once on sparse inputs should still bring
+  // the error down, and leave the neurons agreeing with the plan.
+  MFNetwork network(32, 2, 16);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  network.SetLearningRate(0.2);
+  helpers::ThreadPool pool(3);
+  network.SetThreadPool(&pool);
+
+  // Each sample has two of the inputs on.
+  constexpr size_t kSamples = 64;
+  std::vector<double> inputs(kSamples * 32, 0);
+  std::vector<double> targets(kSamples * 2);
+  for (size_t i = 0; i < kSamples; ++i) {
+    inputs[i * 32 + i % 32] = 1;
+    inputs[i * 32 + (i * 5 + 1) % 32] = 1;
+    targets[i * 2] = (i % 3) ? 0.8 : 0.2;
+    targets[i * 2 + 1] = (i % 2) ? 0.3 : 0.7;
+  }
+  auto get_error = [&]() {
+    std::vector<double> outputs(kSamples * 2);
+    EXPECT_TRUE(network.GetOutputsBatch(inputs.data(), kSamples,
+                                        outputs.data()));
+    double error = 0;
+    for (size_t i = 0; i < outputs.size(); ++i) {
+      error += (targets[i] - outputs[i]) * (targets[i] - outputs[i]);
+    }
+    return error;
+  };
+
+  const double initial_error = get_error();
+  for (int i = 0; i < 50; ++i) {
+    ASSERT_TRUE(network.PropagateErrorAsync(inputs.data(), targets.data(),
+                                            kSamples));
+  }
+  EXPECT_LT(get_error(), initial_error);
+
+  // Walking the layers uses the weights in the neurons.
+  double expected [2];
+  double actual [2];
+  network.SetInputs(inputs.data());
+  ASSERT_TRUE(network.GetOutputs(expected));
+  ASSERT_TRUE(network.GetOutputsBatch(inputs.data(), 1, actual));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-12);
+  }
+}
+
+TEST(BackPropagationTests, MomentumOptimizerTest) {
+  // Without any momentum, the Momentum optimizer should move the weights
+  // exactly like the default does, both one sample at a time and in batches.
+  Sigmoid sigmoid;
+  Momentum optimizer(0.3, 0);
+  MFNetwork networks [2] = {{3, 2, 6}, {3, 2, 6}};
+  std::vector<uint64_t> chromosome;
+  for (int i = 0; i < 2; ++i) {
+    networks[i].AddHiddenLayer();
+    networks[i].SetOutputFunctions(&sigmoid);
+    networks[i].SetLearningRate(0.3);
+    networks[i].SetMomentum(0);
+    if (!i) {
+      networks[i].RandomWeights(-1, 1);
+      ASSERT_TRUE(networks[i].ForceWeightUpdate());
+      chromosome.resize(networks[i].GetChromosomeSize());
+      ASSERT_TRUE(networks[i].GetChromosome(chromosome.data()));
+    } else {
+      ASSERT_TRUE(networks[i].SetChromosome(chromosome.data()));
+      networks[i].SetOptimizer(&optimizer);
+    }
+  }
+
+  constexpr size_t kSamples = 5;
+  std::vector<double> inputs(kSamples * 3);
+  std::vector<double> targets(kSamples * 2);
+  for (double& input : inputs) {
+    input = (rand() % 1000) / 1000.0;
+  }
+  for (double& target : targets) {
+    target = (rand() % 1000) / 1000.0;
+  }
+  for (MFNetwork& network : networks) {
+    for (size_t i = 0; i < kSamples; ++i) {
+      network.SetInputs(&inputs[i * 3]);
+      ASSERT_TRUE(network.PropagateError(&targets[i * 2]));
+    }
+    ASSERT_TRUE(network.PropagateErrorBatch(inputs.data(), targets.data(),
+                                            kSamples));
+  }
+
+  double outputs [2][kSamples * 2];
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(networks[i].GetOutputsBatch(inputs.data(), kSamples,
+                                            outputs[i]));
+  }
+  for (size_t i = 0; i < kSamples * 2; ++i) {
+    EXPECT_EQ(outputs[0][i], outputs[1][i]);
+  }
+}
+
+TEST(BackPropagationTests, OptimizersDecreaseErrorTest) {
+  // Training with any of the optimizers, one sample at a time or in batches,
+  // should bring the error down.
+  Nesterov nesterov(0.1);
+  Adagrad adagrad(0.1);
+  RmsProp rms_prop(0.01);
+  Adam adam(0.01);
+  Optimizer *optimizers[] = {&nesterov, &adagrad, &rms_prop, &adam};
+
+  constexpr size_t kSamples = 8;
+  double inputs [kSamples * 2];
+  double targets [kSamples];
+  for (size_t i = 0; i < kSamples; ++i) {
+    inputs[i * 2] = i / 8.0;
+    inputs[i * 2 + 1] = 1 - i / 8.0;
+    targets[i] = 0.2 + 0.6 * i / 8.0;
+  }
+  Sigmoid sigmoid;
+  for (Optimizer *optimizer : optimizers) {
+    for (bool batch : {false, true}) {
+      // Start from the same weights every time, so that the results don't
+      // depend on luck.
+      MFNetwork network(2, 1, 8);
+      network.AddHiddenLayer();
+      network.SetWeights(0);
+      std::vector<uint64_t> chromosome(network.GetChromosomeSize());
+      for (size_t i = 0; i < chromosome.size(); ++i) {
+        double weight = ((i * 7919) % 200) / 100.0 - 1;
+        memcpy(&chromosome[i], &weight, sizeof(weight));
+      }
+      ASSERT_TRUE(network.SetChromosome(chromosome.data()));
+      network.SetOutputFunctions(&sigmoid);
+      network.SetOptimizer(optimizer);
+      auto get_error = [&]() {
+        double outputs [kSamples];
+        EXPECT_TRUE(network.GetOutputsBatch(inputs, kSamples, outputs));
+        double error = 0;
+        for (size_t i = 0; i < kSamples; ++i) {
+          error += (targets[i] - outputs[i]) * (targets[i] - outputs[i]);
+        }
+        return error;
+      };
+
+      const double initial_error = get_error();
+      for (int i = 0; i < 100; ++i) {
+        if (batch) {
+          ASSERT_TRUE(network.PropagateErrorBatch(inputs, targets, kSamples));
+        } else {
+          for (size_t sample_i = 0; sample_i < kSamples; ++sample_i) {
+            network.SetInputs(&inputs[sample_i * 2]);
+            ASSERT_TRUE(network.PropagateError(&targets[sample_i]));
+          }
+        }
+      }
+      EXPECT_LT(get_error(), initial_error / 2);
+    }
+  }
+}
+
+TEST(BackPropagationTests, OptimizerStateTest) {
+  // The optimizer's state should carry over from one sample to the next, and
+  // start over when the optimizer gets set again.
+  Sigmoid sigmoid;
+  Adam adam(0.1);
+  MFNetwork networks [2] = {{2, 1, 4}, {2, 1, 4}};
+  std::vector<uint64_t> chromosome;
+  for (int i = 0; i < 2; ++i) {
+    networks[i].AddHiddenLayer();
+    networks[i].SetOutputFunctions(&sigmoid);
+    if (!i) {
+      networks[i].RandomWeights(-1, 1);
+      ASSERT_TRUE(networks[i].ForceWeightUpdate());
+      chromosome.resize(networks[i].GetChromosomeSize());
+      ASSERT_TRUE(networks[i].GetChromosome(chromosome.data()));
+    } else {
+      ASSERT_TRUE(networks[i].SetChromosome(chromosome.data()));
+    }
+    networks[i].SetOptimizer(&adam);
+  }
+
+  const double inputs [2][2] = {{0.2, 0.9}, {0.7, 0.1}};
+  const double targets [2] = {0.9, 0.1};
+  for (int i = 0; i < 2; ++i) {
+    for (int sample_i = 0; sample_i < 2; ++sample_i) {
+      if (i && sample_i) {
+        networks[i].SetOptimizer(&adam);
+      }
+      networks[i].SetInputs(inputs[sample_i]);
+      ASSERT_TRUE(networks[i].PropagateError(&targets[sample_i]));
+    }
+  }
+
+  double outputs [2];
+  for (int i = 0; i < 2; ++i) {
+    networks[i].SetInputs(inputs[0]);
+    ASSERT_TRUE(networks[i].GetOutputs(&outputs[i]));
+  }
+  EXPECT_NE(outputs[0], outputs[1]);
+}
+
+TEST(CompiledTests, ThreadPoolTest) {
+  // Splitting up layers across threads shouldn't change any results.
+  MFNetwork network(4, 3, 40);
+  MFNetwork parallel(4, 3, 40);
+  network.AddHiddenLayers(2);
+  parallel.AddHiddenLayers(2);
+  network.SetWeights(0);
+  size_t size = network.GetChromosomeSize();
+  ASSERT_GT(size, 0u);
+  std::vector<uint64_t> chromosome(size);
+  for (size_t i = 0; i < size; ++i) {
+    double weight = ((i * 7919) % 200) / 100.0 - 1;
+    memcpy(&chromosome[i], &weight, sizeof(weight));
+  }
+  ASSERT_TRUE(network.SetChromosome(chromosome.data()));
+  ASSERT_TRUE(parallel.SetChromosome(chromosome.data()));
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  parallel.SetOutputFunctions(&sigmoid);
+  helpers::ThreadPool pool(3);
+  parallel.SetThreadPool(&pool, 8);
+
+  // Back propagation first.
+  const double inputs [4] = {0.5, -0.25, 1, 0};
+  const double targets [3] = {0.1, 0.9, 0.5};
+  for (int i = 0; i < 5; ++i) {
+    network.SetInputs(inputs);
+    parallel.SetInputs(inputs);
+    ASSERT_TRUE(network.PropagateError(targets));
+    ASSERT_TRUE(parallel.PropagateError(targets));
+  }
+  std::vector<uint64_t> expected(size);
+  std::vector<uint64_t> actual(size);
+  ASSERT_TRUE(network.GetChromosome(expected.data()));
+  ASSERT_TRUE(parallel.GetChromosome(actual.data()));
+  EXPECT_EQ(expected, actual);
+
+  // Then compiled outputs.
+  ASSERT_TRUE(network.Compile());
+  ASSERT_TRUE(parallel.Compile());
+  double expected_outputs [6];
+  double actual_outputs [6];
+  const double batch [8] = {0.5, -0.25, 1, 0, 1, 2, 3, 4};
+  ASSERT_TRUE(network.GetOutputsBatch(batch, 2, expected_outputs));
+  ASSERT_TRUE(parallel.GetOutputsBatch(batch, 2, actual_outputs));
+  for (int i = 0; i < 6; ++i) {
+    EXPECT_EQ(expected_outputs[i], actual_outputs[i]);
+  }
+  ASSERT_TRUE(network.GetOutputs(expected_outputs));
+  ASSERT_TRUE(parallel.GetOutputs(actual_outputs));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(expected_outputs[i], actual_outputs[i]);
+  }
+}
+
+// An impulse function that the library doesn't know about.
+class Square : public ImpulseFunction {
+ public:
+  virtual double Function(double input) {
+    return input * input;
+  }
+};
+
+TEST(CompiledTests, CustomImpulseTest) {
+  // User-defined impulse functions should still work once compiled.
+  MFNetwork network(2, 2, 3);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  Square square;
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&sigmoid);
+  network.SetLayerOutputFunctions(1, &square);
+
+  const double inputs [2] = {0.3, -0.7};
+  double expected [2];
+  double actual [2];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(expected));
+  ASSERT_TRUE(network.Compile());
+  ASSERT_TRUE(network.GetOutputs(actual));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-12);
+  }
+}
+
+// A subclass of a built-in impulse function that changes what it does.
+class ScaledSigmoid : public Sigmoid {
+ public:
+  virtual double Function(double input) {
+    return 2 * Sigmoid::Function(input) - 1;
+  }
+};
+
+TEST(CompiledTests, DerivedImpulseTest) {
+  // Subclasses of the built-in impulse functions shouldn't get swapped for
+  // the built-in ones once compiled.
+  ScaledSigmoid scaled;
+  EXPECT_EQ(ImpulseType::CUSTOM, scaled.GetType());
+
+  MFNetwork network(2, 2, 3);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetOutputFunctions(&scaled);
+
+  const double inputs [2] = {0.3, -0.7};
+  double expected [2];
+  double actual [2];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(expected));
+  ASSERT_TRUE(network.Compile());
+  ASSERT_TRUE(network.GetOutputs(actual));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-12);
+  }
+}
+
+TEST(CompiledTests, ImpulseAccuracyTest) {
+  // Approximate activations should only change the compiled outputs slightly.
+  MFNetwork network(3, 2, 8);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  TanH tanh;
+  Sigmoid sigmoid;
+  network.SetLayerOutputFunctions(1, &tanh);
+  network.SetOutputFunctions(&sigmoid);
+  EXPECT_FALSE(network.SetLayerImpulseAccuracy(0, ImpulseAccuracy::TABLE));
+  EXPECT_FALSE(network.SetLayerImpulseAccuracy(3, ImpulseAccuracy::TABLE));
+
+  const double inputs [3] = {0.3, -0.7, 0.9};
+  double expected [2];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(expected));
+  ASSERT_TRUE(network.Compile());
+
+  const ImpulseAccuracy accuracies[] = {ImpulseAccuracy::RATIONAL,
+                                        ImpulseAccuracy::TABLE};
+  for (ImpulseAccuracy accuracy : accuracies) {
+    ASSERT_TRUE(network.SetLayerImpulseAccuracy(1, accuracy));
+    ASSERT_TRUE(network.SetLayerImpulseAccuracy(2, accuracy));
+    double actual [2];
+    ASSERT_TRUE(network.GetOutputs(actual));
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-5);
+    }
+  }
+}
+
+TEST(CompiledTests, XorTest) {
+  // The XOR network from above, but compiled.
+  MFNetwork network (2, 1, 3);
+  network.AddHiddenLayer();
+  Threshold threshold1(1);
+  Threshold threshold2(2);
+  DumbOutputer dumboutputer;
+  network.SetOutputFunctions(&dumboutputer);
+  network.SetLayerOutputFunctions(1, &threshold1);
+  network.GetNeuron(1, 1)->SetOutputFunction(&threshold2);
+  std::vector<double> out_weights = {1, -2, 1};
+  std::vector<double> weights = {1};
+  network.SetLayerWeights(1, weights);
+  network.SetLayerWeights(2, out_weights);
+  weights.push_back(1);
+  network.GetNeuron(1, 1)->SetWeights(weights);
+  network.SetOutputRoute(0, 0, std::vector<int>({0, 1}));
+  network.SetOutputRoute(0, 1, std::vector<int>({1, 2}));
+  ASSERT_TRUE(network.Compile());
+
+  const double cases [4][3] = {{1, 0, 1}, {0, 1, 1}, {0, 0, 0}, {1, 1, 0}};
+  for (const auto& item : cases) {
+    double out [1];
+    network.SetInputs(item);
+    EXPECT_TRUE(network.GetOutputs(out));
+    EXPECT_EQ(item[2], out[0]);
+  }
+}
+
+TEST(CompiledTests, SparseLayerTest) {
+  // A sparsely connected layer should be run as a sparse matrix, and give the
+  // same results as the layers themselves.
+  MFNetwork network(3, 2, 20);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.25);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+  // Connect each neuron in the first hidden layer to two in the second.
+  for (int i = 0; i < 20; ++i) {
+    network.SetOutputRoute(1, i, std::vector<int>({i, (i * 7 + 3) % 20}));
+  }
+
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+  EXPECT_FALSE(plan->GetLayer(0)->Sparse);
+  EXPECT_TRUE(plan->GetLayer(1)->Sparse);
+  EXPECT_EQ(40u, plan->GetLayer(1)->Connections.size());
+
+  constexpr size_t kSamples = 5;
+  double inputs [kSamples * 3];
+  for (size_t i = 0; i < kSamples * 3; ++i) {
+    inputs[i] = 0.2 * i - 1;
+  }
+  double batch_outputs [kSamples * 2];
+  ASSERT_TRUE(network.GetOutputsBatch(inputs, kSamples, batch_outputs));
+
+  InferenceWorkspace workspace;
+  for (size_t i = 0; i < kSamples; ++i) {
+    double expected [2];
+    double actual [2];
+    network.SetInputs(inputs + i * 3);
+    ASSERT_TRUE(network.GetOutputs(expected));
+    ASSERT_TRUE(plan->Run(inputs + i * 3, actual, &workspace));
+    for (int j = 0; j < 2; ++j) {
+      EXPECT_NEAR(expected[j], actual[j], 1e-12);
+      EXPECT_NEAR(expected[j], batch_outputs[i * 2 + j], 1e-12);
+    }
+  }
+}
+
+TEST(CompiledTests, SparseInputTest) {
+  // Giving only the nonzero inputs should give the same results as giving all
+  // of them, whether or not the first layer is sparse.
+  const uint32_t indices [] = {3, 17, 40};
+  const double values [] = {1, -0.5, 2};
+  double dense_inputs [50] = {};
+  for (int i = 0; i < 3; ++i) {
+    dense_inputs[indices[i]] = values[i];
+  }
+
+  for (int sparse_layer = 0; sparse_layer < 2; ++sparse_layer) {
+    MFNetwork network(50, 2, 10);
+    network.AddHiddenLayer();
+    network.RandomWeights(-1, 1);
+    network.SetBiases(0.25);
+    Sigmoid sigmoid;
+    network.SetOutputFunctions(&sigmoid);
+    if (sparse_layer) {
+      for (int i = 0; i < 50; ++i) {
+        network.SetOutputRoute(0, i, std::vector<int>({i % 10}));
+      }
+    }
+
+    double expected [2];
+    network.SetInputs(dense_inputs);
+    ASSERT_TRUE(network.GetOutputs(expected));
+
+    double actual [2];
+    network.SetSparseInputs(indices, values, 3);
+    ASSERT_TRUE(network.GetOutputs(actual));
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-12);
+    }
+
+    ASSERT_TRUE(network.Compile());
+    EXPECT_EQ(sparse_layer != 0,
+              network.GetExecutionPlan()->GetLayer(0)->Sparse);
+    ASSERT_TRUE(network.GetOutputs(actual));
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-12);
+    }
+    InferenceWorkspace workspace;
+    ASSERT_TRUE(network.EvaluateSparse(indices, values, 3, actual,
+                                       &workspace));
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-12);
+    }
+  }
+}
+
+TEST(BackPropagationTests, SparseInputTest) {
+  // Without momentum, skipping the weights on zero inputs shouldn't change
+  // anything, since they wouldn't have changed anyway.
+  MFNetwork dense(20, 1, 6);
+  dense.AddHiddenLayer();
+  dense.RandomWeights(-1, 1);
+  dense.SetMomentum(0);
+  TanH tanh;
+  dense.SetOutputFunctions(&tanh);
+  ASSERT_TRUE(dense.ForceWeightUpdate());
+
+  MFNetwork sparse(20, 1, 6);
+  sparse.AddHiddenLayer();
+  sparse.CopyLayout(dense);
+  const size_t size = dense.GetChromosomeSize();
+  uint64_t chromosome [size];
+  ASSERT_TRUE(dense.GetChromosome(chromosome));
+  ASSERT_TRUE(sparse.SetChromosome(chromosome));
+  sparse.SetMomentum(0);
+  sparse.SetOutputFunctions(&tanh);
+
+  const uint32_t indices [] = {2, 11};
+  const double values [] = {0.5, -1};
+  double dense_inputs [20] = {};
+  dense_inputs[2] = 0.5;
+  dense_inputs[11] = -1;
+  const double target = 0.75;
+  for (int i = 0; i < 5; ++i) {
+    dense.SetInputs(dense_inputs);
+    ASSERT_TRUE(dense.PropagateError(&target));
+    sparse.SetSparseInputs(indices, values, 2);
+    ASSERT_TRUE(sparse.PropagateError(&target));
+  }
+
+  uint64_t dense_weights [size];
+  uint64_t sparse_weights [size];
+  ASSERT_TRUE(dense.GetChromosome(dense_weights));
+  ASSERT_TRUE(sparse.GetChromosome(sparse_weights));
+  for (size_t i = 0; i < size; ++i) {
+    double dense_weight, sparse_weight;
+    memcpy(&dense_weight, &dense_weights[i], sizeof(dense_weight));
+    memcpy(&sparse_weight, &sparse_weights[i], sizeof(sparse_weight));
+    EXPECT_NEAR(dense_weight, sparse_weight, 1e-12);
+  }
+}
+
+TEST(CompiledTests, OutputSubsetTest) {
+  // Asking for some of the outputs should give the same values as asking for
+  // all of them, and only compute what those outputs need.
+  MFNetwork network(4, 6, 8);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.5);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+  // Make two heads: the first half of the hidden layer feeds the first three
+  // outputs, and the second half feeds the rest.
+  for (int i = 0; i < 8; ++i) {
+    const int first = i < 4 ? 0 : 3;
+    network.SetOutputRoute(1, i, std::vector<int>({first, first + 1,
+                                                   first + 2}));
+  }
+
+  const double inputs [] = {0.5, -0.25, 1, 0};
+  double expected [6];
+  network.SetInputs(inputs);
+  ASSERT_TRUE(network.GetOutputs(expected));
+
+  const uint32_t output_ids [] = {4, 1};
+  double actual [2];
+  for (int i = 0; i < 2; ++i) {
+    // The second time around, the cone should come from the cache.
+    ASSERT_TRUE(network.GetOutputsSubset(output_ids, 2, actual));
+    EXPECT_NEAR(expected[4], actual[0], 1e-12);
+    EXPECT_NEAR(expected[1], actual[1], 1e-12);
+  }
+  const uint32_t one_head [] = {5};
+  ASSERT_TRUE(network.GetOutputsSubset(one_head, 1, actual));
+  EXPECT_NEAR(expected[5], actual[0], 1e-12);
+
+  // One head only needs half of the hidden layer.
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+  ExecutionPlan::OutputCone cone;
+  ASSERT_TRUE(plan->BuildCone(one_head, 1, &cone));
+  ASSERT_EQ(2u, cone.Rows.size());
+  EXPECT_EQ(std::vector<uint32_t>({4, 5, 6, 7}), cone.Rows[0]);
+  EXPECT_EQ(std::vector<uint32_t>({5}), cone.Rows[1]);
+
+  // Changing the network should invalidate the cached cone.
+  network.SetLayerBiases(2, -1);
+  ASSERT_TRUE(network.GetOutputs(expected));
+  ASSERT_TRUE(network.GetOutputsSubset(one_head, 1, actual));
+  EXPECT_NEAR(expected[5], actual[0], 1e-12);
+
+  const uint32_t bad_output [] = {6};
+  EXPECT_FALSE(network.GetOutputsSubset(bad_output, 1, actual));
+}
+
+TEST(CompiledTests, OutputSubsetStaleTest) {
+  // Neurons left over from an earlier call that aren't in the cone shouldn't
+  // affect the outputs, even if they were infinite.
+  MFNetwork network(4, 6, 8);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  for (int i = 0; i < 8; ++i) {
+    const int first = i < 4 ? 0 : 3;
+    network.SetOutputRoute(1, i, std::vector<int>({first, first + 1,
+                                                   first + 2}));
+  }
+  const ExecutionPlan *plan = network.GetExecutionPlan();
+  ASSERT_NE(nullptr, plan);
+  // The output layer is only half connected, but still stored dense.
+  ASSERT_FALSE(plan->GetLayer(1)->Connections.empty());
+  ASSERT_FALSE(plan->GetLayer(1)->Sparse);
+
+  InferenceWorkspace workspace;
+  const double infinite [] = {INFINITY, INFINITY, INFINITY, INFINITY};
+  double outputs [6];
+  ASSERT_TRUE(plan->Run(infinite, outputs, &workspace));
+
+  const double inputs [] = {0.5, -0.25, 1, 0};
+  double expected [6];
+  ASSERT_TRUE(plan->Run(inputs, expected, &workspace));
+  ASSERT_TRUE(plan->Run(infinite, outputs, &workspace));
+  const uint32_t one_head [] = {5};
+  ExecutionPlan::OutputCone cone;
+  ASSERT_TRUE(plan->BuildCone(one_head, 1, &cone));
+  double actual;
+  ASSERT_TRUE(plan->RunCone(cone, inputs, &actual, &workspace));
+  EXPECT_NEAR(expected[5], actual, 1e-12);
+}
+
+TEST(CompiledTests, TransposedTest) {
+  // Multiplying by the transpose of a layer should give the same results
+  // whether or not the layer is sparse.
+  ExecutionPlan plan;
+  plan.SetMaxSparseDensity(0.5);
+  plan.Reset(5);
+  ExecutionPlan::Layer *layer = plan.AddLayer(4);
+  DumbOutputer dumb;
+  layer->Impulses.assign(4, &dumb);
+  for (uint32_t row = 0; row < 4; ++row) {
+    for (uint32_t column = row % 2; column < 5; column += 3) {
+      layer->Weights[row * layer->Stride + column] = row - 0.5 * column;
+      layer->Connections.push_back(row * 5 + column);
+    }
+  }
+  plan.FinishLayer(layer);
+  ASSERT_TRUE(layer->Sparse);
+
+  const double errors [] = {1, -2, 0.5, 3};
+  double expected [5] = {0, 0, 0, 0, 0};
+  for (uint32_t row = 0; row < 4; ++row) {
+    for (uint32_t column = 0; column < 5; ++column) {
+      expected[column] += layer->Weights[row * layer->Stride + column] *
+                          errors[row];
+    }
+  }
+
+  double sparse [5];
+  plan.RunLayerTransposed(0, errors, sparse);
+  plan.SetMaxSparseDensity(0);
+  plan.FinishLayer(layer);
+  ASSERT_FALSE(layer->Sparse);
+  double dense [5];
+  plan.RunLayerTransposed(0, errors, dense);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_NEAR(expected[i], sparse[i], 1e-12);
+    EXPECT_NEAR(expected[i], dense[i], 1e-12);
+  }
+}
+
+TEST(CompiledTests, TransposedThreadPoolTest) {
+  // Splitting up the errors flowing back through a wide dense layer across
+  // threads should give exactly the same results as doing it on one.
+  constexpr uint32_t kInputs = 150;
+  constexpr uint32_t kOutputs = 60;
+  ExecutionPlan plan;
+  plan.Reset(kInputs);
+  ExecutionPlan::Layer *layer = plan.AddLayer(kOutputs);
+  DumbOutputer dumb;
+  layer->Impulses.assign(kOutputs, &dumb);
+  for (uint32_t row = 0; row < kOutputs; ++row) {
+    for (uint32_t column = 0; column < kInputs; ++column) {
+      layer->Weights[row * layer->Stride + column] =
+          ((row * 7919 + column * 104729) % 200) / 100.0 - 1;
+    }
+  }
+  plan.FinishLayer(layer);
+  ASSERT_FALSE(layer->Sparse);
+
+  double errors [kOutputs];
+  for (uint32_t row = 0; row < kOutputs; ++row) {
+    errors[row] = ((row * 31) % 17) / 8.0 - 1;
+  }
+  double serial [kInputs];
+  plan.RunLayerTransposed(0, errors, serial);
+  helpers::ThreadPool pool(3);
+  plan.SetThreadPool(&pool, 8);
+  double parallel [kInputs];
+  plan.RunLayerTransposed(0, errors, parallel);
+  for (uint32_t i = 0; i < kInputs; ++i) {
+    EXPECT_EQ(serial[i], parallel[i]);
+  }
+}
+
+TEST(F32Tests, MatchesDoubleTest) {
+  // A float copy of a network should give almost the same outputs.
+  MFNetwork network(4, 3, 20);
+  network.AddHiddenLayers(2);
+  network.RandomWeights(-1, 1);
+  TanH tanh;
+  Sigmoid sigmoid;
+  network.SetOutputFunctions(&tanh);
+  network.SetLayerOutputFunctions(3, &sigmoid);
+
+  MFNetworkF32 network_f32;
+  ASSERT_TRUE(network_f32.CopyFrom(&network));
+  EXPECT_EQ(4u, network_f32.GetNumInputs());
+  EXPECT_EQ(3u, network_f32.GetNumOutputs());
+
+  constexpr size_t kCount = 7;
+  double inputs [kCount * 4];
+  float inputs_f32 [kCount * 4];
+  for (size_t i = 0; i < kCount * 4; ++i) {
+    inputs[i] = (rand() % 2001 - 1000) / 1000.0;
+    inputs_f32[i] = inputs[i];
+  }
+  double expected [kCount * 3];
+  float actual [kCount * 3];
+  ASSERT_TRUE(network.GetOutputsBatch(inputs, kCount, expected));
+  ASSERT_TRUE(network_f32.GetOutputsBatch(inputs_f32, kCount, actual));
+  for (size_t i = 0; i < kCount * 3; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], 1e-5);
+  }
+
+  float single [3];
+  network_f32.SetInputs(inputs_f32);
+  ASSERT_TRUE(network_f32.GetOutputs(single));
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_NEAR(actual[i], single[i], 1e-6);
+  }
+}
+
+TEST(F32Tests, ChromosomeTest) {
+  // The chromosome should hold two weights per element, and only the weights
+  // for connections that exist.
+  MFNetwork network(2, 1, 3);
+  network.AddHiddenLayer();
+  network.SetWeights(1);
+  network.SetOutputRoute(0, 0, std::vector<int>({0}));
+  network.SetOutputRoute(0, 1, std::vector<int>({0, 1, 2}));
+  MFNetworkF32 network_f32;
+  EXPECT_EQ(0u, network_f32.GetChromosomeSize());
+  ASSERT_TRUE(network_f32.CopyFrom(&network));
+
+  // 4 hidden weights, 3 output weights and 4 biases.
+  const size_t size = network_f32.GetChromosomeSize();
+  ASSERT_EQ(6u, size);
+  uint64_t chromosome [size];
+  ASSERT_TRUE(network_f32.GetChromosome(chromosome));
+  float values [size * 2];
+  memcpy(values, chromosome, sizeof(chromosome));
+  const float expected [] = {1, 1, 0, 1, 0, 1, 0, 1, 1, 1, 0, 0};
+  for (size_t i = 0; i < size * 2; ++i) {
+    EXPECT_EQ(expected[i], values[i]);
+  }
+
+  // Double the weight on the second input to the first hidden neuron.
+  values[1] = 2;
+  memcpy(chromosome, values, sizeof(chromosome));
+  ASSERT_TRUE(network_f32.SetChromosome(chromosome));
+  const float inputs [2] = {1, 1};
+  float output;
+  network_f32.SetInputs(inputs);
+  ASSERT_TRUE(network_f32.GetOutputs(&output));
+  EXPECT_EQ(3 + 1 + 1, output);
+}
+
+TEST(F32Tests, FileIOTest) {
+  // Can we save and load float networks?
+  const char *file_path = "test_f32.bin";
+  MFNetwork network(3, 2, 4);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetOutputRoute(1, 2, std::vector<int>({1}));
+  Sigmoid sigmoid;
+  network.SetLayerOutputFunctions(1, &sigmoid);
+  MFNetworkF32 network_f32;
+  EXPECT_FALSE(network_f32.SaveToFile(file_path));
+  ASSERT_TRUE(network_f32.CopyFrom(&network));
+  ASSERT_TRUE(network_f32.SaveToFile(file_path));
+
+  MFNetworkF32 network2;
+  ASSERT_TRUE(network2.ReadFromFile(file_path));
+  // Impulse functions have to be set again.
+  EXPECT_FALSE(network2.SetLayerOutputFunctions(3, &sigmoid));
+  ASSERT_TRUE(network2.SetLayerOutputFunctions(1, &sigmoid));
+  EXPECT_EQ(network_f32.GetSerializedSize(), network2.GetSerializedSize());
+
+  const float inputs [3] = {0.5, -0.25, 1};
+  float expected [2];
+  float actual [2];
+  network_f32.SetInputs(inputs);
+  network2.SetInputs(inputs);
+  ASSERT_TRUE(network_f32.GetOutputs(expected));
+  ASSERT_TRUE(network2.GetOutputs(actual));
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_EQ(expected[i], actual[i]);
+  }
+}
+
+TEST(F32Tests, OutOfOrderConnectionsTest) {
+  // Files with connections that aren't in increasing order should be
+  // rejected.
+  MFNetwork network(2, 2, 3);
+  network.AddHiddenLayer();
+  network.RandomWeights(-1, 1);
+  network.SetOutputRoute(1, 0, std::vector<int>({1}));
+  MFNetworkF32 network_f32;
+  ASSERT_TRUE(network_f32.CopyFrom(&network));
+  std::vector<char> buffer(network_f32.GetSerializedSize());
+  ASSERT_EQ(buffer.size(), network_f32.Serialize(buffer.data()));
+
+  // Find the connections of the output layer, which come after the layout,
+  // the first layer and the counts for the second.
+  uint32_t first_connections;
+  memcpy(&first_connections, &buffer[12], sizeof(first_connections));
+  const size_t start = 16 + first_connections * 4 + 8;
+  uint32_t connections [2];
+  memcpy(connections, &buffer[start], sizeof(connections));
+  ASSERT_LT(connections[0], connections[1]);
+
+  MFNetworkF32 loaded;
+  EXPECT_EQ(buffer.size(), loaded.Deserialize(buffer.data()));
+  std::swap(connections[0], connections[1]);
+  memcpy(&buffer[start], connections, sizeof(connections));
+  EXPECT_EQ(0u, loaded.Deserialize(buffer.data()));
+  // Repeats aren't allowed either.
+  connections[0] = connections[1];
+  memcpy(&buffer[start], connections, sizeof(connections));
+  EXPECT_EQ(0u, loaded.Deserialize(buffer.data()));
+}
+
 TEST(GenAlgTest, ChromosomeMethodsTest) {
   // Test whether we can get and set chromosomes correctly.
   MFNetwork network (1, 1, 2);
@@ -1,5 +1,8 @@
 // Tests for neuron class.
 
+#include <string.h>
+
+#include <cmath>
 #include <vector>
 
 #include "gtest/gtest.h"
@@ -42,6 +45,154 @@ TEST(NeuronTest, WillFailTest) {
   EXPECT_FALSE(neuron.GetOutput(&output));
 }
 
+TEST(NeuronTest, ApplySignalTest) {
+  // Does ApplySignal() adjust the weights the same way AdjustWeights() does,
+  // when it's given the signal and inputs directly?
+  Sigmoid sigmoid;
+  const std::vector<double> inputs = {0.5, -1, 2};
+  Neuron adjusted;
+  Neuron applied;
+  for (Neuron *neuron : {&adjusted, &applied}) {
+    neuron->SetOutputFunction(&sigmoid);
+    neuron->SetWeights({0.1, 0.2, 0.3});
+    neuron->SetBias(0.4);
+    neuron->SetInputs(inputs);
+  }
+
+  // Twice, so that momentum comes into it.
+  for (int pass = 0; pass < 2; ++pass) {
+    double output;
+    ASSERT_TRUE(adjusted.GetOutput(&output));
+    ASSERT_TRUE(adjusted.AdjustWeights(0.1, 0.9, 1 - output));
+    applied.ApplySignal(0.1, 0.9, sigmoid.Derivative(output) * (1 - output),
+                        inputs.data());
+
+    std::vector<double> expected;
+    std::vector<double> actual;
+    adjusted.GetWeights(&expected);
+    applied.GetWeights(&actual);
+    ASSERT_EQ(expected.size(), actual.size());
+    for (uint32_t i = 0; i < expected.size(); ++i) {
+      EXPECT_DOUBLE_EQ(expected[i], actual[i]);
+    }
+    EXPECT_DOUBLE_EQ(adjusted.GetBias(), applied.GetBias());
+  }
+}
+
+TEST(NeuronTest, OptimizeTest) {
+  // Does Optimize() leave weights with zero values alone, state and all, when
+  // asked to?
+  Adam adam;
+  Neuron neuron;
+  neuron.SetWeights({0.1, 0.2, 0.3, 0.4});
+  const double values[] = {1, 0, 0, -2};
+  // Two arrays of state, for four weights and the bias.
+  std::vector<double> state(2 * 5, 0);
+  neuron.Optimize(adam, 1, 0.5, values, 0.5, state.data(), 5, true);
+
+  std::vector<double> weights;
+  neuron.GetWeights(&weights);
+  EXPECT_GT(weights[0], 0.1);
+  EXPECT_EQ(0.2, weights[1]);
+  EXPECT_EQ(0.3, weights[2]);
+  EXPECT_LT(weights[3], 0.4);
+  EXPECT_GT(neuron.GetBias(), 0);
+  for (uint32_t i : {1, 2}) {
+    EXPECT_EQ(0, state[i]);
+    EXPECT_EQ(0, state[5 + i]);
+  }
+  // On the first step, Adam moves every weight by about the learning rate.
+  EXPECT_NEAR(0.101, weights[0], 1e-6);
+  EXPECT_NEAR(0.399, weights[3], 1e-6);
+  EXPECT_NEAR(0.001, neuron.GetBias(), 1e-6);
+}
+
+TEST(ImpulseTest, LayerWideTest) {
+  // Do the layer-wide versions of the built-in impulse functions match the
+  // virtual ones?
+  DumbOutputer dumb;
+  Threshold threshold(0.5);
+  Sigmoid sigmoid;
+  TanH tanh;
+  Linear linear(2);
+  ImpulseFunction *impulses[] = {&dumb, &threshold, &sigmoid, &tanh, &linear};
+  const double inputs[] = {-3, -0.5, 0, 0.25, 0.5, 2};
+  constexpr size_t kSize = sizeof(inputs) / sizeof(inputs[0]);
+
+  for (ImpulseFunction *impulse : impulses) {
+    double values[kSize];
+    memcpy(values, inputs, sizeof(inputs));
+    ApplyImpulse(impulse->GetType(), impulse->GetParameter(), values, kSize);
+    for (size_t i = 0; i < kSize; ++i) {
+      EXPECT_NEAR(impulse->Function(inputs[i]), values[i], 1e-15);
+    }
+
+    if (impulse == &threshold) {
+      // This one isn't differentiable.
+      continue;
+    }
+    double derivatives[kSize];
+    ApplyDerivative(impulse->GetType(), impulse->GetParameter(), values,
+                    derivatives, kSize);
+    for (size_t i = 0; i < kSize; ++i) {
+      EXPECT_NEAR(impulse->Derivative(values[i]), derivatives[i], 1e-12);
+    }
+  }
+}
+
+TEST(ImpulseTest, ApproximationTest) {
+  // Do the approximations stay within their documented error bounds?
+  Sigmoid sigmoid;
+  TanH tanh;
+  struct Case {
+    ImpulseFunction *Impulse;
+    ImpulseAccuracy Accuracy;
+    double MaxError;
+    double MaxFloatError;
+  };
+  const Case cases[] = {{&tanh, ImpulseAccuracy::RATIONAL, 3e-7, 4.5e-7},
+                        {&sigmoid, ImpulseAccuracy::RATIONAL, 1.5e-7, 2.5e-7},
+                        {&tanh, ImpulseAccuracy::TABLE, 1.5e-6, 1.6e-6},
+                        {&sigmoid, ImpulseAccuracy::TABLE, 7.5e-7, 8e-7}};
+  // A fine grid, reaching well past where the functions saturate.
+  std::vector<double> inputs;
+  for (double x = -40; x <= 40; x += 0.0007) {
+    inputs.push_back(x);
+  }
+
+  for (const Case& item : cases) {
+    std::vector<double> values(inputs);
+    ApplyImpulse(item.Impulse->GetType(), item.Impulse->GetParameter(),
+                 values.data(), values.size(), item.Accuracy);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      ASSERT_NEAR(item.Impulse->Function(inputs[i]), values[i], item.MaxError)
+          << "x = " << inputs[i];
+    }
+
+    // The float versions, compared with the exact function of the same
+    // float input.
+    std::vector<float> float_values(inputs.begin(), inputs.end());
+    ApplyImpulse(item.Impulse->GetType(), item.Impulse->GetParameter(),
+                 float_values.data(), float_values.size(), item.Accuracy);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+      const float input = inputs[i];
+      ASSERT_NEAR(item.Impulse->Function(input), float_values[i],
+                  item.MaxFloatError) << "x = " << input;
+    }
+
+    // NaN should come through as NaN, like it does from the exact function,
+    // instead of being clamped to one end of the range.
+    double nan = NAN;
+    ApplyImpulse(item.Impulse->GetType(), item.Impulse->GetParameter(), &nan,
+                 1, item.Accuracy);
+    EXPECT_TRUE(std::isnan(nan));
+    float float_nan = NAN;
+    ApplyImpulse(item.Impulse->GetType(), item.Impulse->GetParameter(),
+                 &float_nan, 1, item.Accuracy);
+    EXPECT_TRUE(std::isnan(float_nan));
+  }
+}
+
 } //testing
 } //network
 
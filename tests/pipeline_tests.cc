@@ -0,0 +1,143 @@
+// Tests for the layer pipeline.
+
+#include <time.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+#include "../pipeline.h"
+
+namespace network {
+namespace test {
+
+namespace {
+
+const int kNumSamples = 500;
+
+} // namespace
+
+class PipelineTest : public ::testing::Test {
+ protected:
+  PipelineTest() : network_(6, 3, 10) {}
+
+  virtual void SetUp() {
+    for (int i = 0; i < 4; ++i) {
+      network_.AddHiddenLayer();
+    }
+    network_.RandomWeights(-1, 1);
+    network_.SetOutputFunctions(&tanh_);
+    ASSERT_TRUE(network_.Compile());
+    plan_ = network_.GetExecutionPlan();
+    ASSERT_NE(nullptr, plan_);
+  }
+
+  // Makes up some inputs for sample <i>.
+  static std::vector<double> MakeInputs(int i) {
+    return std::vector<double>({0.1 * i, -0.2 * i, 1, (i % 7) - 3.0,
+                                (i % 3) * 0.5, -1});
+  }
+
+  // Checks that <outputs> are what the plan gives for sample <i>.
+  void ExpectCorrect(int i, const double *outputs) {
+    double expected [3];
+    InferenceWorkspace workspace;
+    ASSERT_TRUE(plan_->Run(MakeInputs(i).data(), expected, &workspace));
+    for (int j = 0; j < 3; ++j) {
+      EXPECT_NEAR(expected[j], outputs[j], 1e-12) << "Sample " << i;
+    }
+  }
+
+  TanH tanh_;
+  MFNetwork network_;
+  const ExecutionPlan *plan_;
+};
+
+TEST_F(PipelineTest, StagesTest) {
+  // Stages should cover every layer, in order, without any empty ones.
+  for (uint32_t num_stages = 1; num_stages <= 8; ++num_stages) {
+    InferencePipeline pipeline(plan_, num_stages, 4);
+    const uint32_t expected =
+        std::min(num_stages, plan_->GetNumLayers());
+    ASSERT_EQ(expected, pipeline.GetNumStages());
+    uint32_t begin = 0;
+    for (uint32_t stage_i = 0; stage_i < expected; ++stage_i) {
+      EXPECT_GT(pipeline.GetStageEnd(stage_i), begin);
+      begin = pipeline.GetStageEnd(stage_i);
+    }
+    EXPECT_EQ(plan_->GetNumLayers(), begin);
+  }
+}
+
+TEST_F(PipelineTest, OrderTest) {
+  // Outputs should come out in the same order as the inputs went in, with
+  // one thread feeding the pipeline and another draining it.
+  for (uint32_t num_stages = 1; num_stages <= 5; ++num_stages) {
+    InferencePipeline pipeline(plan_, num_stages, 8);
+    std::thread producer([&pipeline]() {
+      for (int i = 0; i < kNumSamples; ++i) {
+        pipeline.Push(MakeInputs(i).data());
+      }
+    });
+    double outputs [3];
+    for (int i = 0; i < kNumSamples; ++i) {
+      pipeline.Pop(outputs);
+      ExpectCorrect(i, outputs);
+    }
+    producer.join();
+    EXPECT_FALSE(pipeline.TryPop(outputs));
+  }
+}
+
+TEST_F(PipelineTest, SingleThreadTest) {
+  // One thread can do both, as long as it doesn't overfill the pipeline.
+  InferencePipeline pipeline(plan_, 3, 2);
+  double outputs [3];
+  for (int i = 0; i < kNumSamples; i += 2) {
+    pipeline.Push(MakeInputs(i).data());
+    pipeline.Push(MakeInputs(i + 1).data());
+    pipeline.Pop(outputs);
+    ExpectCorrect(i, outputs);
+    pipeline.Pop(outputs);
+    ExpectCorrect(i + 1, outputs);
+  }
+}
+
+TEST_F(PipelineTest, ShutdownTest) {
+  // Destroying a pipeline with samples still in it shouldn't hang.
+  InferencePipeline pipeline(plan_, 4, 2);
+  for (int i = 0; i < 4; ++i) {
+    pipeline.Push(MakeInputs(i).data());
+  }
+}
+
+TEST_F(PipelineTest, IdleTest) {
+  // An idle pipeline should put its threads to sleep, rather than keep them
+  // spinning. Spinning, the four stages and the thread waiting in Pop() would
+  // take up every core they could get, even if there were only one.
+  InferencePipeline pipeline(plan_, 4, 2);
+  double outputs [3];
+  pipeline.Push(MakeInputs(0).data());
+  pipeline.Pop(outputs);
+  ExpectCorrect(0, outputs);
+
+  std::thread consumer([&pipeline, &outputs]() {
+    pipeline.Pop(outputs);
+  });
+  const clock_t start = clock();
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  const double seconds = static_cast<double>(clock() - start) / CLOCKS_PER_SEC;
+  EXPECT_LT(seconds, 0.1);
+
+  // Anything asleep should wake up again once there is work.
+  pipeline.Push(MakeInputs(1).data());
+  consumer.join();
+  ExpectCorrect(1, outputs);
+}
+
+} // test
+} // network
@@ -0,0 +1,107 @@
+// Tests for int8 quantized networks.
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+#include "../quantized_network.h"
+
+namespace network {
+namespace test {
+
+// How many sets of inputs to calibrate with.
+const size_t kSamples = 200;
+
+// Makes a network with some random weights, and some inputs to calibrate it
+// with.
+class QuantizedTest : public ::testing::Test {
+ protected:
+  QuantizedTest() : network_(8, 4, 32) {}
+
+  virtual void SetUp() {
+    network_.AddHiddenLayers(2);
+    network_.RandomWeights(-1, 1);
+    network_.SetOutputFunctions(&tanh_);
+    network_.SetLayerOutputFunctions(3, &sigmoid_);
+    for (size_t i = 0; i < kSamples * 8; ++i) {
+      calibration_.push_back((rand() % 2001 - 1000) / 1000.0);
+    }
+  }
+
+  MFNetwork network_;
+  TanH tanh_;
+  Sigmoid sigmoid_;
+  std::vector<double> calibration_;
+};
+
+TEST_F(QuantizedTest, MatchesFullPrecisionTest) {
+  QuantizedNetwork quantized;
+  QuantizationReport report;
+  EXPECT_FALSE(quantized.Quantize(&network_, calibration_.data(), 0));
+  ASSERT_TRUE(quantized.Quantize(&network_, calibration_.data(), kSamples,
+                                 QuantizationGranularity::PER_NEURON,
+                                 &report));
+  EXPECT_EQ(8u, quantized.GetNumInputs());
+  EXPECT_EQ(4u, quantized.GetNumOutputs());
+  EXPECT_EQ(kSamples, report.Samples);
+  EXPECT_GT(report.MaxOutput, 0.5);
+  EXPECT_LT(report.MaxError, 0.05);
+  EXPECT_LT(report.MeanError, 0.01);
+  EXPECT_GE(report.ArgmaxAgreement, 0.9);
+
+  // Does the report actually describe the outputs?
+  float inputs [8];
+  for (int i = 0; i < 8; ++i) {
+    inputs[i] = calibration_[i];
+  }
+  float actual [4];
+  double expected [4];
+  ASSERT_TRUE(quantized.GetOutputs(inputs, actual));
+  network_.SetInputs(calibration_.data());
+  ASSERT_TRUE(network_.GetOutputs(expected));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_NEAR(expected[i], actual[i], report.MaxError + 1e-6);
+  }
+
+  // Per-layer scales should work too, if not quite as well.
+  QuantizationReport layer_report;
+  ASSERT_TRUE(quantized.Quantize(&network_, calibration_.data(), kSamples,
+                                 QuantizationGranularity::PER_LAYER,
+                                 &layer_report));
+  EXPECT_LT(layer_report.MaxError, 0.1);
+  EXPECT_GE(layer_report.ArgmaxAgreement, 0.8);
+}
+
+TEST_F(QuantizedTest, FileIOTest) {
+  // Can we save and load quantized networks, and are they small?
+  const char *file_path = "test_quantized.bin";
+  QuantizedNetwork quantized;
+  EXPECT_FALSE(quantized.SaveToFile(file_path));
+  ASSERT_TRUE(quantized.Quantize(&network_, calibration_.data(), kSamples));
+  ASSERT_TRUE(quantized.SaveToFile(file_path));
+  EXPECT_LT(quantized.GetSerializedSize() * 5,
+            network_.GetSerializedSize());
+
+  QuantizedNetwork loaded;
+  ASSERT_TRUE(loaded.ReadFromFile(file_path));
+  EXPECT_FALSE(loaded.SetLayerOutputFunctions(0, &tanh_));
+  ASSERT_TRUE(loaded.SetLayerOutputFunctions(1, &tanh_));
+  ASSERT_TRUE(loaded.SetLayerOutputFunctions(2, &tanh_));
+  ASSERT_TRUE(loaded.SetLayerOutputFunctions(3, &sigmoid_));
+
+  float inputs [8] = {0.1, -0.2, 0.3, -0.4, 0.5, -0.6, 0.7, -0.8};
+  float expected [4];
+  float actual [4];
+  QuantizedWorkspace workspace;
+  ASSERT_TRUE(quantized.Evaluate(inputs, expected, &workspace));
+  ASSERT_TRUE(loaded.Evaluate(inputs, actual, &workspace));
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_EQ(expected[i], actual[i]);
+  }
+}
+
+} // test
+} // network
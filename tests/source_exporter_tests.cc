@@ -0,0 +1,89 @@
+// Tests for exporting networks as source code.
+
+#include <math.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "gtest/gtest.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+#include "../source_exporter.h"
+
+namespace network {
+namespace test {
+namespace {
+
+// Exports <network> and returns the generated source, or an empty string if
+// it fails.
+std::string Export(MFNetwork *network, const char *name) {
+  FILE *out = tmpfile();
+  if (!out) {
+    return "";
+  }
+  std::string source;
+  if (ExportSource(network, name, out)) {
+    rewind(out);
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), out)) > 0) {
+      source.append(buffer, read);
+    }
+  }
+  fclose(out);
+  return source;
+}
+
+// An impulse function that can't be exported.
+class Squarer : public ImpulseFunction {
+ public:
+  virtual double Function(double input) {
+    return input * input;
+  }
+  virtual double Derivative(double output) {
+    return 2 * sqrt(output);
+  }
+};
+
+} // namespace
+
+TEST(SourceExporterTest, ExportTest) {
+  // The generated header should have the right shape, all the weights, and
+  // the impulse functions of each layer.
+  MFNetwork network(3, 2, 4);
+  network.AddHiddenLayer();
+  network.SetWeights(0.5);
+  network.SetBiases(0.25);
+  TanH tanh;
+  Sigmoid sigmoid;
+  network.SetLayerOutputFunctions(1, &tanh);
+  network.SetLayerOutputFunctions(2, &sigmoid);
+
+  const std::string source = Export(&network, "small_net");
+  ASSERT_FALSE(source.empty());
+  EXPECT_NE(std::string::npos, source.find("namespace small_net {"));
+  EXPECT_NE(std::string::npos, source.find("kNumInputs = 3;"));
+  EXPECT_NE(std::string::npos, source.find("kNumOutputs = 2;"));
+  EXPECT_NE(std::string::npos, source.find("kLayer0Weights[12]"));
+  EXPECT_NE(std::string::npos, source.find("kLayer1Biases[2]"));
+  EXPECT_NE(std::string::npos, source.find("0.25,"));
+  EXPECT_NE(std::string::npos, source.find("tanh(sum)"));
+  EXPECT_NE(std::string::npos, source.find("1 / (1 + exp(-sum))"));
+  EXPECT_NE(std::string::npos,
+            source.find("inline void Evaluate(const double *inputs, "
+                        "double *outputs)"));
+}
+
+TEST(SourceExporterTest, CustomImpulseTest) {
+  // Custom impulse functions can't be turned into source code.
+  MFNetwork network(2, 1, 3);
+  network.AddHiddenLayer();
+  network.SetWeights(1);
+  Squarer squarer;
+  network.SetLayerOutputFunctions(1, &squarer);
+
+  EXPECT_TRUE(Export(&network, "custom_net").empty());
+}
+
+} // test
+} // network
@@ -0,0 +1,89 @@
+// Tests for networks with a fixed shape.
+
+#include <stdlib.h>
+
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../multilayered_feedforward.h"
+#include "../output_functions.h"
+#include "../static_network.h"
+
+namespace network {
+namespace test {
+
+TEST(StaticNetworkTest, MatchesMFNetworkTest) {
+  // A static network loaded from a file should compute the same thing as the
+  // network that saved it.
+  const char *file_path = "test_static.bin";
+  MFNetwork network(3, 2, 5);
+  network.AddHiddenLayer();
+  network.AddHiddenLayer(4);
+  network.RandomWeights(-1, 1);
+  network.SetBiases(0.25);
+  TanH tanh;
+  network.SetOutputFunctions(&tanh);
+  ASSERT_TRUE(network.SaveToFile(file_path));
+
+  StaticMFNetwork<TanH, 3, 5, 4, 2> static_network;
+  EXPECT_EQ(3u, (StaticMFNetwork<TanH, 3, 5, 4, 2>::kNumInputs));
+  EXPECT_EQ(2u, (StaticMFNetwork<TanH, 3, 5, 4, 2>::kNumOutputs));
+  ASSERT_TRUE(static_network.ReadFromFile(file_path));
+
+  for (int trial = 0; trial < 10; ++trial) {
+    double inputs [3];
+    for (int i = 0; i < 3; ++i) {
+      inputs[i] = (rand() % 2001 - 1000) / 1000.0;
+    }
+    double expected [2];
+    double actual [2];
+    network.SetInputs(inputs);
+    ASSERT_TRUE(network.GetOutputs(expected));
+    static_network.Evaluate(inputs, actual);
+    for (int i = 0; i < 2; ++i) {
+      EXPECT_NEAR(expected[i], actual[i], 1e-12);
+    }
+  }
+}
+
+TEST(StaticNetworkTest, ShapeMismatchTest) {
+  // Loading a network with a different shape should fail.
+  MFNetwork network(3, 2, 5);
+  network.AddHiddenLayer();
+  network.SetWeights(1);
+
+  StaticMFNetwork<Sigmoid, 3, 5, 2> matching;
+  EXPECT_TRUE(matching.CopyFrom(&network));
+  StaticMFNetwork<Sigmoid, 3, 4, 2> too_narrow;
+  EXPECT_FALSE(too_narrow.CopyFrom(&network));
+  StaticMFNetwork<Sigmoid, 3, 5, 5, 2> too_deep;
+  EXPECT_FALSE(too_deep.CopyFrom(&network));
+  StaticMFNetwork<Sigmoid, 2, 5, 2> wrong_inputs;
+  EXPECT_FALSE(wrong_inputs.CopyFrom(&network));
+}
+
+TEST(StaticNetworkTest, ParameterTest) {
+  // Impulse functions with parameters get them through the constructor, and
+  // the output routing is respected.
+  MFNetwork network(1, 2, 2);
+  network.AddHiddenLayer();
+  network.SetWeights(1);
+  network.SetLayerWeights(1, std::vector<double>({2}));
+  network.SetOutputRoute(2, 0, std::vector<int>({1}));
+  network.SetOutputRoute(2, 1, std::vector<int>({0}));
+  network.SetLayerBiases(2, 1);
+  network.GetNeuron(2, 1)->SetBias(0);
+
+  StaticMFNetwork<Linear, 1, 2, 2> static_network(3);
+  ASSERT_TRUE(static_network.CopyFrom(&network));
+  const double inputs [1] = {1};
+  double outputs [2];
+  static_network.Evaluate(inputs, outputs);
+  // The hidden neurons output 3 * 2 = 6, so the output neurons get 12 and
+  // 12 + 1, times 3.
+  EXPECT_EQ(36, outputs[0]);
+  EXPECT_EQ(39, outputs[1]);
+}
+
+} // test
+} // network
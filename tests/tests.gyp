@@ -50,5 +50,104 @@
         'learner_tests.cc',
       ],
     },
+    {
+      'target_name': 'kernels_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'kernels_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'thread_pool_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'thread_pool_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'quantized_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'quantized_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'static_network_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'static_network_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'source_exporter_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'source_exporter_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'incremental_evaluator_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'incremental_evaluator_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'inference_cache_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'inference_cache_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'batch_scheduler_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'batch_scheduler_tests.cc',
+      ],
+    },
+    {
+      'target_name': 'pipeline_tests',
+      'type': 'executable',
+      'dependencies': [
+        '<(externals):gtest',
+        '<(DEPTH)/libneuralnet.gyp:*',
+      ],
+      'sources': [
+        'pipeline_tests.cc',
+      ],
+    },
   ],
 }
@@ -0,0 +1,69 @@
+// Tests for the thread pool.
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "../thread_pool.h"
+
+namespace helpers {
+namespace test {
+
+TEST(ThreadPoolTest, CoversRangeTest) {
+  // Does every index get visited exactly once?
+  ThreadPool pool(3);
+  EXPECT_EQ(3u, pool.GetNumThreads());
+  for (uint32_t size : {0u, 1u, 2u, 4u, 5u, 100u}) {
+    std::vector<std::atomic<int> > visits(size);
+    for (auto& count : visits) {
+      count = 0;
+    }
+    pool.ParallelFor(0, size, [&visits](uint32_t begin, uint32_t end) {
+      for (uint32_t i = begin; i < end; ++i) {
+        ++visits[i];
+      }
+    });
+    for (auto& count : visits) {
+      EXPECT_EQ(1, count);
+    }
+  }
+}
+
+TEST(ThreadPoolTest, NestedTest) {
+  // Calling ParallelFor() from inside a worker shouldn't deadlock.
+  ThreadPool pool(2);
+  std::atomic<int> total(0);
+  pool.ParallelFor(0, 8, [&pool, &total](uint32_t begin, uint32_t end) {
+    for (uint32_t i = begin; i < end; ++i) {
+      pool.ParallelFor(0, 10, [&total](uint32_t inner_begin,
+                                       uint32_t inner_end) {
+        total += inner_end - inner_begin;
+      });
+    }
+  });
+  EXPECT_EQ(80, total);
+}
+
+TEST(ThreadPoolTest, ConcurrentCallersTest) {
+  // Can several threads share a pool?
+  ThreadPool pool(2);
+  std::atomic<int> total(0);
+  std::vector<std::thread> callers;
+  for (int i = 0; i < 4; ++i) {
+    callers.emplace_back([&pool, &total]() {
+      for (int repeat = 0; repeat < 50; ++repeat) {
+        pool.ParallelFor(10, 30, [&total](uint32_t begin, uint32_t end) {
+          total += end - begin;
+        });
+      }
+    });
+  }
+  for (std::thread& caller : callers) {
+    caller.join();
+  }
+  EXPECT_EQ(4 * 50 * 20, total);
+}
+
+} // test
+} // helpers
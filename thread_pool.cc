@@ -0,0 +1,143 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+namespace helpers {
+
+ThreadPool::ThreadPool(uint32_t num_threads) {
+  for (uint32_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  condition_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Run(uint32_t begin, uint32_t end,
+                     void (*call)(const void *, uint32_t, uint32_t),
+                     const void *work) {
+  if (end <= begin) {
+    return;
+  }
+  Job job;
+  job.Call = call;
+  job.Work = work;
+  job.Begin = begin;
+  job.Total = end - begin;
+  // One piece for each worker, and one for us.
+  job.Pieces = std::min<uint32_t>(job.Total, workers_.size() + 1);
+  job.NextPiece = 0;
+  job.Remaining = job.Pieces;
+  job.Next = nullptr;
+
+  if (job.Pieces > 1) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (last_job_) {
+        last_job_->Next = &job;
+      } else {
+        first_job_ = &job;
+      }
+      last_job_ = &job;
+    }
+    condition_.notify_all();
+  }
+
+  // Do as much of it as we can ourselves.
+  uint32_t piece;
+  while ((piece = job.NextPiece++) < job.Pieces) {
+    RunPiece(&job, piece);
+  }
+
+  // Wait for everyone else. In the meantime, help out with anything that's
+  // queued, so that calling this from inside a worker can't deadlock.
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (job.Remaining) {
+    Job *other;
+    if (ClaimPiece(&other, &piece)) {
+      lock.unlock();
+      RunPiece(other, piece);
+      lock.lock();
+    } else {
+      condition_.wait(lock);
+    }
+  }
+  // Nobody can find it once it's gone from the queue.
+  RemoveJob(&job);
+}
+
+void ThreadPool::RunPiece(Job *job, uint32_t piece) {
+  const uint64_t total = job->Total;
+  job->Call(job->Work, job->Begin + total * piece / job->Pieces,
+            job->Begin + total * (piece + 1) / job->Pieces);
+  // The job can go away as soon as this reaches zero, so don't touch it
+  // afterwards. Taking the lock before signalling makes sure that the
+  // caller is either still checking Remaining or already waiting.
+  if (job->Remaining-- == 1) {
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    condition_.notify_all();
+  }
+}
+
+bool ThreadPool::ClaimPiece(Job **job, uint32_t *piece) {
+  while (first_job_) {
+    Job *first = first_job_;
+    const uint32_t claimed = first->NextPiece++;
+    if (claimed + 1 >= first->Pieces) {
+      // Nothing more to claim from this one.
+      RemoveJob(first);
+    }
+    if (claimed < first->Pieces) {
+      *job = first;
+      *piece = claimed;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ThreadPool::RemoveJob(Job *job) {
+  Job *previous = nullptr;
+  for (Job *current = first_job_; current; current = current->Next) {
+    if (current == job) {
+      if (previous) {
+        previous->Next = job->Next;
+      } else {
+        first_job_ = job->Next;
+      }
+      if (last_job_ == job) {
+        last_job_ = previous;
+      }
+      job->Next = nullptr;
+      return;
+    }
+    previous = current;
+  }
+}
+
+void ThreadPool::WorkerLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    Job *job;
+    uint32_t piece;
+    if (ClaimPiece(&job, &piece)) {
+      lock.unlock();
+      RunPiece(job, piece);
+      lock.lock();
+    } else if (stopping_) {
+      return;
+    } else {
+      condition_.wait(lock);
+    }
+  }
+}
+
+} // helpers
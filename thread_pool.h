@@ -0,0 +1,92 @@
+#ifndef NEURAL_NET_THREAD_POOL_H_
+#define NEURAL_NET_THREAD_POOL_H_
+
+// A simple pool of worker threads for splitting up loops.
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "macros.h"
+
+namespace helpers {
+
+class ThreadPool {
+ public:
+  // Starts <num_threads> worker threads, which wait around until there is
+  // work for them.
+  explicit ThreadPool(uint32_t num_threads);
+  // Waits for any queued work to finish and stops the workers.
+  ~ThreadPool();
+  // Returns the number of worker threads.
+  inline uint32_t GetNumThreads() const {
+    return workers_.size();
+  }
+  // Splits the range [<begin>, <end>) into contiguous pieces and calls
+  // <work> with the beginning and end of each of them, spreading the calls
+  // across the workers and the calling thread. It returns once all of them
+  // are done. It's fine to call this from several threads at once, and from
+  // inside <work>. This never allocates any memory.
+  template <typename Work>
+  void ParallelFor(uint32_t begin, uint32_t end, const Work& work) {
+    Run(begin, end, &CallWork<Work>, &work);
+  }
+
+  DISSALOW_COPY_AND_ASSIGN(ThreadPool);
+
+ private:
+  // Everything about one call to ParallelFor(). This lives on the stack of
+  // the caller, and workers claim pieces of it until there are none left.
+  struct Job {
+    // Calls the work with the beginning and end of a piece.
+    void (*Call)(const void *work, uint32_t begin, uint32_t end);
+    const void *Work;
+    uint32_t Begin;
+    uint32_t Total;
+    uint32_t Pieces;
+    // The next piece that hasn't been claimed yet. This can go past Pieces.
+    std::atomic<uint32_t> NextPiece;
+    // How many pieces haven't finished yet.
+    std::atomic<uint32_t> Remaining;
+    // The job after this one in the queue.
+    Job *Next;
+  };
+
+  template <typename Work>
+  static void CallWork(const void *work, uint32_t begin, uint32_t end) {
+    (*static_cast<const Work *>(work))(begin, end);
+  }
+  // Does the work for ParallelFor().
+  void Run(uint32_t begin, uint32_t end,
+           void (*call)(const void *, uint32_t, uint32_t), const void *work);
+  // Runs piece <piece> of <job>, and lets whoever is waiting on the job know
+  // if it was the last one to finish. mutex_ must not be held.
+  void RunPiece(Job *job, uint32_t piece);
+  // Claims a piece from the first job in the queue, taking jobs off of the
+  // queue once all their pieces have been claimed. mutex_ must be held.
+  // Returns false if the queue is empty.
+  bool ClaimPiece(Job **job, uint32_t *piece);
+  // Takes <job> off of the queue, if it's still there. mutex_ must be held.
+  void RemoveJob(Job *job);
+  // What the worker threads run.
+  void WorkerLoop();
+
+  std::vector<std::thread> workers_;
+  // Protects everything below.
+  std::mutex mutex_;
+  // Jobs that still have pieces that haven't been claimed, oldest first.
+  Job *first_job_ = nullptr;
+  Job *last_job_ = nullptr;
+  // Signalled when new work arrives or a job finishes.
+  std::condition_variable condition_;
+  // Set when the workers should exit.
+  bool stopping_ = false;
+};
+
+} // helpers
+
+#endif